@@ -0,0 +1,268 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Slow hardware writes (sysfs, i2c, ADB, port I/O, ALSA controls) are
+ * handed over to a dedicated thread so the input path never blocks on
+ * a slow controller.
+ *
+ * Each target has a single pending slot holding the packed value; the
+ * main thread swaps in the newest value and the actuator thread swaps
+ * it out. A burst of keypresses therefore collapses into one write, and
+ * the eventfd is only poked when the slot goes from empty to full.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sys/eventfd.h>
+
+#include <pthread.h>
+
+#include "pommed.h"
+#include "latency.h"
+#include "actuator.h"
+
+
+#define ACT_PENDING        (1ULL << 63)
+
+#define act_pack(value, arg) \
+  (ACT_PENDING | ((uint64_t)(uint16_t)(arg) << 32) | (uint32_t)(value))
+#define act_value(p)       ((int)(uint32_t)(p))
+#define act_arg(p)         ((int)(int16_t)(uint16_t)((p) >> 32))
+
+
+struct actuator_slot
+{
+  actuator_fn fn;
+  uint64_t pending;  /* packed value, 0 if empty */
+  int inflight;      /* write in progress */
+};
+
+static struct actuator_slot slots[ACT_MAX];
+
+static int act_efd = -1;
+static pthread_t act_thread;
+static int act_running;
+static int act_quit;
+
+
+static void
+actuator_wake(void)
+{
+  uint64_t one = 1;
+  int ret;
+
+  ret = write(act_efd, &one, sizeof(one));
+  if (ret != sizeof(one))
+    logmsg(LOG_ERR, "actuator: could not wake thread: %s", strerror(errno));
+}
+
+
+void
+actuator_register(int target, actuator_fn fn)
+{
+  __atomic_store_n(&slots[target].fn, fn, __ATOMIC_RELEASE);
+}
+
+/*
+ * Drop the writer and wait for any write in progress to complete.
+ * Pairs with actuator_run(): each side stores then loads the other's
+ * variable, which needs sequential consistency; with release/acquire
+ * both loads could see the old values (store buffering), and the
+ * caller would close the handle under a running write.
+ */
+void
+actuator_unregister(int target)
+{
+  struct timespec ts = { 0, 1000000 };
+
+  __atomic_store_n(&slots[target].fn, NULL, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&slots[target].pending, 0, __ATOMIC_RELEASE);
+
+  while (__atomic_load_n(&slots[target].inflight, __ATOMIC_SEQ_CST))
+    nanosleep(&ts, NULL);
+}
+
+void
+actuator_submit(int target, int value, int arg)
+{
+  actuator_fn fn;
+  uint64_t prev;
+
+  /* Before the thread is up (probing) writes are done inline */
+  if (!act_running)
+    {
+      fn = __atomic_load_n(&slots[target].fn, __ATOMIC_ACQUIRE);
+      if (fn != NULL)
+	fn(value, arg);
+
+      return;
+    }
+
+  prev = __atomic_exchange_n(&slots[target].pending, act_pack(value, arg), __ATOMIC_ACQ_REL);
+
+  /* The thread has not picked up the previous value yet, it's been replaced */
+  if (prev != 0)
+    {
+      logdebug("actuator: target %d: coalesced %d -> %d\n", target, act_value(prev), value);
+
+      return;
+    }
+
+  actuator_wake();
+}
+
+/* Queued or being written; the hardware state may lag behind */
+int
+actuator_busy(int target)
+{
+  return ((__atomic_load_n(&slots[target].pending, __ATOMIC_ACQUIRE) != 0)
+	  || __atomic_load_n(&slots[target].inflight, __ATOMIC_ACQUIRE));
+}
+
+/* For long writes (fades): a newer value is waiting, give up early */
+int
+actuator_superseded(int target)
+{
+  return (__atomic_load_n(&slots[target].pending, __ATOMIC_ACQUIRE) != 0);
+}
+
+
+static void
+actuator_run(void)
+{
+  actuator_fn fn;
+  uint64_t p;
+  int i;
+
+  for (i = 0; i < ACT_MAX; i++)
+    {
+      /* See actuator_unregister() */
+      __atomic_store_n(&slots[i].inflight, 1, __ATOMIC_SEQ_CST);
+
+      p = __atomic_exchange_n(&slots[i].pending, 0, __ATOMIC_ACQ_REL);
+      fn = __atomic_load_n(&slots[i].fn, __ATOMIC_SEQ_CST);
+
+      if ((p != 0) && (fn != NULL))
+	fn(act_value(p), act_arg(p));
+
+      __atomic_store_n(&slots[i].inflight, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static void *
+actuator_thread(void *arg)
+{
+  uint64_t n;
+  int quit;
+  int ret;
+
+  /* Hotkey writes, latency critical */
+  latency_actuator();
+
+  for (;;)
+    {
+      ret = read(act_efd, &n, sizeof(n));
+      if ((ret < 0) && (errno != EINTR))
+	{
+	  logmsg(LOG_ERR, "actuator: eventfd read failed: %s", strerror(errno));
+	  break;
+	}
+
+      /* Everything submitted before the quit request gets written */
+      quit = __atomic_load_n(&act_quit, __ATOMIC_ACQUIRE);
+
+      actuator_run();
+
+      if (quit)
+	break;
+    }
+
+  return NULL;
+}
+
+
+/*
+ * Start the thread once the backends have been probed, so it inherits
+ * the I/O privileges (iopl) some of them set up.
+ */
+int
+actuator_init(void)
+{
+  pthread_attr_t attr;
+  int ret;
+
+  act_quit = 0;
+
+  act_efd = eventfd(0, EFD_CLOEXEC);
+  if (act_efd < 0)
+    {
+      logmsg(LOG_ERR, "actuator: could not create eventfd: %s", strerror(errno));
+
+      return -1;
+    }
+
+  pthread_attr_init(&attr);
+  latency_thread_attr(&attr);
+
+  ret = pthread_create(&act_thread, &attr, actuator_thread, NULL);
+
+  pthread_attr_destroy(&attr);
+
+  if (ret != 0)
+    {
+      logmsg(LOG_ERR, "actuator: could not create thread: %s", strerror(ret));
+
+      close(act_efd);
+      act_efd = -1;
+
+      return -1;
+    }
+
+  act_running = 1;
+
+  return 0;
+}
+
+/* Flushes pending writes before returning */
+void
+actuator_cleanup(void)
+{
+  if (!act_running)
+    return;
+
+  __atomic_store_n(&act_quit, 1, __ATOMIC_RELEASE);
+  actuator_wake();
+
+  pthread_join(act_thread, NULL);
+
+  act_running = 0;
+
+  close(act_efd);
+  act_efd = -1;
+}
@@ -0,0 +1,44 @@
+/*
+ * pommed - actuator.h
+ */
+
+#ifndef __ACTUATOR_H__
+#define __ACTUATOR_H__
+
+
+/* Hardware write targets; only the newest value queued for a target is written */
+enum
+  {
+    ACT_LCD = 0,
+    ACT_KBD,
+    ACT_VOLUME,
+    ACT_MUTE,
+    ACT_MAX /* keep this one last */
+  };
+
+typedef void(*actuator_fn)(int value, int arg);
+
+
+void
+actuator_register(int target, actuator_fn fn);
+
+void
+actuator_unregister(int target);
+
+void
+actuator_submit(int target, int value, int arg);
+
+int
+actuator_busy(int target);
+
+int
+actuator_superseded(int target);
+
+int
+actuator_init(void);
+
+void
+actuator_cleanup(void);
+
+
+#endif /* !__ACTUATOR_H__ */
@@ -19,48 +19,137 @@
  */ 
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sys/epoll.h>
+
 #define NDEBUG
 #include <alsa/asoundlib.h>
 
 #include "pommed.h"
+#include "dynlib_alsa.h"
+#include "evloop.h"
 #include "conffile.h"
 #include "audio.h"
 #include "beep.h"
+#include "actuator.h"
 
 
 struct _audio_info audio_info;
 
-static snd_mixer_t *mixer_hdl;
-static snd_mixer_elem_t *vol_elem;
-static snd_mixer_elem_t *spkr_elem;
-static snd_mixer_elem_t *head_elem;
+/* Mixer control elements, addressed by numid */
+struct audio_ctl
+{
+  unsigned int numid;
+  unsigned int count;  /* number of channels */
+  long min;
+  long max;
+};
+
+/* Holding a reference on ALSA */
+static int alsa_loaded;
+
+static snd_ctl_t *ctl_hdl;
+/* Separate handle for the actuator thread, ALSA handles aren't thread-safe */
+static snd_ctl_t *wr_hdl;
+static struct audio_ctl vol_ctl;
+static struct audio_ctl spkr_ctl;
+static struct audio_ctl head_ctl;
 
-static long vol_min;
-static long vol_max;
-static long vol_step;
 static int play;
 
+/* ctl poll descriptors registered on the main loop */
+static struct pollfd ctl_pfds[AUDIO_MAX_POLLFDS];
+static int ctl_nfds;
+
+
+static int
+audio_ctl_read(struct audio_ctl *ctl, long *val)
+{
+  snd_ctl_elem_value_t *value;
+  int ret;
+
+  snd_ctl_elem_value_alloca(&value);
+
+  snd_ctl_elem_value_set_numid(value, ctl->numid);
+
+  ret = snd_ctl_elem_read(ctl_hdl, value);
+  if (ret < 0)
+    {
+      logdebug("Failed to read control %u: %s\n", ctl->numid, snd_strerror(ret));
+
+      return ret;
+    }
+
+  /* Booleans are stored as integers too */
+  *val = snd_ctl_elem_value_get_integer(value, 0);
+
+  return 0;
+}
+
+/* Single ioctl, all channels at once */
+static int
+audio_ctl_write(struct audio_ctl *ctl, long val)
+{
+  snd_ctl_elem_value_t *value;
+  unsigned int i;
+  int ret;
+
+  snd_ctl_elem_value_alloca(&value);
+
+  snd_ctl_elem_value_set_numid(value, ctl->numid);
+
+  for (i = 0; i < ctl->count; i++)
+    snd_ctl_elem_value_set_integer(value, i, val);
+
+  ret = snd_ctl_elem_write(wr_hdl, value);
+  if (ret < 0)
+    logdebug("Failed to write control %u: %s\n", ctl->numid, snd_strerror(ret));
+
+  return ret;
+}
+
+/* Actuator thread writers */
+static void
+audio_volume_write(int value, int arg)
+{
+  audio_ctl_write(&vol_ctl, value);
+}
+
+static void
+audio_mute_write(int value, int arg)
+{
+  if (spkr_ctl.numid != 0)
+    audio_ctl_write(&spkr_ctl, value);
+
+  if (head_ctl.numid != 0)
+    audio_ctl_write(&head_ctl, value);
+}
+
 
 void
 audio_step(int dir)
 {
   long vol;
   long newvol;
+  long vol_step;
 
-  if (mixer_hdl == NULL)
+  if (ctl_hdl == NULL)
     return;
 
-  if (vol_elem == NULL)
+  if (vol_ctl.numid == 0)
     return;
 
-  snd_mixer_handle_events(mixer_hdl);
+  /* Not cached, the step can change on reload */
+  vol_step = (long)((double)(vol_ctl.max - vol_ctl.min) / 100.0 * (double)audio_cfg.step);
 
-  if (!snd_mixer_selem_is_active(vol_elem))
-    return;
-
-  snd_mixer_selem_get_playback_volume(vol_elem, 0, &vol);
+  /* Kept current by the ctl event handler */
+  vol = audio_info.level;
 
   logdebug("Mixer volume: %ld\n", vol);
 
@@ -68,8 +157,8 @@ audio_step(int dir)
     {
       newvol = vol + vol_step;
 
-      if (newvol > vol_max)
-	newvol = vol_max;
+      if (newvol > vol_ctl.max)
+	newvol = vol_ctl.max;
 
       logdebug("Audio stepping +%ld -> %ld\n", vol_step, newvol);
     }
@@ -77,18 +166,15 @@ audio_step(int dir)
     {
       newvol = vol - vol_step;
 
-      if (newvol < vol_min)
-	newvol = vol_min;
+      if (newvol < vol_ctl.min)
+	newvol = vol_ctl.min;
 
       logdebug("Audio stepping -%ld -> %ld\n", vol_step, newvol);
     }
   else
     return;
 
-  snd_mixer_selem_set_playback_volume(vol_elem, 0, newvol);
-
-  if (snd_mixer_selem_is_playback_mono(vol_elem) == 0)
-    snd_mixer_selem_set_playback_volume(vol_elem, 1, newvol);
+  actuator_submit(ACT_VOLUME, newvol, 0);
 
   if (audio_cfg.beep)
     beep_audio();
@@ -96,147 +182,370 @@ audio_step(int dir)
   audio_info.level = newvol;
 }
 
-
-static void
-audio_set_mute_elem(snd_mixer_elem_t *elem)
+void
+audio_set(int vol)
 {
-  if (snd_mixer_selem_is_active(elem)
-      && snd_mixer_selem_has_playback_switch(elem))
-    {
-      snd_mixer_selem_set_playback_switch(elem, 0, play);
+  if (ctl_hdl == NULL)
+    return;
 
-      if (snd_mixer_selem_is_playback_mono(elem) == 0)
-	snd_mixer_selem_set_playback_switch(elem, 1, play);
-    }
+  if (vol_ctl.numid == 0)
+    return;
+
+  if (vol > vol_ctl.max)
+    vol = vol_ctl.max;
+  else if (vol < vol_ctl.min)
+    vol = vol_ctl.min;
+
+  logdebug("Audio volume set to %d\n", vol);
+
+  actuator_submit(ACT_VOLUME, vol, 0);
+
+  audio_info.level = vol;
 }
 
+
 void
 audio_toggle_mute(void)
 {
-  if (mixer_hdl == NULL)
+  if (ctl_hdl == NULL)
     return;
 
-  snd_mixer_handle_events(mixer_hdl);
+  /* Kept current by the ctl event handler */
+  play = audio_info.muted;
 
-  play = !play;
-
-  if (spkr_elem != NULL)
-    audio_set_mute_elem(spkr_elem);
-
-  if (head_elem != NULL)
-    audio_set_mute_elem(head_elem);
+  actuator_submit(ACT_MUTE, play, 0);
 
   audio_info.muted = !play;
 }
 
 
-int
-audio_init(void)
+/* Speakers drive the mute state; headphones only if there are no speakers */
+static struct audio_ctl *
+audio_mute_ctl(void)
 {
-  snd_mixer_elem_t *elem;
-  snd_mixer_selem_id_t *sid;
+  return (spkr_ctl.numid != 0) ? &spkr_ctl : &head_ctl;
+}
 
-  double dvol;
-  long vol;
+static void
+audio_ctl_event(unsigned int numid, unsigned int mask)
+{
+  long val;
+  int ret;
+
+  if (mask == SND_CTL_EVENT_MASK_REMOVE)
+    {
+      if (numid == vol_ctl.numid)
+	vol_ctl.numid = 0;
+      else if (numid == spkr_ctl.numid)
+	spkr_ctl.numid = 0;
+      else if (numid == head_ctl.numid)
+	head_ctl.numid = 0;
+      else
+	return;
+
+      logdebug("Mixer control %u removed\n", numid);
+
+      return;
+    }
+
+  if (!(mask & SND_CTL_EVENT_MASK_VALUE))
+    return;
+
+  /* Our own writes are in flight, the state we hold is newer */
+  if (numid == vol_ctl.numid)
+    {
+      if (actuator_busy(ACT_VOLUME))
+	return;
+
+      ret = audio_ctl_read(&vol_ctl, &val);
+      if (ret < 0)
+	return;
+
+      logdebug("Mixer volume changed: %ld\n", val);
+
+      audio_info.level = val;
+    }
+  else if (numid == audio_mute_ctl()->numid)
+    {
+      if (actuator_busy(ACT_MUTE))
+	return;
+
+      ret = audio_ctl_read(audio_mute_ctl(), &val);
+      if (ret < 0)
+	return;
 
+      logdebug("Mixer switch changed: %s\n", (val) ? "on" : "off");
+
+      play = (val != 0);
+      audio_info.muted = !play;
+    }
+}
+
+static void
+audio_ctl_process(int fd, uint32_t events)
+{
+  snd_ctl_event_t *event;
   int ret;
 
-  vol_elem = NULL;
-  spkr_elem = NULL;
-  head_elem = NULL;
+  if (events & (EPOLLERR | EPOLLHUP))
+    {
+      logmsg(LOG_WARNING, "Mixer device lost, audio support disabled");
 
-  if (audio_cfg.disabled)
+      audio_cleanup();
+
+      return;
+    }
+
+  snd_ctl_event_alloca(&event);
+
+  /* Non-blocking handle, drain all pending events */
+  while ((ret = snd_ctl_read(ctl_hdl, event)) > 0)
     {
-      audio_info.level = 0;
-      audio_info.max = 0;
-      audio_info.muted = 1;
+      if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+	continue;
 
-      return 0;
+      audio_ctl_event(snd_ctl_event_elem_get_numid(event),
+		      snd_ctl_event_elem_get_mask(event));
     }
 
-  play = 1;
+  if ((ret < 0) && (ret != -EAGAIN))
+    logdebug("Failed to read ctl events: %s\n", snd_strerror(ret));
+}
 
-  ret = snd_mixer_open(&mixer_hdl, 0);
+static void
+audio_ctl_unwatch(void)
+{
+  int i;
+
+  for (i = 0; i < ctl_nfds; i++)
+    evloop_remove(ctl_pfds[i].fd);
+
+  ctl_nfds = 0;
+}
+
+static int
+audio_ctl_watch(void)
+{
+  int nfds;
+  int ret;
+  int i;
+
+  ret = snd_ctl_subscribe_events(ctl_hdl, 1);
   if (ret < 0)
     {
-      logdebug("Failed to open mixer: %s\n", snd_strerror(ret));
-
-      mixer_hdl = NULL;
+      logdebug("Failed to subscribe to ctl events: %s\n", snd_strerror(ret));
 
       return -1;
     }
 
-  ret = snd_mixer_attach(mixer_hdl, audio_cfg.card);
-  if (ret < 0)
+  nfds = snd_ctl_poll_descriptors_count(ctl_hdl);
+  if ((nfds <= 0) || (nfds > AUDIO_MAX_POLLFDS))
     {
-      logdebug("Failed to attach mixer: %s\n", snd_strerror(ret));
+      logdebug("Unsupported number of ctl poll descriptors: %d\n", nfds);
 
-      snd_mixer_close(mixer_hdl);
+      return -1;
+    }
+
+  nfds = snd_ctl_poll_descriptors(ctl_hdl, ctl_pfds, nfds);
+  if (nfds < 0)
+    {
+      logdebug("Failed to get ctl poll descriptors: %s\n", snd_strerror(nfds));
 
       return -1;
     }
 
-  ret = snd_mixer_selem_register(mixer_hdl, NULL, NULL);
-  if (ret < 0)
+  ctl_nfds = 0;
+  for (i = 0; i < nfds; i++)
     {
-      logdebug("Failed to register mixer: %s\n", snd_strerror(ret));
+      /* pollfd events map directly to epoll events */
+      ret = evloop_add(ctl_pfds[i].fd, ctl_pfds[i].events, EVLOOP_PRIO_DEFAULT, audio_ctl_process);
+      if (ret < 0)
+	{
+	  audio_ctl_unwatch();
 
-      snd_mixer_detach(mixer_hdl, audio_cfg.card);
-      snd_mixer_close(mixer_hdl);
+	  return -1;
+	}
 
-      return -1;
+      ctl_nfds++;
     }
 
-  ret = snd_mixer_load(mixer_hdl);
-  if (ret < 0)
+  return 0;
+}
+
+
+/*
+ * Look up a mixer control by name, the way the simple mixer names them:
+ * "<name> Playback Volume" or "<name> Volume" (resp. "Switch").
+ * The kernel resolves the name in a single ELEM_INFO ioctl, so there
+ * is no need to load every element on the card.
+ */
+static int
+audio_ctl_resolve(const char *name, const char *kind, snd_ctl_elem_type_t type, struct audio_ctl *ctl)
+{
+  char *fmt[] =
     {
-      logdebug("Failed to load mixer: %s\n", snd_strerror(ret));
+      "%s Playback %s",
+      "%s %s"
+    };
+  snd_ctl_elem_info_t *info;
+  char ctl_name[64];
+  int ret;
+  int i;
 
-      snd_mixer_detach(mixer_hdl, audio_cfg.card);
-      snd_mixer_close(mixer_hdl);
+  snd_ctl_elem_info_alloca(&info);
 
-      return -1;
+  memset(ctl, 0, sizeof(*ctl));
+
+  for (i = 0; i < sizeof(fmt) / sizeof(*fmt); i++)
+    {
+      ret = snprintf(ctl_name, sizeof(ctl_name), fmt[i], name, kind);
+      if ((ret <= 0) || (ret >= sizeof(ctl_name)))
+	continue;
+
+      snd_ctl_elem_info_set_interface(info, SND_CTL_ELEM_IFACE_MIXER);
+      snd_ctl_elem_info_set_name(info, ctl_name);
+      snd_ctl_elem_info_set_index(info, 0);
+      snd_ctl_elem_info_set_numid(info, 0);
+
+      ret = snd_ctl_elem_info(ctl_hdl, info);
+      if (ret < 0)
+	continue;
+
+      if (snd_ctl_elem_info_get_type(info) != type)
+	{
+	  logdebug("Mixer control [%s] has unexpected type\n", ctl_name);
+	  continue;
+	}
+
+      ctl->numid = snd_ctl_elem_info_get_numid(info);
+      ctl->count = snd_ctl_elem_info_get_count(info);
+
+      if (type == SND_CTL_ELEM_TYPE_INTEGER)
+	{
+	  ctl->min = snd_ctl_elem_info_get_min(info);
+	  ctl->max = snd_ctl_elem_info_get_max(info);
+	}
+      else
+	{
+	  ctl->min = 0;
+	  ctl->max = 1;
+	}
+
+      logdebug("Mixer control [%s]: numid %u, %u channel(s)\n", ctl_name, ctl->numid, ctl->count);
+
+      return 0;
     }
 
+  return -1;
+}
 
-  /* Grab interesting elements */
-  snd_mixer_selem_id_alloca(&sid);
 
-  for (elem = snd_mixer_first_elem(mixer_hdl); elem; elem = snd_mixer_elem_next(elem)) 
+/* Undoes audio_probe(); touches neither the actuator nor the event loop */
+static void
+audio_close(void)
+{
+  if (wr_hdl != NULL)
     {
-      snd_mixer_selem_get_id(elem, sid);
+      snd_ctl_close(wr_hdl);
 
-      if (strcmp(snd_mixer_selem_id_get_name(sid), audio_cfg.vol) == 0)
-	vol_elem = elem;
+      wr_hdl = NULL;
+    }
 
-      if (strcmp(snd_mixer_selem_id_get_name(sid), audio_cfg.spkr) == 0)
-	spkr_elem = elem;
+  if (ctl_hdl != NULL)
+    {
+      snd_ctl_close(ctl_hdl);
 
-      if (strcmp(snd_mixer_selem_id_get_name(sid), audio_cfg.head) == 0)
-	head_elem = elem;
+      ctl_hdl = NULL;
     }
 
+  if (alsa_loaded)
+    {
+      dynlib_unload(&dynlib_alsa);
+
+      alsa_loaded = 0;
+    }
+}
+
+/* Opens the mixer and reads the state; no event loop, can run on any thread */
+int
+audio_probe(void)
+{
+  double dvol;
+  long vol;
+  long sw;
+
+  int ret;
+
+  memset(&vol_ctl, 0, sizeof(vol_ctl));
+  memset(&spkr_ctl, 0, sizeof(spkr_ctl));
+  memset(&head_ctl, 0, sizeof(head_ctl));
+
+  ctl_nfds = 0;
+
+  if (audio_cfg.disabled)
+    {
+      audio_info.level = 0;
+      audio_info.max = 0;
+      audio_info.muted = 1;
+
+      return 0;
+    }
+
+  play = 1;
+
+  /* ALSA is only loaded if we handle audio */
+  ret = dynlib_load(&dynlib_alsa);
+  if (ret < 0)
+    return -1;
+
+  alsa_loaded = 1;
+
+  ret = snd_ctl_open(&ctl_hdl, audio_cfg.card, SND_CTL_NONBLOCK);
+  if (ret < 0)
+    {
+      logdebug("Failed to open mixer: %s\n", snd_strerror(ret));
+
+      ctl_hdl = NULL;
+
+      audio_close();
+
+      return -1;
+    }
+
+  ret = snd_ctl_open(&wr_hdl, audio_cfg.card, 0);
+  if (ret < 0)
+    {
+      logdebug("Failed to open mixer for writing: %s\n", snd_strerror(ret));
+
+      wr_hdl = NULL;
+
+      audio_close();
+
+      return -1;
+    }
+
+  /* Grab interesting elements */
+  audio_ctl_resolve(audio_cfg.vol, "Volume", SND_CTL_ELEM_TYPE_INTEGER, &vol_ctl);
+  audio_ctl_resolve(audio_cfg.spkr, "Switch", SND_CTL_ELEM_TYPE_BOOLEAN, &spkr_ctl);
+  audio_ctl_resolve(audio_cfg.head, "Switch", SND_CTL_ELEM_TYPE_BOOLEAN, &head_ctl);
+
   logdebug("Audio init: volume %s, speakers %s, headphones %s\n",
-	   (vol_elem == NULL) ? "NOK" : "OK",
-	   (spkr_elem == NULL) ? "NOK" : "OK",
-	   (head_elem == NULL) ? "NOK" : "OK");
+	   (vol_ctl.numid == 0) ? "NOK" : "OK",
+	   (spkr_ctl.numid == 0) ? "NOK" : "OK",
+	   (head_ctl.numid == 0) ? "NOK" : "OK");
 
-  if ((vol_elem == NULL) || ((spkr_elem == NULL) && (head_elem == NULL)))
+  if ((vol_ctl.numid == 0) || ((spkr_ctl.numid == 0) && (head_ctl.numid == 0)))
     {
       logdebug("Failed to open required mixer elements\n");
 
-      audio_cleanup();
+      audio_close();
 
       return -1;
     }
 
-  /* Get min & max volume */
-  snd_mixer_selem_get_playback_volume_range(vol_elem, &vol_min, &vol_max);
-
-  dvol = (double)(vol_max - vol_min) / 100.0;
-  vol_step = (long)(dvol * (double)audio_cfg.step);
+  dvol = (double)(vol_ctl.max - vol_ctl.min) / 100.0;
 
-  logdebug("Audio init: min %ld, max %ld, step %ld\n", vol_min, vol_max, vol_step);
+  logdebug("Audio init: min %ld, max %ld, step %d%%\n", vol_ctl.min, vol_ctl.max, audio_cfg.step);
 
   /* Set initial volume if enabled */
   if (audio_cfg.init > -1)
@@ -244,35 +553,84 @@ audio_init(void)
       dvol *= (double)audio_cfg.init;
       vol = (long)dvol;
 
-      if (vol > vol_max)
-	vol = vol_max;
+      if (vol > vol_ctl.max)
+	vol = vol_ctl.max;
 
-      snd_mixer_selem_set_playback_volume(vol_elem, 0, vol);
+      audio_ctl_write(&vol_ctl, vol);
+    }
 
-      if (snd_mixer_selem_is_playback_mono(vol_elem) == 0)
-	snd_mixer_selem_set_playback_volume(vol_elem, 1, vol);      
+  ret = audio_ctl_read(&vol_ctl, &vol);
+  if (ret < 0)
+    {
+      audio_close();
+
+      return -1;
     }
 
-  snd_mixer_handle_events(mixer_hdl);
-  snd_mixer_selem_get_playback_volume(vol_elem, 0, &vol);
+  /* Pick up the current mute state */
+  ret = audio_ctl_read(audio_mute_ctl(), &sw);
+  if (ret == 0)
+    play = (sw != 0);
 
   audio_info.level = vol;
-  audio_info.max = vol_max;
+  audio_info.max = vol_ctl.max;
   audio_info.muted = !play;
 
   return 0;
 }
 
-void
-audio_cleanup(void)
+/* Second half of the initialization, after audio_probe(); main thread */
+int
+audio_start(void)
 {
-  if (mixer_hdl != NULL)
+  int ret;
+
+  if (audio_cfg.disabled)
+    return 0;
+
+  if (ctl_hdl == NULL)
+    return -1;
+
+  actuator_register(ACT_VOLUME, audio_volume_write);
+  actuator_register(ACT_MUTE, audio_mute_write);
+
+  /* Track external changes from now on */
+  ret = audio_ctl_watch();
+  if (ret < 0)
     {
-      snd_mixer_detach(mixer_hdl, audio_cfg.card);
-      snd_mixer_close(mixer_hdl);
+      logdebug("Failed to watch mixer for changes\n");
+
+      audio_cleanup();
 
-      mixer_hdl = NULL;
+      return -1;
     }
+
+  return 0;
+}
+
+int
+audio_init(void)
+{
+  int ret;
+
+  ret = audio_probe();
+  if (ret < 0)
+    return -1;
+
+  return audio_start();
+}
+
+/* Main thread only */
+void
+audio_cleanup(void)
+{
+  /* Wait for pending writes before closing the handles */
+  actuator_unregister(ACT_VOLUME);
+  actuator_unregister(ACT_MUTE);
+
+  audio_ctl_unwatch();
+
+  audio_close();
 }
 
 
@@ -6,6 +6,9 @@
 #define __AUDIO_H__
 
 
+#define AUDIO_MAX_POLLFDS    4
+
+
 struct _audio_info
 {
   int level;
@@ -19,9 +22,18 @@ extern struct _audio_info audio_info;
 void
 audio_step(int dir);
 
+void
+audio_set(int vol);
+
 void
 audio_toggle_mute(void);
 
+int
+audio_probe(void);
+
+int
+audio_start(void);
+
 int
 audio_init(void);
 
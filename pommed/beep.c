@@ -44,8 +44,11 @@
 #include <audiofile.h>
 
 #include "pommed.h"
+#include "dynlib_alsa.h"
+#include "dynlib_audiofile.h"
 #include "evloop.h"
 #include "conffile.h"
+#include "latency.h"
 #include "audio.h"
 #include "beep.h"
 
@@ -65,6 +68,9 @@ static int beep_thread_running = 0;
 static void
 beep_thread_command(int command);
 
+static void
+beep_thread_join(void);
+
 static void
 beep_thread_cleanup(void);
 
@@ -187,7 +193,8 @@ beep_open_device(void)
 static void
 beep_close_device(void)
 {
-  if (!beep_cfg.enabled || (beep_fd == -1))
+  /* Not beep_cfg.enabled, it may have changed on reload */
+  if (beep_fd == -1)
     return;
 
   evloop_remove(beep_fd);
@@ -260,7 +267,7 @@ beep_init(void)
   if (ret < 0)
     return -1;
 
-  ret = evloop_add(beep_fd, EPOLLIN, beep_process_events);
+  ret = evloop_add(beep_fd, EPOLLIN, EVLOOP_PRIO_DEFAULT, beep_process_events);
   if (ret < 0)
     {
       logmsg(LOG_ERR, "Could not add device to event loop");
@@ -281,7 +288,11 @@ beep_cleanup(void)
   if (beep_thread_running)
     {
       beep_thread_command(AUDIO_COMMAND_QUIT);
+      beep_thread_join();
+
       beep_thread_cleanup();
+
+      beep_thread_running = 0;
     }
 
   beep_close_device();
@@ -294,7 +305,7 @@ beep_fix_config(void)
     return;
 
   if (beep_cfg.beepfile == NULL)
-    beep_cfg.beepfile = strdup(BEEP_DEFAULT_FILE);
+    beep_cfg.beepfile = config_strdup(BEEP_DEFAULT_FILE);
 
   if (access(beep_cfg.beepfile, R_OK) != 0)
     {
@@ -304,8 +315,7 @@ beep_fix_config(void)
 	{
 	  logmsg(LOG_WARNING, "beep: falling back to default file %s", BEEP_DEFAULT_FILE);
 
-	  free(beep_cfg.beepfile);
-	  beep_cfg.beepfile = strdup(BEEP_DEFAULT_FILE);
+	  beep_cfg.beepfile = config_strdup(BEEP_DEFAULT_FILE);
 	}
       else
 	{
@@ -324,7 +334,11 @@ beep_fix_config(void)
 
 struct dspdata _dsp;
 
-/* Called from the main thread */
+/* Beep thread state: the sample is decoded and ALSA loaded on the first beep */
+static int sample_failed;
+static int alsa_loaded;
+
+/* Called from the audio thread; libaudiofile is only loaded meanwhile */
 static struct sample *
 beep_load_sample(char *filename)
 {
@@ -339,9 +353,17 @@ beep_load_sample(char *filename)
   if (sample == NULL)
     return NULL;
 
+  ret = dynlib_load(&dynlib_audiofile);
+  if (ret < 0)
+    {
+      free(sample);
+      return NULL;
+    }
+
   affd = afOpenFile(filename, "r", 0);
   if (!affd)
     {
+      dynlib_unload(&dynlib_audiofile);
       free(sample);
       return NULL;
     }
@@ -394,16 +416,52 @@ beep_load_sample(char *filename)
     goto error_out;
 
   afCloseFile(affd);
+  dynlib_unload(&dynlib_audiofile);
 
   return sample;
 
  error_out: /* something bad happened */
   afCloseFile(affd);
+  dynlib_unload(&dynlib_audiofile);
   free(sample);
   return NULL;
 }
 
 
+/* Called from the audio thread, on the first beep or at startup */
+static int
+beep_prepare_sample(struct dspdata *dsp, int cmd)
+{
+  if (sample_failed)
+    return -1;
+
+  if (dsp->sample[cmd] == NULL)
+    {
+      dsp->sample[cmd] = beep_load_sample(beep_cfg.beepfile);
+      if (dsp->sample[cmd] == NULL)
+	{
+	  logmsg(LOG_WARNING, "beep: could not load WAV file %s, beeps disabled", beep_cfg.beepfile);
+
+	  sample_failed = 1;
+	  return -1;
+	}
+    }
+
+  /* Kept until we exit, the next beep will need it again */
+  if (!alsa_loaded)
+    {
+      if (dynlib_load(&dynlib_alsa) < 0)
+	{
+	  sample_failed = 1;
+	  return -1;
+	}
+
+      alsa_loaded = 1;
+    }
+
+  return 0;
+}
+
 /* Called from the audio thread */
 static void
 beep_play_sample(struct dspdata *dsp, int cmd)
@@ -413,7 +471,12 @@ beep_play_sample(struct dspdata *dsp, int cmd)
 
   char *pcm_name = "default";
 
-  struct sample *s = dsp->sample[cmd];
+  struct sample *s;
+
+  if (beep_prepare_sample(dsp, cmd) < 0)
+    return;
+
+  s = dsp->sample[cmd];
 
   snd_pcm_hw_params_alloca(&hwparams);
 
@@ -504,17 +567,26 @@ void *
 beep_thread (void *arg)
 {
   struct dspdata *dsp = (struct dspdata *) arg;
+  int command;
+
+  /* Don't wait for the first beep, it must not stall */
+  if (general_cfg.lowlatency)
+    beep_prepare_sample(dsp, AUDIO_CLICK);
+
   for (;;)
     {
+      /* Commands sent while we're playing aren't lost, QUIT must not be */
       pthread_mutex_lock(&dsp->mutex);
-      pthread_cond_wait(&dsp->cond, &dsp->mutex);
+      while (dsp->command == AUDIO_COMMAND_NONE)
+	pthread_cond_wait(&dsp->cond, &dsp->mutex);
+
+      command = dsp->command;
+      dsp->command = AUDIO_COMMAND_NONE;
       pthread_mutex_unlock(&dsp->mutex);
 
-      switch (dsp->command)
+      switch (command)
 	{
 	  case AUDIO_CLICK:
-	    dsp->command = AUDIO_COMMAND_NONE;
-
 	    beep_play_sample(dsp, AUDIO_CLICK);
 	    break;
 	  case AUDIO_COMMAND_QUIT:
@@ -547,6 +619,15 @@ beep_thread_command(int command)
 }
 
 
+/* Called from the main thread
+ * Before the samples go away, and before a new thread on reload
+ */
+static void
+beep_thread_join(void)
+{
+  pthread_join(_dsp.thread, NULL);
+}
+
 /* Called from the main thread */
 static void
 beep_thread_cleanup(void)
@@ -562,6 +643,7 @@ beep_thread_cleanup(void)
 	free(_dsp.sample[i]->audiodata);
 
       free(_dsp.sample[i]);
+      _dsp.sample[i] = NULL;
     }
 
   pthread_mutex_destroy(&(_dsp.mutex));
@@ -579,17 +661,18 @@ beep_thread_init(void)
   pthread_attr_t attr;
   int ret;
 
-  _dsp.sample[AUDIO_CLICK] = beep_load_sample(beep_cfg.beepfile);
-
-  if (_dsp.sample[AUDIO_CLICK] == NULL)
-    return -1;
+  /* Decoded by the thread on the first beep, or right away */
+  _dsp.sample[AUDIO_CLICK] = NULL;
+  sample_failed = 0;
 
   _dsp.thread = 0;
+  _dsp.command = AUDIO_COMMAND_NONE;
 
   pthread_mutex_init(&(_dsp.mutex), NULL);
   pthread_cond_init (&(_dsp.cond), NULL);
   pthread_attr_init(&attr);
   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+  latency_thread_attr(&attr);
 
   ret = pthread_create(&(_dsp.thread), &attr, beep_thread, (void *) &_dsp);
   if (ret != 0)
@@ -23,7 +23,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
+#include <sys/mount.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <limits.h>
 
@@ -31,27 +32,143 @@
 
 #include <syslog.h>
 
+#include <pthread.h>
+
 #include <sys/ioctl.h>
 #include <linux/cdrom.h>
 
 #include "pommed.h"
 #include "conffile.h"
+#include "latency.h"
 #include "cd_eject.h"
 
 
-void
-cd_eject(void)
+#define EJECT_COMMAND_NONE      0
+#define EJECT_COMMAND_EJECT     1
+#define EJECT_COMMAND_QUIT      2
+
+/*
+ * The worker is started once, creating a thread from the event loop
+ * allocates (glibc sets up the new thread's TLS on the caller's side).
+ * All of the below is protected by eject_mutex.
+ */
+static pthread_mutex_t eject_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eject_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t eject_thread;
+static int eject_running;
+static int eject_command;
+
+/* An eject is queued or running, cleared by the worker */
+static int eject_busy;
+
+/* Copied from the configuration, which a reload can swap under the worker */
+static char eject_device[PATH_MAX];
+
+/* Mount points found by the worker, packed; one eject at a time */
+static char mount_arena[EJECT_MOUNT_ARENA];
+
+
+/* Mount points in mountinfo have spaces & co. escaped as \ooo */
+static void
+cd_eject_unescape(char *s)
 {
-  char *eject_argv[3] = { "eject", eject_cfg.device, NULL };
-  char *eject_envp[1] = { NULL };
-  long max_fd;
-  int fd;
+  char *d;
+
+  for (d = s; *s != '\0'; d++)
+    {
+      if ((s[0] == '\\')
+	  && (s[1] >= '0') && (s[1] <= '3')
+	  && (s[2] >= '0') && (s[2] <= '7')
+	  && (s[3] >= '0') && (s[3] <= '7'))
+	{
+	  *d = ((s[1] - '0') << 6) | ((s[2] - '0') << 3) | (s[3] - '0');
+	  s += 4;
+	}
+      else
+	*d = *s++;
+    }
+
+  *d = '\0';
+}
+
+/* Unmount whatever is mounted from the drive, most recent mounts first */
+static int
+cd_eject_umount(dev_t rdev)
+{
+  FILE *fp;
+  char line[PATH_MAX + 256];
+  char mnt[PATH_MAX];
+  char *mounts[EJECT_MAX_MOUNTS];
+  unsigned int maj;
+  unsigned int min;
+  size_t used;
+  size_t len;
+  int nmounts;
   int ret;
+  int i;
 
-  if (!eject_cfg.enabled)
-    return;
+  fp = fopen("/proc/self/mountinfo", "r");
+  if (fp == NULL)
+    {
+      logmsg(LOG_ERR, "Could not open /proc/self/mountinfo: %s", strerror(errno));
+
+      return -1;
+    }
+
+  nmounts = 0;
+  used = 0;
+  while ((nmounts < EJECT_MAX_MOUNTS) && (fgets(line, sizeof(line), fp) != NULL))
+    {
+      /* 36 35 11:0 / /media/cdrom rw,nosuid - iso9660 /dev/sr0 ro */
+      ret = sscanf(line, "%*d %*d %u:%u %*s %4095s", &maj, &min, mnt);
+      if (ret != 3)
+	continue;
+
+      if ((maj != major(rdev)) || (min != minor(rdev)))
+	continue;
+
+      cd_eject_unescape(mnt);
+
+      len = strlen(mnt) + 1;
+      if (used + len > sizeof(mount_arena))
+	{
+	  logmsg(LOG_WARNING, "eject: too many mount points, not unmounting %s", mnt);
+
+	  continue;
+	}
 
-  fd = open(eject_cfg.device, O_RDONLY | O_NONBLOCK);
+      mounts[nmounts] = memcpy(mount_arena + used, mnt, len);
+      used += len;
+      nmounts++;
+    }
+
+  fclose(fp);
+
+  ret = 0;
+  for (i = nmounts - 1; i >= 0; i--)
+    {
+      if ((ret == 0) && (umount2(mounts[i], 0) < 0))
+	{
+	  logmsg(LOG_INFO, "Could not unmount %s: %s", mounts[i], strerror(errno));
+
+	  ret = -1;
+	}
+      else if (ret == 0)
+	logdebug("eject: unmounted %s\n", mounts[i]);
+    }
+
+  return ret;
+}
+
+/* Called from the worker, the drive can take seconds to answer */
+static void
+cd_eject_run(const char *device)
+{
+  struct stat st;
+  int fd;
+  int ret;
+
+  fd = open(device, O_RDONLY | O_NONBLOCK);
   if (fd < 0)
     {
       logmsg(LOG_ERR, "Could not open CD/DVD device: %s", strerror(errno));
@@ -61,7 +178,6 @@ cd_eject(void)
 
   /* Check drive status */
   ret = ioctl(fd, CDROM_DRIVE_STATUS);
-  close(fd);
 
   switch (ret)
     {
@@ -73,51 +189,158 @@ cd_eject(void)
 
       case CDS_NO_DISC:
 	logmsg(LOG_INFO, "No disc in CD/DVD drive");
-	return;
+	goto out_close;
 
       case CDS_DRIVE_NOT_READY:
 	logmsg(LOG_INFO, "Drive not ready, please retry later");
-	return;
+	goto out_close;
 
       case CDS_TRAY_OPEN:
 	logmsg(LOG_INFO, "Drive tray already open");
-	return;
+	goto out_close;
 
       default:
 	logmsg(LOG_INFO, "CDROM_DRIVE_STATUS returned %d (%s)", ret, strerror(errno));
-	return;
+	goto out_close;
+    }
+
+  ret = fstat(fd, &st);
+  if ((ret < 0) || !S_ISBLK(st.st_mode))
+    {
+      logmsg(LOG_ERR, "%s is not a block device", device);
+
+      goto out_close;
     }
 
-  ret = fork();
-  if (ret == 0) /* exec eject */
+  ret = cd_eject_umount(st.st_rdev);
+  if (ret < 0)
+    goto out_close;
+
+  ret = ioctl(fd, CDROMEJECT);
+  if (ret < 0)
+    logmsg(LOG_INFO, "eject failed: %s", strerror(errno));
+
+ out_close:
+  close(fd);
+}
+
+/* Worker thread main loop */
+static void *
+cd_eject_thread(void *data)
+{
+  char device[PATH_MAX];
+  int command;
+
+  latency_idle();
+
+  for (;;)
     {
-      max_fd = sysconf(_SC_OPEN_MAX);
+      pthread_mutex_lock(&eject_mutex);
+      while (eject_command == EJECT_COMMAND_NONE)
+	pthread_cond_wait(&eject_cond, &eject_mutex);
+
+      command = eject_command;
+      eject_command = EJECT_COMMAND_NONE;
 
-      if (max_fd > INT_MAX)
-	max_fd = INT_MAX;
+      if (command == EJECT_COMMAND_EJECT)
+	memcpy(device, eject_device, sizeof(device));
+      pthread_mutex_unlock(&eject_mutex);
 
-      for (fd = 3; fd < max_fd; fd++)
-	close(fd);
+      if (command == EJECT_COMMAND_QUIT)
+	break;
 
-      execve("/usr/bin/eject", eject_argv, eject_envp);
+      cd_eject_run(device);
 
-      logmsg(LOG_ERR, "Could not execute eject: %s", strerror(errno));
-      exit(1);
+      pthread_mutex_lock(&eject_mutex);
+      eject_busy = 0;
+      pthread_mutex_unlock(&eject_mutex);
     }
-  else if (ret == -1)
+
+  return NULL;
+}
+
+
+/* Called from the main thread, wakes the worker */
+void
+cd_eject(void)
+{
+  if (!eject_cfg.enabled)
+    return;
+
+  if (!eject_running)
     {
-      logmsg(LOG_ERR, "Could not fork: %s", strerror(errno));
+      logmsg(LOG_ERR, "eject worker not running");
       return;
     }
-  else
+
+  pthread_mutex_lock(&eject_mutex);
+
+  if (eject_busy)
     {
-      waitpid(ret, &ret, 0);
-      if ((WIFEXITED(ret) == 0) || (WEXITSTATUS(ret) != 0))
-	{
-	  logmsg(LOG_INFO, "eject failed");
-	  return;
-	}
+      pthread_mutex_unlock(&eject_mutex);
+
+      logdebug("eject already in progress\n");
+      return;
+    }
+
+  strncpy(eject_device, eject_cfg.device, sizeof(eject_device) - 1);
+  eject_device[sizeof(eject_device) - 1] = '\0';
+
+  eject_busy = 1;
+  eject_command = EJECT_COMMAND_EJECT;
+
+  pthread_cond_signal(&eject_cond);
+  pthread_mutex_unlock(&eject_mutex);
+}
+
+
+/*
+ * Started even with eject disabled, a reload can enable it and the
+ * worker can't be created from the event loop
+ */
+int
+cd_eject_init(void)
+{
+  pthread_attr_t attr;
+  int ret;
+
+  eject_command = EJECT_COMMAND_NONE;
+  eject_busy = 0;
+
+  pthread_attr_init(&attr);
+  latency_thread_attr(&attr);
+
+  ret = pthread_create(&eject_thread, &attr, cd_eject_thread, NULL);
+
+  pthread_attr_destroy(&attr);
+
+  if (ret != 0)
+    {
+      logmsg(LOG_ERR, "Could not create eject thread: %s", strerror(ret));
+
+      return -1;
     }
+
+  eject_running = 1;
+
+  return 0;
+}
+
+/* Waits for an eject in progress, if any */
+void
+cd_eject_cleanup(void)
+{
+  if (!eject_running)
+    return;
+
+  pthread_mutex_lock(&eject_mutex);
+  eject_command = EJECT_COMMAND_QUIT;
+  pthread_cond_signal(&eject_cond);
+  pthread_mutex_unlock(&eject_mutex);
+
+  pthread_join(eject_thread, NULL);
+
+  eject_running = 0;
 }
 
 
@@ -5,10 +5,20 @@
 #ifndef __CD_EJECT_H__
 #define __CD_EJECT_H__
 
+/* Mounts from the drive we unmount before ejecting */
+#define EJECT_MAX_MOUNTS        16
+#define EJECT_MOUNT_ARENA       4096  /* room for their paths */
+
 
 void
 cd_eject(void);
 
+int
+cd_eject_init(void);
+
+void
+cd_eject_cleanup(void);
+
 void
 cd_eject_fix_config(void);
 
@@ -32,6 +32,7 @@
 #include "cd_eject.h"
 #include "beep.h"
 #include "audio.h"
+#include "keymap.h"
 
 
 struct _general_cfg general_cfg;
@@ -45,15 +46,50 @@ struct _audio_cfg audio_cfg;
 struct _kbd_cfg kbd_cfg;
 struct _eject_cfg eject_cfg;
 struct _beep_cfg beep_cfg;
+struct _keys_cfg keys_cfg;
+struct _hooks_cfg hooks_cfg;
 #ifndef __powerpc__
 struct _appleir_cfg appleir_cfg;
 #endif
 
+/*
+ * Fixed arenas for the configuration strings, reset by config_cleanup().
+ * A reload is parsed into the arena the live configuration doesn't use,
+ * so the current strings stay valid until the next reload.
+ */
+static char config_arenas[2][CONFIG_ARENA_SIZE];
+static int config_arena_cur;
+static char *config_arena = config_arenas[0];
+static size_t config_arena_used;
+static int config_arena_full;
+
+/* Live configuration, put back if a reload fails */
+struct config_snapshot
+{
+  struct _general_cfg general;
+  struct _lcd_sysfs_cfg lcd_sysfs;
+#ifndef __powerpc__
+  struct _lcd_x1600_cfg lcd_x1600;
+  struct _lcd_gma950_cfg lcd_gma950;
+  struct _lcd_nv8600mgt_cfg lcd_nv8600mgt;
+  struct _appleir_cfg appleir;
+#endif
+  struct _audio_cfg audio;
+  struct _kbd_cfg kbd;
+  struct _eject_cfg eject;
+  struct _beep_cfg beep;
+  struct _keys_cfg keys;
+  struct _hooks_cfg hooks;
+};
+
 
 /* Config file structure */
 static cfg_opt_t general_opts[] =
   {
     CFG_INT("fnmode", 1, CFGF_NONE),
+    CFG_BOOL("io_uring", 0, CFGF_NONE),
+    CFG_BOOL("lowlatency", 0, CFGF_NONE),
+    CFG_STR("control_group", "", CFGF_NONE),
     CFG_END()
   };
 
@@ -132,6 +168,29 @@ static cfg_opt_t beep_opts[] =
     CFG_END()
   };
 
+static cfg_opt_t bind_opts[] =
+  {
+    CFG_STR("action", "none", CFGF_NONE),
+    CFG_STR("command", "", CFGF_NONE),
+    CFG_STR_LIST("modifiers", "{}", CFGF_NONE),
+    CFG_END()
+  };
+
+static cfg_opt_t keys_opts[] =
+  {
+    CFG_SEC("bind", bind_opts, CFGF_MULTI | CFGF_TITLE),
+    CFG_END()
+  };
+
+static cfg_opt_t hooks_opts[] =
+  {
+    CFG_STR("ac_plugged", "", CFGF_NONE),
+    CFG_STR("ac_unplugged", "", CFGF_NONE),
+    CFG_STR("lid_closed", "", CFGF_NONE),
+    CFG_STR("lid_opened", "", CFGF_NONE),
+    CFG_END()
+  };
+
 #ifndef __powerpc__
 static cfg_opt_t appleir_opts[] =
   {
@@ -153,6 +212,8 @@ static cfg_opt_t opts[] =
     CFG_SEC("kbd", kbd_opts, CFGF_NONE),
     CFG_SEC("eject", eject_opts, CFGF_NONE),
     CFG_SEC("beep", beep_opts, CFGF_NONE),
+    CFG_SEC("keys", keys_opts, CFGF_NONE),
+    CFG_SEC("hooks", hooks_opts, CFGF_NONE),
 #ifndef __powerpc__
     CFG_SEC("appleir", appleir_opts, CFGF_NONE),
 #endif
@@ -189,12 +250,117 @@ config_validate_string(cfg_t *cfg, cfg_opt_t *opt)
 }
 
 
+static void *
+config_alloc(size_t size)
+{
+  size_t start;
+
+  /* Keep the key bindings array aligned */
+  start = (config_arena_used + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+  if ((start > CONFIG_ARENA_SIZE) || (size > CONFIG_ARENA_SIZE - start))
+    {
+      if (!config_arena_full)
+	logmsg(LOG_ERR, "Configuration too large, %d bytes max", CONFIG_ARENA_SIZE);
+
+      config_arena_full = 1;
+
+      return NULL;
+    }
+
+  config_arena_used = start + size;
+
+  return config_arena + start;
+}
+
+/* Never returns NULL, config_load() fails if the arena ran out */
+char *
+config_strdup(const char *str)
+{
+  char *ret;
+  size_t len;
+
+  len = strlen(str) + 1;
+
+  ret = config_alloc(len);
+  if (ret == NULL)
+    return "";
+
+  return memcpy(ret, str, len);
+}
+
+
+static int
+config_load_keys(cfg_t *sec)
+{
+  cfg_t *bind;
+  char *mod;
+  int nmods;
+  int i;
+  int j;
+
+  keys_cfg.nbinds = cfg_size(sec, "bind");
+  if (keys_cfg.nbinds == 0)
+    return 0;
+
+  keys_cfg.binds = config_alloc(keys_cfg.nbinds * sizeof(struct _keys_bind));
+  if (keys_cfg.binds == NULL)
+    {
+      keys_cfg.nbinds = 0;
+
+      logmsg(LOG_ERR, "Could not allocate memory for key bindings");
+
+      return -1;
+    }
+
+  for (i = 0; i < keys_cfg.nbinds; i++)
+    {
+      bind = cfg_getnsec(sec, "bind", i);
+
+      keys_cfg.binds[i].key = config_strdup(cfg_title(bind));
+      keys_cfg.binds[i].action = config_strdup(cfg_getstr(bind, "action"));
+      keys_cfg.binds[i].command = config_strdup(cfg_getstr(bind, "command"));
+
+      /* No modifiers listed: any modifier state */
+      nmods = cfg_size(bind, "modifiers");
+      keys_cfg.binds[i].mods = (nmods == 0) ? KEYMAP_MOD_ANY : 0;
+
+      for (j = 0; j < nmods; j++)
+	{
+	  mod = cfg_getnstr(bind, "modifiers", j);
+
+	  if (strcmp(mod, "shift") == 0)
+	    keys_cfg.binds[i].mods |= KEYMAP_MOD_SHIFT;
+	  else if (strcmp(mod, "ctrl") == 0)
+	    keys_cfg.binds[i].mods |= KEYMAP_MOD_CTRL;
+	  else if (strcmp(mod, "alt") == 0)
+	    keys_cfg.binds[i].mods |= KEYMAP_MOD_ALT;
+	  else if (strcmp(mod, "meta") == 0)
+	    keys_cfg.binds[i].mods |= KEYMAP_MOD_META;
+	  else if (strcmp(mod, "none") != 0)
+	    {
+	      logmsg(LOG_ERR, "Unknown modifier %s for key %s", mod, keys_cfg.binds[i].key);
+
+	      return -1;
+	    }
+	}
+    }
+
+  return 0;
+}
+
+
 static void
 config_print(void)
 {
+  int i;
+
   printf("pommed configuration:\n");
   printf(" + General settings:\n");
   printf("    fnmode: %d\n", general_cfg.fnmode);
+  printf("    io_uring: %s\n", (general_cfg.io_uring) ? "yes" : "no");
+  printf("    lowlatency: %s\n", (general_cfg.lowlatency) ? "yes" : "no");
+  printf("    control_group: %s\n", (general_cfg.control_group[0] != '\0') ? general_cfg.control_group : "(none)");
   printf(" + sysfs backlight control:\n");
   printf("    initial level: %d\n", lcd_sysfs_cfg.init);
   printf("    step: %d\n", lcd_sysfs_cfg.step);
@@ -240,6 +406,26 @@ config_print(void)
   printf(" + Beep:\n");
   printf("    enabled: %s\n", (beep_cfg.enabled) ? "yes" : "no");
   printf("    beepfile: %s\n", beep_cfg.beepfile);
+  printf(" + Key bindings:\n");
+  if (keys_cfg.nbinds == 0)
+    printf("    defaults\n");
+  for (i = 0; i < keys_cfg.nbinds; i++)
+    {
+      printf("    %s%s%s%s%s%s: %s\n", keys_cfg.binds[i].key,
+	     (keys_cfg.binds[i].mods == 0) ? " (no modifiers)" : "",
+	     (keys_cfg.binds[i].mods & KEYMAP_MOD_ANY) ? "" : (keys_cfg.binds[i].mods & KEYMAP_MOD_SHIFT) ? " +shift" : "",
+	     (keys_cfg.binds[i].mods & KEYMAP_MOD_ANY) ? "" : (keys_cfg.binds[i].mods & KEYMAP_MOD_CTRL) ? " +ctrl" : "",
+	     (keys_cfg.binds[i].mods & KEYMAP_MOD_ANY) ? "" : (keys_cfg.binds[i].mods & KEYMAP_MOD_ALT) ? " +alt" : "",
+	     (keys_cfg.binds[i].mods & KEYMAP_MOD_ANY) ? "" : (keys_cfg.binds[i].mods & KEYMAP_MOD_META) ? " +meta" : "",
+	     keys_cfg.binds[i].action);
+      if (keys_cfg.binds[i].command[0] != '\0')
+	printf("      command: %s\n", keys_cfg.binds[i].command);
+    }
+  printf(" + Hooks:\n");
+  printf("    AC plugged: %s\n", hooks_cfg.ac_plugged);
+  printf("    AC unplugged: %s\n", hooks_cfg.ac_unplugged);
+  printf("    lid closed: %s\n", hooks_cfg.lid_closed);
+  printf("    lid opened: %s\n", hooks_cfg.lid_opened);
 #ifndef __powerpc__
   printf(" + Apple Remote IR Receiver:\n");
   printf("    enabled: %s\n", (appleir_cfg.enabled) ? "yes" : "no");
@@ -255,6 +441,9 @@ config_load(void)
 
   int ret;
 
+  config_arena_used = 0;
+  config_arena_full = 0;
+
   cfg = cfg_init(opts, CFGF_NONE);
 
   if (cfg == NULL)
@@ -322,12 +511,16 @@ config_load(void)
   /* Fill up the structs */
   sec = cfg_getsec(cfg, "general");
   general_cfg.fnmode = cfg_getint(sec, "fnmode");
+  general_cfg.io_uring = cfg_getbool(sec, "io_uring");
+  general_cfg.lowlatency = cfg_getbool(sec, "lowlatency");
+  general_cfg.control_group = config_strdup(cfg_getstr(sec, "control_group"));
 
   sec = cfg_getsec(cfg, "lcd_sysfs");
   lcd_sysfs_cfg.init = cfg_getint(sec, "init");
   lcd_sysfs_cfg.step = cfg_getint(sec, "step");
   lcd_sysfs_cfg.on_batt = cfg_getint(sec, "on_batt");
-  /* No _fix_config() call here, it's done at probe time */
+  /* Does nothing until probed, it's done at probe time then */
+  sysfs_backlight_fix_config();
 #ifndef __powerpc__
   sec = cfg_getsec(cfg, "lcd_x1600");
   lcd_x1600_cfg.init = cfg_getint(sec, "init");
@@ -339,8 +532,9 @@ config_load(void)
   lcd_gma950_cfg.init = cfg_getint(sec, "init");
   lcd_gma950_cfg.step = cfg_getint(sec, "step");
   lcd_gma950_cfg.on_batt = cfg_getint(sec, "on_batt");
-  /* No _fix_config() call here, as we're hardware-dependent
-   * for the max backlight value */
+  /* Hardware-dependent for the max backlight value,
+   * does nothing until probed */
+  gma950_backlight_fix_config();
 
   sec = cfg_getsec(cfg, "lcd_nv8600mgt");
   lcd_nv8600mgt_cfg.init = cfg_getint(sec, "init");
@@ -351,13 +545,13 @@ config_load(void)
 
   sec = cfg_getsec(cfg, "audio");
   audio_cfg.disabled = cfg_getbool(sec, "disabled");
-  audio_cfg.card = strdup(cfg_getstr(sec, "card"));
+  audio_cfg.card = config_strdup(cfg_getstr(sec, "card"));
   audio_cfg.init = cfg_getint(sec, "init");
   audio_cfg.step = cfg_getint(sec, "step");
   audio_cfg.beep = cfg_getbool(sec, "beep");
-  audio_cfg.vol = strdup(cfg_getstr(sec, "volume"));
-  audio_cfg.spkr = strdup(cfg_getstr(sec, "speakers"));
-  audio_cfg.head = strdup(cfg_getstr(sec, "headphones"));
+  audio_cfg.vol = config_strdup(cfg_getstr(sec, "volume"));
+  audio_cfg.spkr = config_strdup(cfg_getstr(sec, "speakers"));
+  audio_cfg.head = config_strdup(cfg_getstr(sec, "headphones"));
   audio_fix_config();
 
   sec = cfg_getsec(cfg, "kbd");
@@ -372,7 +566,7 @@ config_load(void)
 
   sec = cfg_getsec(cfg, "eject");
   eject_cfg.enabled = cfg_getbool(sec, "enabled");
-  eject_cfg.device = strdup(cfg_getstr(sec, "device"));
+  eject_cfg.device = config_strdup(cfg_getstr(sec, "device"));
   cd_eject_fix_config();
 
   sec = cfg_getsec(cfg, "beep");
@@ -380,7 +574,7 @@ config_load(void)
     beep_cfg.enabled = 0;
   else
     beep_cfg.enabled = cfg_getbool(sec, "enabled");
-  beep_cfg.beepfile = strdup(cfg_getstr(sec, "beepfile"));
+  beep_cfg.beepfile = config_strdup(cfg_getstr(sec, "beepfile"));
   beep_fix_config();
 
 #ifndef __powerpc__
@@ -388,23 +582,167 @@ config_load(void)
   appleir_cfg.enabled = cfg_getbool(sec, "enabled");
 #endif
 
+  sec = cfg_getsec(cfg, "hooks");
+  hooks_cfg.ac_plugged = config_strdup(cfg_getstr(sec, "ac_plugged"));
+  hooks_cfg.ac_unplugged = config_strdup(cfg_getstr(sec, "ac_unplugged"));
+  hooks_cfg.lid_closed = config_strdup(cfg_getstr(sec, "lid_closed"));
+  hooks_cfg.lid_opened = config_strdup(cfg_getstr(sec, "lid_opened"));
+
+  sec = cfg_getsec(cfg, "keys");
+  ret = config_load_keys(sec);
+  if (ret == 0)
+    ret = keymap_compile();
+
   cfg_free(cfg);
 
+  if (config_arena_full)
+    return -1;
+
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Invalid key bindings in configuration file");
+
+      return -1;
+    }
+
   if (console)
     config_print();
 
   return 0;
 }
 
-void
-config_cleanup(void)
+
+static void
+config_snapshot_take(struct config_snapshot *s)
+{
+  s->general = general_cfg;
+  s->lcd_sysfs = lcd_sysfs_cfg;
+#ifndef __powerpc__
+  s->lcd_x1600 = lcd_x1600_cfg;
+  s->lcd_gma950 = lcd_gma950_cfg;
+  s->lcd_nv8600mgt = lcd_nv8600mgt_cfg;
+  s->appleir = appleir_cfg;
+#endif
+  s->audio = audio_cfg;
+  s->kbd = kbd_cfg;
+  s->eject = eject_cfg;
+  s->beep = beep_cfg;
+  s->keys = keys_cfg;
+  s->hooks = hooks_cfg;
+}
+
+static void
+config_snapshot_restore(struct config_snapshot *s)
 {
-  free(audio_cfg.card);
-  free(audio_cfg.vol);
-  free(audio_cfg.spkr);
-  free(audio_cfg.head);
+  general_cfg = s->general;
+  lcd_sysfs_cfg = s->lcd_sysfs;
+#ifndef __powerpc__
+  lcd_x1600_cfg = s->lcd_x1600;
+  lcd_gma950_cfg = s->lcd_gma950;
+  lcd_nv8600mgt_cfg = s->lcd_nv8600mgt;
+  appleir_cfg = s->appleir;
+#endif
+  audio_cfg = s->audio;
+  kbd_cfg = s->kbd;
+  eject_cfg = s->eject;
+  beep_cfg = s->beep;
+  keys_cfg = s->keys;
+  hooks_cfg = s->hooks;
+}
 
-  free(eject_cfg.device);
+/* The lid switch is only listened to if there's a hook for it */
+static int
+config_lid_hooks(struct _hooks_cfg *hooks)
+{
+  return (hooks->lid_closed[0] != '\0') || (hooks->lid_opened[0] != '\0');
+}
+
+/*
+ * Reload the configuration file; called from the event loop, so the new
+ * settings are swapped in between two events. Returns CONFIG_RELOAD_*
+ * flags for the subsystems to reinitialize, or -1 if the file could not
+ * be loaded, in which case the current configuration is kept.
+ */
+int
+config_reload(void)
+{
+  struct config_snapshot old;
+  int changed;
+  int ret;
 
-  free(beep_cfg.beepfile);
+  config_snapshot_take(&old);
+
+  config_arena_cur ^= 1;
+  config_arena = config_arenas[config_arena_cur];
+
+  ret = config_load();
+  if (ret < 0)
+    {
+      config_arena_cur ^= 1;
+      config_arena = config_arenas[config_arena_cur];
+
+      config_snapshot_restore(&old);
+
+      /* Rebuilt from the new bindings, maybe halfway */
+      keymap_compile();
+
+      logmsg(LOG_ERR, "Configuration reload failed, keeping the current configuration");
+
+      return -1;
+    }
+
+  changed = 0;
+
+  if (general_cfg.fnmode != old.general.fnmode)
+    changed |= CONFIG_RELOAD_FNMODE;
+
+  if ((general_cfg.io_uring != old.general.io_uring)
+      || (general_cfg.lowlatency != old.general.lowlatency))
+    {
+      logmsg(LOG_WARNING, "Changes to io_uring and lowlatency need a restart");
+
+      general_cfg.io_uring = old.general.io_uring;
+      general_cfg.lowlatency = old.general.lowlatency;
+    }
+
+  if (strcmp(general_cfg.control_group, old.general.control_group) != 0)
+    changed |= CONFIG_RELOAD_CONTROL;
+
+  /* The initial volume is only set at startup */
+  if ((audio_cfg.disabled != old.audio.disabled)
+      || (strcmp(audio_cfg.card, old.audio.card) != 0)
+      || (strcmp(audio_cfg.vol, old.audio.vol) != 0)
+      || (strcmp(audio_cfg.spkr, old.audio.spkr) != 0)
+      || (strcmp(audio_cfg.head, old.audio.head) != 0))
+    changed |= CONFIG_RELOAD_AUDIO;
+
+  if (kbd_cfg.auto_on != old.kbd.auto_on)
+    changed |= CONFIG_RELOAD_KBD_AUTO;
+
+  if ((beep_cfg.enabled != old.beep.enabled)
+      || (strcmp(beep_cfg.beepfile, old.beep.beepfile) != 0))
+    changed |= CONFIG_RELOAD_BEEP;
+
+  if (config_lid_hooks(&hooks_cfg) != config_lid_hooks(&old.hooks))
+    changed |= CONFIG_RELOAD_EVDEV;
+
+#ifndef __powerpc__
+  if (appleir_cfg.enabled != old.appleir.enabled)
+    changed |= CONFIG_RELOAD_EVDEV;
+#endif
+
+  return changed;
+}
+
+void
+config_cleanup(void)
+{
+  keys_cfg.binds = NULL;
+  keys_cfg.nbinds = 0;
+
+  /* All the strings go with it */
+  config_arena_cur = 0;
+  config_arena = config_arenas[0];
+  config_arena_used = 0;
+  config_arena_full = 0;
 }
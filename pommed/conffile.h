@@ -7,6 +7,9 @@
 
 struct _general_cfg {
   int fnmode;
+  int io_uring;
+  int lowlatency;
+  char *control_group;
 };
 
 struct _lcd_sysfs_cfg {
@@ -67,6 +70,25 @@ struct _beep_cfg {
   char *beepfile;
 };
 
+struct _keys_bind {
+  char *key;
+  char *action;
+  char *command;  /* exec action */
+  int mods;  /* KEYMAP_MOD_* */
+};
+
+struct _keys_cfg {
+  int nbinds;
+  struct _keys_bind *binds;
+};
+
+struct _hooks_cfg {
+  char *ac_plugged;
+  char *ac_unplugged;
+  char *lid_closed;
+  char *lid_opened;
+};
+
 #ifndef __powerpc__
 struct _appleir_cfg {
   int enabled;
@@ -85,14 +107,37 @@ extern struct _audio_cfg audio_cfg;
 extern struct _kbd_cfg kbd_cfg;
 extern struct _eject_cfg eject_cfg;
 extern struct _beep_cfg beep_cfg;
+extern struct _keys_cfg keys_cfg;
+extern struct _hooks_cfg hooks_cfg;
 #ifndef __powerpc__
 extern struct _appleir_cfg appleir_cfg;
 #endif
 
 
+/* Strings and key bindings from the configuration file live here */
+#define CONFIG_ARENA_SIZE    16384
+
+/*
+ * What config_reload() found changed and must be acted upon; everything
+ * else is read at the time of use and takes effect right away
+ */
+#define CONFIG_RELOAD_FNMODE     (1 << 0)
+#define CONFIG_RELOAD_AUDIO      (1 << 1)  /* mixer card or elements */
+#define CONFIG_RELOAD_KBD_AUTO   (1 << 2)
+#define CONFIG_RELOAD_BEEP       (1 << 3)
+#define CONFIG_RELOAD_EVDEV      (1 << 4)  /* AppleIR, lid switch */
+#define CONFIG_RELOAD_CONTROL    (1 << 5)  /* control socket group */
+
+
+char *
+config_strdup(const char *str);
+
 int
 config_load(void);
 
+int
+config_reload(void);
+
 void
 config_cleanup(void);
 
@@ -0,0 +1,676 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Control socket: a line-based protocol on a Unix stream socket.
+ *
+ *   GET                         -> STATE lcd <lvl> <max> kbd <lvl> <max>
+ *                                  volume <lvl> <max> mute <0|1> ac <state>
+ *   SUBSCRIBE                   -> OK, then a STATE line on every change
+ *   UNSUBSCRIBE                 -> OK
+ *   ACTION <action>             -> OK, runs a key binding action
+ *   SET LCD|KBD|VOLUME <level>  -> OK
+ *
+ * Each message is one line, at most CONTROL_LINE_MAX bytes. Errors are
+ * reported as ERR <reason>. STATE lines that do not fit in the socket
+ * buffer are dropped, the next one supersedes them anyway; a client
+ * whose buffer only takes part of a line is disconnected.
+ *
+ * Anyone can connect so status bars can read the state. ACTION and SET
+ * change the machine: they are accepted from root and from members of
+ * the control_group set in the configuration, going by the credentials
+ * of the peer.
+ */
+
+/* struct ucred */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <grp.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "pommed.h"
+#include "evloop.h"
+#include "keymap.h"
+#include "lcd_backlight.h"
+#include "kbd_backlight.h"
+#include "audio.h"
+#include "power.h"
+#include "control.h"
+#include "statefile.h"
+#include "conffile.h"
+
+
+/* Linux 4.13 */
+#ifndef SO_PEERGROUPS
+# define SO_PEERGROUPS 59
+#endif
+
+
+struct control_client
+{
+  int fd;
+  int subscribed;
+  int privileged;
+
+  int len;
+  char buf[CONTROL_LINE_MAX];
+};
+
+static struct control_client clients[CONTROL_MAX_CLIENTS];
+
+static int control_sock = -1;
+
+static struct control_state last_state;
+
+/* Resolved control_group, -1 if none */
+static gid_t control_gid = (gid_t)-1;
+
+/* Publishing queued as idle work, see control_update() */
+static int publish_queued;
+
+
+void
+control_snapshot(struct control_state *state)
+{
+  memset(state, 0, sizeof(*state));
+
+  state->lcd_level = lcd_bck_info.level;
+  state->lcd_max = lcd_bck_info.max;
+
+  if (has_kbd_backlight())
+    {
+      state->kbd_level = kbd_bck_info.level;
+      state->kbd_max = kbd_bck_info.max;
+    }
+
+  state->vol_level = audio_info.level;
+  state->vol_max = audio_info.max;
+  state->muted = audio_info.muted;
+
+  state->ac = power_ac_state();
+}
+
+static int
+control_format_state(struct control_state *state, char *buf, int size)
+{
+  return snprintf(buf, size, "STATE lcd %d %d kbd %d %d volume %d %d mute %d ac %d\n",
+		  state->lcd_level, state->lcd_max,
+		  state->kbd_level, state->kbd_max,
+		  state->vol_level, state->vol_max,
+		  (state->muted) ? 1 : 0, state->ac);
+}
+
+
+static void
+control_client_close(struct control_client *client)
+{
+  evloop_remove(client->fd);
+  close(client->fd);
+
+  client->fd = -1;
+
+  logdebug("Control client disconnected\n");
+}
+
+/* Returns -1 if the client went away */
+static int
+control_client_send(struct control_client *client, const char *line, int len)
+{
+  ssize_t ret;
+
+  ret = send(client->fd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (ret < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+	return 0;
+
+      control_client_close(client);
+
+      return -1;
+    }
+
+  /* The rest of the line would be glued to the next one; drop the client */
+  if (ret < len)
+    {
+      logdebug("Control client too slow, disconnecting\n");
+
+      control_client_close(client);
+
+      return -1;
+    }
+
+  return 0;
+}
+
+static int
+control_client_reply(struct control_client *client, const char *msg)
+{
+  char line[CONTROL_LINE_MAX];
+  int len;
+
+  len = snprintf(line, sizeof(line), "%s\n", msg);
+
+  return control_client_send(client, line, len);
+}
+
+
+static void
+control_set_lcd(int val)
+{
+  int prev;
+  int i;
+
+  /* Backends only know how to step; walk towards the target */
+  for (i = 0; (i < CONTROL_LCD_STEPS_MAX) && (lcd_bck_info.level != val); i++)
+    {
+      prev = lcd_bck_info.level;
+
+      mops->lcd_backlight_step((val > prev) ? STEP_UP : STEP_DOWN);
+
+      /* Stuck at a bound, or stepped over the target */
+      if ((lcd_bck_info.level == prev)
+	  || ((prev < val) != (lcd_bck_info.level < val)))
+	break;
+    }
+}
+
+static const char *
+control_set(char *args)
+{
+  char *what;
+  char *end;
+  long val;
+
+  what = strsep(&args, " ");
+  if ((args == NULL) || (*args == '\0'))
+    return "ERR missing level";
+
+  val = strtol(args, &end, 10);
+  if ((*end != '\0') || (val < 0))
+    return "ERR invalid level";
+
+  if (strcasecmp(what, "lcd") == 0)
+    {
+      if (val > lcd_bck_info.max)
+	return "ERR invalid level";
+
+      control_set_lcd(val);
+    }
+  else if (strcasecmp(what, "kbd") == 0)
+    {
+      if (!has_kbd_backlight())
+	return "ERR no keyboard backlight";
+
+      if (val > kbd_bck_info.max)
+	return "ERR invalid level";
+
+      kbd_backlight_set(val, KBD_USER);
+    }
+  else if (strcasecmp(what, "volume") == 0)
+    {
+      if (val > audio_info.max)
+	return "ERR invalid level";
+
+      audio_set(val);
+    }
+  else
+    return "ERR unknown control";
+
+  return "OK";
+}
+
+/* Returns -1 if the client went away */
+static int
+control_client_request(struct control_client *client, char *line)
+{
+  struct control_state state;
+  char buf[CONTROL_LINE_MAX];
+  const char *reply;
+  char *cmd;
+  int len;
+  int ret;
+
+  cmd = strsep(&line, " ");
+
+  if (strcasecmp(cmd, "GET") == 0)
+    {
+      control_snapshot(&state);
+      len = control_format_state(&state, buf, sizeof(buf));
+
+      return control_client_send(client, buf, len);
+    }
+  else if (strcasecmp(cmd, "SUBSCRIBE") == 0)
+    {
+      client->subscribed = 1;
+
+      ret = control_client_reply(client, "OK");
+      if (ret < 0)
+	return -1;
+
+      /* Start the client off with the current state */
+      control_snapshot(&state);
+      len = control_format_state(&state, buf, sizeof(buf));
+
+      return control_client_send(client, buf, len);
+    }
+  else if (strcasecmp(cmd, "UNSUBSCRIBE") == 0)
+    {
+      client->subscribed = 0;
+
+      reply = "OK";
+    }
+  else if (!client->privileged
+	   && ((strcasecmp(cmd, "ACTION") == 0) || (strcasecmp(cmd, "SET") == 0)))
+    reply = "ERR permission denied";
+  else if (strcasecmp(cmd, "ACTION") == 0)
+    {
+      if ((line == NULL) || (keymap_run(line) < 0))
+	reply = "ERR unknown action";
+      else
+	reply = "OK";
+    }
+  else if (strcasecmp(cmd, "SET") == 0)
+    {
+      if (line == NULL)
+	reply = "ERR missing control";
+      else
+	reply = control_set(line);
+    }
+  else
+    reply = "ERR unknown command";
+
+  return control_client_reply(client, reply);
+}
+
+static void
+control_client_process(int fd, uint32_t events)
+{
+  struct control_client *client;
+  char *line;
+  char *eol;
+  ssize_t n;
+  int ret;
+  int i;
+
+  client = NULL;
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+      if (clients[i].fd == fd)
+	{
+	  client = &clients[i];
+	  break;
+	}
+    }
+
+  if (client == NULL)
+    return;
+
+  if (events & (EPOLLERR | EPOLLHUP))
+    {
+      control_client_close(client);
+
+      return;
+    }
+
+  n = read(fd, client->buf + client->len, sizeof(client->buf) - client->len - 1);
+  if (n <= 0)
+    {
+      if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+	return;
+
+      control_client_close(client);
+
+      return;
+    }
+
+  client->len += n;
+  client->buf[client->len] = '\0';
+
+  line = client->buf;
+  while ((eol = strchr(line, '\n')) != NULL)
+    {
+      *eol = '\0';
+      if ((eol > line) && (eol[-1] == '\r'))
+	eol[-1] = '\0';
+
+      if (*line != '\0')
+	{
+	  ret = control_client_request(client, line);
+	  if (ret < 0)
+	    return;
+	}
+
+      line = eol + 1;
+    }
+
+  client->len -= line - client->buf;
+
+  if (client->len == sizeof(client->buf) - 1)
+    {
+      logdebug("Control client line too long, disconnecting\n");
+
+      ret = control_client_reply(client, "ERR line too long");
+      if (ret == 0)
+	control_client_close(client);
+
+      return;
+    }
+
+  memmove(client->buf, line, client->len);
+}
+
+/* Whether the peer may use ACTION and SET */
+static int
+control_client_privileged(int fd)
+{
+  struct ucred cred;
+  gid_t groups[CONTROL_PEER_GROUPS];
+  socklen_t len;
+  int ngroups;
+  int ret;
+  int i;
+
+  len = sizeof(cred);
+  ret = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len);
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Could not get control client credentials: %s", strerror(errno));
+
+      return 0;
+    }
+
+  if (cred.uid == 0)
+    return 1;
+
+  if (control_gid == (gid_t)-1)
+    return 0;
+
+  if (cred.gid == control_gid)
+    return 1;
+
+  len = sizeof(groups);
+  ret = getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, groups, &len);
+  if (ret < 0)
+    {
+      /* Older kernel, or more groups than we check; primary group only */
+      logdebug("Could not get control client groups: %s\n", strerror(errno));
+
+      return 0;
+    }
+
+  ngroups = len / sizeof(gid_t);
+  for (i = 0; i < ngroups; i++)
+    {
+      if (groups[i] == control_gid)
+	return 1;
+    }
+
+  return 0;
+}
+
+static void
+control_accept(int fd, uint32_t events)
+{
+  int cfd;
+  int ret;
+  int i;
+
+  cfd = accept(fd, NULL, NULL);
+  if (cfd < 0)
+    {
+      if ((errno != EAGAIN) && (errno != EINTR))
+	logmsg(LOG_WARNING, "Could not accept control connection: %s", strerror(errno));
+
+      return;
+    }
+
+  fcntl(cfd, F_SETFD, FD_CLOEXEC);
+  fcntl(cfd, F_SETFL, O_NONBLOCK);
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+      if (clients[i].fd < 0)
+	break;
+    }
+
+  if (i == CONTROL_MAX_CLIENTS)
+    {
+      logmsg(LOG_WARNING, "Too many control clients, max %d", CONTROL_MAX_CLIENTS);
+
+      close(cfd);
+
+      return;
+    }
+
+  ret = evloop_add(cfd, EPOLLIN, EVLOOP_PRIO_DEFAULT, control_client_process);
+  if (ret < 0)
+    {
+      close(cfd);
+
+      return;
+    }
+
+  clients[i].fd = cfd;
+  clients[i].subscribed = 0;
+  clients[i].privileged = control_client_privileged(cfd);
+  clients[i].len = 0;
+
+  logdebug("Control client connected%s\n", (clients[i].privileged) ? ", privileged" : "");
+}
+
+
+/* Writes the latest state to the state file and the subscribers */
+static void
+control_publish(void *data)
+{
+  char buf[CONTROL_LINE_MAX];
+  int len;
+  int i;
+
+  publish_queued = 0;
+
+  statefile_update(&last_state);
+
+  if (control_sock < 0)
+    return;
+
+  len = control_format_state(&last_state, buf, sizeof(buf));
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+      if ((clients[i].fd >= 0) && clients[i].subscribed)
+	control_client_send(&clients[i], buf, len);
+    }
+}
+
+/*
+ * Called after each event loop iteration. Publishing is idle work: during
+ * a burst of keypresses it waits for the loop to quiet down, and all the
+ * changes made meanwhile go out as a single update.
+ */
+void
+control_update(void)
+{
+  struct control_state state;
+  int ret;
+
+  control_snapshot(&state);
+
+  if (memcmp(&state, &last_state, sizeof(state)) == 0)
+    return;
+
+  last_state = state;
+
+  if (publish_queued)
+    return;
+
+  ret = evloop_idle(control_publish, NULL);
+  if (ret < 0)
+    {
+      control_publish(NULL);
+
+      return;
+    }
+
+  publish_queued = 1;
+}
+
+/* Not from the event loop in steady state, getgrnam() allocates */
+static void
+control_resolve_group(void)
+{
+  struct group *gr;
+
+  control_gid = (gid_t)-1;
+
+  if (general_cfg.control_group[0] == '\0')
+    return;
+
+  gr = getgrnam(general_cfg.control_group);
+  if (gr == NULL)
+    {
+      logmsg(LOG_WARNING, "Unknown control group %s, ACTION and SET restricted to root",
+	     general_cfg.control_group);
+
+      return;
+    }
+
+  control_gid = gr->gr_gid;
+}
+
+/* Called on reload, when control_group changed */
+void
+control_reconfigure(void)
+{
+  int i;
+
+  control_resolve_group();
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+      if (clients[i].fd >= 0)
+	clients[i].privileged = control_client_privileged(clients[i].fd);
+    }
+}
+
+int
+control_init(void)
+{
+  struct sockaddr_un sun;
+  int ret;
+  int i;
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    clients[i].fd = -1;
+
+  control_resolve_group();
+
+  control_sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (control_sock < 0)
+    {
+      logmsg(LOG_ERR, "Could not create control socket: %s", strerror(errno));
+
+      return -1;
+    }
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, CONTROL_SOCKET, sizeof(sun.sun_path) - 1);
+
+  /* Left over by a previous instance */
+  unlink(CONTROL_SOCKET);
+
+  ret = bind(control_sock, (struct sockaddr *)&sun, sizeof(sun));
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not bind control socket: %s", strerror(errno));
+
+      goto out_close;
+    }
+
+  /* Status bars run as the user; ACTION and SET are checked per client */
+  chmod(CONTROL_SOCKET, 0666);
+
+  ret = listen(control_sock, CONTROL_MAX_CLIENTS);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not listen on control socket: %s", strerror(errno));
+
+      goto out_unlink;
+    }
+
+  ret = evloop_add(control_sock, EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, control_accept);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not add control socket to event loop");
+
+      goto out_unlink;
+    }
+
+  control_snapshot(&last_state);
+  publish_queued = 0;
+
+  return 0;
+
+ out_unlink:
+  unlink(CONTROL_SOCKET);
+ out_close:
+  close(control_sock);
+  control_sock = -1;
+
+  return -1;
+}
+
+void
+control_cleanup(void)
+{
+  int i;
+
+  if (control_sock < 0)
+    return;
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+      if (clients[i].fd >= 0)
+	control_client_close(&clients[i]);
+    }
+
+  evloop_remove(control_sock);
+  close(control_sock);
+  control_sock = -1;
+
+  unlink(CONTROL_SOCKET);
+}
@@ -0,0 +1,53 @@
+/*
+ * pommed - control.h
+ */
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+
+#define CONTROL_SOCKET          "/run/pommed.sock"
+
+#define CONTROL_MAX_CLIENTS     8
+
+/* Requests and replies are single lines */
+#define CONTROL_LINE_MAX        128
+
+/* Supplementary groups of a client checked against the control group */
+#define CONTROL_PEER_GROUPS     64
+
+/* Bound on the steps taken by SET LCD */
+#define CONTROL_LCD_STEPS_MAX   64
+
+
+/* State reported to the clients */
+struct control_state
+{
+  int lcd_level;
+  int lcd_max;
+  int kbd_level;
+  int kbd_max;
+  int vol_level;
+  int vol_max;
+  int muted;
+  int ac;
+};
+
+
+void
+control_snapshot(struct control_state *state);
+
+void
+control_update(void);
+
+void
+control_reconfigure(void);
+
+int
+control_init(void);
+
+void
+control_cleanup(void);
+
+
+#endif /* !__CONTROL_H__ */
@@ -0,0 +1,202 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Libraries that are only needed by some setups, or only for a short
+ * while, are loaded with dlopen() when first needed instead of being
+ * linked in: ALSA isn't loaded when audio is handled elsewhere,
+ * libaudiofile only while the beep sample is decoded and libpci only
+ * while probing.
+ *
+ * Loads are reference counted; the library is closed with the last
+ * reference, and its table must not be used after that.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <syslog.h>
+
+#include <dlfcn.h>
+
+#include <pthread.h>
+
+#define DYNLIB_LOADER
+#include "pommed.h"
+#include "dynlib.h"
+#include "dynlib_alsa.h"
+#include "dynlib_audiofile.h"
+#ifndef __powerpc__
+# include "dynlib_pci.h"
+#endif
+
+
+/* Probes and the beep thread may load libraries concurrently */
+static pthread_mutex_t dynlib_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+#define ALSA_SYM(sym)       DYNLIB_SYM(struct dynlib_alsa_table, sym)
+
+static const struct dynlib_sym alsa_syms[] =
+  {
+    DYNLIB_ALSA_SYMS(ALSA_SYM)
+    { NULL, 0 }
+  };
+
+struct dynlib_alsa_table dynlib_alsa_table;
+
+struct dynlib dynlib_alsa =
+  {
+    .soname = DYNLIB_ALSA_SONAME,
+    .syms = alsa_syms,
+    .table = &dynlib_alsa_table,
+    .table_size = sizeof(dynlib_alsa_table),
+  };
+
+
+#define AUDIOFILE_SYM(sym)  DYNLIB_SYM(struct dynlib_audiofile_table, sym)
+
+static const struct dynlib_sym audiofile_syms[] =
+  {
+    DYNLIB_AUDIOFILE_SYMS(AUDIOFILE_SYM)
+    { NULL, 0 }
+  };
+
+struct dynlib_audiofile_table dynlib_audiofile_table;
+
+struct dynlib dynlib_audiofile =
+  {
+    .soname = DYNLIB_AUDIOFILE_SONAME,
+    .syms = audiofile_syms,
+    .table = &dynlib_audiofile_table,
+    .table_size = sizeof(dynlib_audiofile_table),
+  };
+
+
+#ifndef __powerpc__
+#define PCI_SYM(sym)        DYNLIB_SYM(struct dynlib_pci_table, sym)
+
+static const struct dynlib_sym pci_syms[] =
+  {
+    DYNLIB_PCI_SYMS(PCI_SYM)
+    { NULL, 0 }
+  };
+
+struct dynlib_pci_table dynlib_pci_table;
+
+struct dynlib dynlib_pci =
+  {
+    .soname = DYNLIB_PCI_SONAME,
+    .syms = pci_syms,
+    .table = &dynlib_pci_table,
+    .table_size = sizeof(dynlib_pci_table),
+  };
+#endif /* !__powerpc__ */
+
+
+/* Returns 0 once the library and all its symbols are available */
+int
+dynlib_load(struct dynlib *lib)
+{
+  const struct dynlib_sym *sym;
+  void *fn;
+  size_t size;
+
+  pthread_mutex_lock(&dynlib_mutex);
+
+  if (lib->refs > 0)
+    {
+      lib->refs++;
+
+      pthread_mutex_unlock(&dynlib_mutex);
+
+      return 0;
+    }
+
+  /* Don't retry, and complain only once */
+  if (lib->failed)
+    {
+      pthread_mutex_unlock(&dynlib_mutex);
+
+      return -1;
+    }
+
+  lib->handle = dlopen(lib->soname, RTLD_NOW | RTLD_LOCAL);
+  if (lib->handle == NULL)
+    {
+      logmsg(LOG_WARNING, "Could not load %s: %s", lib->soname, dlerror());
+
+      lib->failed = 1;
+
+      pthread_mutex_unlock(&dynlib_mutex);
+
+      return -1;
+    }
+
+  for (sym = lib->syms, size = 0; sym->name != NULL; sym++, size++)
+    {
+      fn = dlsym(lib->handle, sym->name);
+      if (fn == NULL)
+	{
+	  logmsg(LOG_WARNING, "Could not load %s: symbol %s not found", lib->soname, sym->name);
+
+	  dlclose(lib->handle);
+	  lib->handle = NULL;
+	  lib->failed = 1;
+
+	  pthread_mutex_unlock(&dynlib_mutex);
+
+	  return -1;
+	}
+
+      memcpy((char *)lib->table + sym->offset, &fn, sizeof(fn));
+    }
+
+  lib->refs = 1;
+
+  logdebug("Loaded %s, %zu symbols\n", lib->soname, size);
+
+  pthread_mutex_unlock(&dynlib_mutex);
+
+  return 0;
+}
+
+void
+dynlib_unload(struct dynlib *lib)
+{
+  pthread_mutex_lock(&dynlib_mutex);
+
+  if (lib->refs > 0)
+    {
+      lib->refs--;
+
+      if (lib->refs == 0)
+	{
+	  dlclose(lib->handle);
+	  lib->handle = NULL;
+
+	  /* Catch any use after unload */
+	  memset(lib->table, 0, lib->table_size);
+
+	  logdebug("Unloaded %s\n", lib->soname);
+	}
+    }
+
+  pthread_mutex_unlock(&dynlib_mutex);
+}
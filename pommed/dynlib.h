@@ -0,0 +1,46 @@
+/*
+ * pommed - dynlib.h
+ */
+
+#ifndef __DYNLIB_H__
+#define __DYNLIB_H__
+
+#include <stddef.h>
+
+
+/*
+ * A library loaded on first use; its functions are called through a
+ * table of pointers, filled from the symbol list by dynlib_load().
+ * See dynlib_alsa.h for an example.
+ */
+struct dynlib_sym
+{
+  const char *name;
+  size_t offset;
+};
+
+struct dynlib
+{
+  const char *soname;
+  const struct dynlib_sym *syms;
+  void *table;
+  size_t table_size;
+
+  void *handle;
+  int refs;
+  int failed;
+};
+
+/* Helpers for the per-library headers */
+#define DYNLIB_FIELD(sym)     __typeof__(sym) *sym;
+#define DYNLIB_SYM(tab, sym)  { #sym, offsetof(tab, sym) },
+
+
+int
+dynlib_load(struct dynlib *lib);
+
+void
+dynlib_unload(struct dynlib *lib);
+
+
+#endif /* !__DYNLIB_H__ */
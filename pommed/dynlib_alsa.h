@@ -0,0 +1,116 @@
+/*
+ * pommed - dynlib_alsa.h
+ */
+
+#ifndef __DYNLIB_ALSA_H__
+#define __DYNLIB_ALSA_H__
+
+#include <alsa/asoundlib.h>
+
+#include "dynlib.h"
+
+
+/* ALSA, for the mixer and the beeper */
+#define DYNLIB_ALSA_SONAME  "libasound.so.2"
+
+#define DYNLIB_ALSA_SYMS(X) \
+  X(snd_strerror) \
+  X(snd_ctl_open) \
+  X(snd_ctl_close) \
+  X(snd_ctl_read) \
+  X(snd_ctl_subscribe_events) \
+  X(snd_ctl_poll_descriptors) \
+  X(snd_ctl_poll_descriptors_count) \
+  X(snd_ctl_elem_info) \
+  X(snd_ctl_elem_read) \
+  X(snd_ctl_elem_write) \
+  X(snd_ctl_elem_info_sizeof) \
+  X(snd_ctl_elem_info_get_count) \
+  X(snd_ctl_elem_info_get_max) \
+  X(snd_ctl_elem_info_get_min) \
+  X(snd_ctl_elem_info_get_numid) \
+  X(snd_ctl_elem_info_get_type) \
+  X(snd_ctl_elem_info_set_index) \
+  X(snd_ctl_elem_info_set_interface) \
+  X(snd_ctl_elem_info_set_name) \
+  X(snd_ctl_elem_info_set_numid) \
+  X(snd_ctl_elem_value_sizeof) \
+  X(snd_ctl_elem_value_get_integer) \
+  X(snd_ctl_elem_value_set_integer) \
+  X(snd_ctl_elem_value_set_numid) \
+  X(snd_ctl_event_sizeof) \
+  X(snd_ctl_event_get_type) \
+  X(snd_ctl_event_elem_get_mask) \
+  X(snd_ctl_event_elem_get_numid) \
+  X(snd_pcm_open) \
+  X(snd_pcm_close) \
+  X(snd_pcm_drop) \
+  X(snd_pcm_writei) \
+  X(snd_pcm_recover) \
+  X(snd_pcm_hw_params) \
+  X(snd_pcm_hw_params_sizeof) \
+  X(snd_pcm_hw_params_any) \
+  X(snd_pcm_hw_params_set_access) \
+  X(snd_pcm_hw_params_set_format) \
+  X(snd_pcm_hw_params_set_rate_near) \
+  X(snd_pcm_hw_params_set_channels_near) \
+  X(snd_pcm_hw_params_set_periods_near) \
+  X(snd_pcm_hw_params_set_buffer_size_near)
+
+struct dynlib_alsa_table
+{
+  DYNLIB_ALSA_SYMS(DYNLIB_FIELD)
+};
+
+extern struct dynlib_alsa_table dynlib_alsa_table;
+extern struct dynlib dynlib_alsa;
+
+
+/* Calls go through the table, except in dynlib.c which fills it */
+#ifndef DYNLIB_LOADER
+# define snd_strerror                           (dynlib_alsa_table.snd_strerror)
+# define snd_ctl_open                           (dynlib_alsa_table.snd_ctl_open)
+# define snd_ctl_close                          (dynlib_alsa_table.snd_ctl_close)
+# define snd_ctl_read                           (dynlib_alsa_table.snd_ctl_read)
+# define snd_ctl_subscribe_events               (dynlib_alsa_table.snd_ctl_subscribe_events)
+# define snd_ctl_poll_descriptors               (dynlib_alsa_table.snd_ctl_poll_descriptors)
+# define snd_ctl_poll_descriptors_count         (dynlib_alsa_table.snd_ctl_poll_descriptors_count)
+# define snd_ctl_elem_info                      (dynlib_alsa_table.snd_ctl_elem_info)
+# define snd_ctl_elem_read                      (dynlib_alsa_table.snd_ctl_elem_read)
+# define snd_ctl_elem_write                     (dynlib_alsa_table.snd_ctl_elem_write)
+# define snd_ctl_elem_info_sizeof               (dynlib_alsa_table.snd_ctl_elem_info_sizeof)
+# define snd_ctl_elem_info_get_count            (dynlib_alsa_table.snd_ctl_elem_info_get_count)
+# define snd_ctl_elem_info_get_max              (dynlib_alsa_table.snd_ctl_elem_info_get_max)
+# define snd_ctl_elem_info_get_min              (dynlib_alsa_table.snd_ctl_elem_info_get_min)
+# define snd_ctl_elem_info_get_numid            (dynlib_alsa_table.snd_ctl_elem_info_get_numid)
+# define snd_ctl_elem_info_get_type             (dynlib_alsa_table.snd_ctl_elem_info_get_type)
+# define snd_ctl_elem_info_set_index            (dynlib_alsa_table.snd_ctl_elem_info_set_index)
+# define snd_ctl_elem_info_set_interface        (dynlib_alsa_table.snd_ctl_elem_info_set_interface)
+# define snd_ctl_elem_info_set_name             (dynlib_alsa_table.snd_ctl_elem_info_set_name)
+# define snd_ctl_elem_info_set_numid            (dynlib_alsa_table.snd_ctl_elem_info_set_numid)
+# define snd_ctl_elem_value_sizeof              (dynlib_alsa_table.snd_ctl_elem_value_sizeof)
+# define snd_ctl_elem_value_get_integer         (dynlib_alsa_table.snd_ctl_elem_value_get_integer)
+# define snd_ctl_elem_value_set_integer         (dynlib_alsa_table.snd_ctl_elem_value_set_integer)
+# define snd_ctl_elem_value_set_numid           (dynlib_alsa_table.snd_ctl_elem_value_set_numid)
+# define snd_ctl_event_sizeof                   (dynlib_alsa_table.snd_ctl_event_sizeof)
+# define snd_ctl_event_get_type                 (dynlib_alsa_table.snd_ctl_event_get_type)
+# define snd_ctl_event_elem_get_mask            (dynlib_alsa_table.snd_ctl_event_elem_get_mask)
+# define snd_ctl_event_elem_get_numid           (dynlib_alsa_table.snd_ctl_event_elem_get_numid)
+# define snd_pcm_open                           (dynlib_alsa_table.snd_pcm_open)
+# define snd_pcm_close                          (dynlib_alsa_table.snd_pcm_close)
+# define snd_pcm_drop                           (dynlib_alsa_table.snd_pcm_drop)
+# define snd_pcm_writei                         (dynlib_alsa_table.snd_pcm_writei)
+# define snd_pcm_recover                        (dynlib_alsa_table.snd_pcm_recover)
+# define snd_pcm_hw_params                      (dynlib_alsa_table.snd_pcm_hw_params)
+# define snd_pcm_hw_params_sizeof               (dynlib_alsa_table.snd_pcm_hw_params_sizeof)
+# define snd_pcm_hw_params_any                  (dynlib_alsa_table.snd_pcm_hw_params_any)
+# define snd_pcm_hw_params_set_access           (dynlib_alsa_table.snd_pcm_hw_params_set_access)
+# define snd_pcm_hw_params_set_format           (dynlib_alsa_table.snd_pcm_hw_params_set_format)
+# define snd_pcm_hw_params_set_rate_near        (dynlib_alsa_table.snd_pcm_hw_params_set_rate_near)
+# define snd_pcm_hw_params_set_channels_near    (dynlib_alsa_table.snd_pcm_hw_params_set_channels_near)
+# define snd_pcm_hw_params_set_periods_near     (dynlib_alsa_table.snd_pcm_hw_params_set_periods_near)
+# define snd_pcm_hw_params_set_buffer_size_near (dynlib_alsa_table.snd_pcm_hw_params_set_buffer_size_near)
+#endif
+
+
+#endif /* !__DYNLIB_ALSA_H__ */
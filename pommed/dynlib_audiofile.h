@@ -0,0 +1,50 @@
+/*
+ * pommed - dynlib_audiofile.h
+ */
+
+#ifndef __DYNLIB_AUDIOFILE_H__
+#define __DYNLIB_AUDIOFILE_H__
+
+#include <audiofile.h>
+
+#include "dynlib.h"
+
+
+/* libaudiofile, only needed to decode the beep sample */
+#define DYNLIB_AUDIOFILE_SONAME  "libaudiofile.so.1"
+
+#define DYNLIB_AUDIOFILE_SYMS(X) \
+  X(afOpenFile) \
+  X(afCloseFile) \
+  X(afReadFrames) \
+  X(afGetChannels) \
+  X(afGetFrameCount) \
+  X(afGetFrameSize) \
+  X(afGetRate) \
+  X(afGetSampleFormat) \
+  X(afGetVirtualByteOrder)
+
+struct dynlib_audiofile_table
+{
+  DYNLIB_AUDIOFILE_SYMS(DYNLIB_FIELD)
+};
+
+extern struct dynlib_audiofile_table dynlib_audiofile_table;
+extern struct dynlib dynlib_audiofile;
+
+
+/* Calls go through the table, except in dynlib.c which fills it */
+#ifndef DYNLIB_LOADER
+# define afOpenFile            (dynlib_audiofile_table.afOpenFile)
+# define afCloseFile           (dynlib_audiofile_table.afCloseFile)
+# define afReadFrames          (dynlib_audiofile_table.afReadFrames)
+# define afGetChannels         (dynlib_audiofile_table.afGetChannels)
+# define afGetFrameCount       (dynlib_audiofile_table.afGetFrameCount)
+# define afGetFrameSize        (dynlib_audiofile_table.afGetFrameSize)
+# define afGetRate             (dynlib_audiofile_table.afGetRate)
+# define afGetSampleFormat     (dynlib_audiofile_table.afGetSampleFormat)
+# define afGetVirtualByteOrder (dynlib_audiofile_table.afGetVirtualByteOrder)
+#endif
+
+
+#endif /* !__DYNLIB_AUDIOFILE_H__ */
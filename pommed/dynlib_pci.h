@@ -0,0 +1,42 @@
+/*
+ * pommed - dynlib_pci.h
+ */
+
+#ifndef __DYNLIB_PCI_H__
+#define __DYNLIB_PCI_H__
+
+#include <pci/pci.h>
+
+#include "dynlib.h"
+
+
+/* libpci, only needed while probing */
+#define DYNLIB_PCI_SONAME  "libpci.so.3"
+
+#define DYNLIB_PCI_SYMS(X) \
+  X(pci_alloc) \
+  X(pci_init) \
+  X(pci_scan_bus) \
+  X(pci_fill_info) \
+  X(pci_cleanup)
+
+struct dynlib_pci_table
+{
+  DYNLIB_PCI_SYMS(DYNLIB_FIELD)
+};
+
+extern struct dynlib_pci_table dynlib_pci_table;
+extern struct dynlib dynlib_pci;
+
+
+/* Calls go through the table, except in dynlib.c which fills it */
+#ifndef DYNLIB_LOADER
+# define pci_alloc     (dynlib_pci_table.pci_alloc)
+# define pci_init      (dynlib_pci_table.pci_init)
+# define pci_scan_bus  (dynlib_pci_table.pci_scan_bus)
+# define pci_fill_info (dynlib_pci_table.pci_fill_info)
+# define pci_cleanup   (dynlib_pci_table.pci_cleanup)
+#endif
+
+
+#endif /* !__DYNLIB_PCI_H__ */
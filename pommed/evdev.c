@@ -24,27 +24,37 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <dirent.h>
 
 #include <syslog.h>
 
+#include <pthread.h>
+
 #include <errno.h>
 
 #include <sys/epoll.h>
 
 #include <sys/inotify.h>
 
+#ifndef NO_SYS_TIMERFD_H
+# include <sys/timerfd.h>
+#else
+# include "timerfd-syscalls.h"
+#endif
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
 #include <linux/input.h>
 
 #include "pommed.h"
 #include "conffile.h"
 #include "evdev.h"
 #include "evloop.h"
+#include "keymap.h"
+#include "hooks.h"
 #include "kbd_backlight.h"
-#include "lcd_backlight.h"
-#include "cd_eject.h"
-#include "audio.h"
-#include "video.h"
-#include "beep.h"
+#include "probecache.h"
 
 
 #define BITS_PER_LONG (sizeof(long) * 8)
@@ -61,11 +71,165 @@
 
 
 static int
-evdev_try_add(int fd);
+evdev_try_add(int fd, int num, const char *phys);
+
+static int
+evdev_match_id(unsigned short *id);
 
 
 static int internal_kbd_fd;
 
+/* inputN parents of interest, announced by uevents before their eventN */
+struct evdev_candidate
+{
+  int input;
+  char phys[EVDEV_PHYS_LEN];
+};
+
+static struct evdev_candidate uevent_candidates[EVDEV_UEVENT_CANDIDATES];
+
+/* Event devices we're listening to, by eventN number */
+struct evdev_dev
+{
+  int fd;
+  int num;
+};
+
+static struct evdev_dev evdevs[EVDEV_MAX_DEVS];
+
+/* Classification results, kept across device removals */
+struct evdev_ident
+{
+  unsigned short id[4];
+  char phys[EVDEV_PHYS_LEN];
+  int flags;
+};
+
+static struct evdev_ident ident_cache[EVDEV_IDENT_CACHE];
+static int ident_count;
+
+static pthread_mutex_t ident_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Startup scan, shared with the scan threads */
+struct evdev_scan_dev
+{
+  int num;
+  int fd;     /* -1 if rejected */
+  int flags;
+};
+
+struct evdev_scan
+{
+  struct evdev_scan_dev devs[EVDEV_HOTPLUG_MAX];
+  int count;
+  int next;   /* next device to classify */
+
+  int done[EVDEV_HOTPLUG_MAX]; /* classified devices, in completion order */
+  int ndone;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+/* Table of known devices, see evdev_ids.awk */
+struct evdev_known_id
+{
+  unsigned short bus;
+  unsigned short vendor;
+  unsigned short product;
+  unsigned short version; /* 0: any */
+  int class;
+  const char *name;
+};
+
+/* inotify hotplug: eventN nodes waiting for the debounce timer */
+static unsigned long hotplug_pending[NBITS(EVDEV_HOTPLUG_MAX)];
+static int hotplug_timer_fd = -1;
+
+/* Aligned for struct inotify_event, records are variable-length */
+static char inotify_buf[EVDEV_INOTIFY_BUFSIZE]
+  __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+
+static int
+evdev_attached(int num)
+{
+  int i;
+
+  if (num < 0)
+    return 0;
+
+  for (i = 0; i < EVDEV_MAX_DEVS; i++)
+    {
+      if ((evdevs[i].fd >= 0) && (evdevs[i].num == num))
+	return 1;
+    }
+
+  return 0;
+}
+
+static int
+evdev_attach(int fd, int num)
+{
+  int i;
+
+  for (i = 0; i < EVDEV_MAX_DEVS; i++)
+    {
+      if (evdevs[i].fd < 0)
+	{
+	  evdevs[i].fd = fd;
+	  evdevs[i].num = num;
+
+	  return 0;
+	}
+    }
+
+  logmsg(LOG_WARNING, "Too many event devices, ignoring event%d", num);
+
+  return -1;
+}
+
+static void
+evdev_detach(int fd)
+{
+  int i;
+
+  for (i = 0; i < EVDEV_MAX_DEVS; i++)
+    {
+      if (evdevs[i].fd == fd)
+	{
+	  evdevs[i].fd = -1;
+	  evdevs[i].num = -1;
+
+	  return;
+	}
+    }
+}
+
+static void
+evdev_open_add(const char *evdev, int num, const char *phys)
+{
+  int efd;
+
+  if (evdev_attached(num))
+    {
+      logdebug("%s already attached\n", evdev);
+
+      return;
+    }
+
+  efd = open(evdev, O_RDWR);
+  if (efd < 0)
+    {
+      if (errno != ENOENT)
+	logmsg(LOG_WARNING, "Could not open %s: %s", evdev, strerror(errno));
+
+      return;
+    }
+
+  evdev_try_add(efd, num, phys);
+}
+
 void
 evdev_process_events(int fd, uint32_t events)
 {
@@ -85,6 +249,8 @@ evdev_process_events(int fd, uint32_t events)
       if (fd == internal_kbd_fd)
 	internal_kbd_fd = -1;
 
+      evdev_detach(fd);
+
       close(fd);
 
       return;
@@ -97,6 +263,9 @@ evdev_process_events(int fd, uint32_t events)
 
   if (ev.type == EV_KEY)
     {
+      /* Modifiers are tracked on release too */
+      keymap_modifier(ev.code, ev.value);
+
       /* key released - we don't care */
       if (ev.value == 0)
 	return;
@@ -108,105 +277,7 @@ evdev_process_events(int fd, uint32_t events)
 	  kbd_backlight_inhibit_clear(KBD_INHIBIT_IDLE);
 	}
 
-      switch (ev.code)
-	{
-	  case KEY_BRIGHTNESSDOWN:
-	    logdebug("\nKEY: LCD backlight down\n");
-
-	    mops->lcd_backlight_step(STEP_DOWN);
-	    break;
-
-	  case KEY_BRIGHTNESSUP:
-	    logdebug("\nKEY: LCD backlight up\n");
-
-	    mops->lcd_backlight_step(STEP_UP);
-	    break;
-
-	  case KEY_MUTE:
-	    logdebug("\nKEY: audio mute\n");
-
-	    audio_toggle_mute();
-	    break;
-
-	  case KEY_VOLUMEDOWN:
-	    logdebug("\nKEY: audio down\n");
-
-	    audio_step(STEP_DOWN);
-	    break;
-
-	  case KEY_VOLUMEUP:
-	    logdebug("\nKEY: audio up\n");
-
-	    audio_step(STEP_UP);
-	    break;
-
-	  case KEY_SWITCHVIDEOMODE:
-	    logdebug("\nKEY: video toggle\n");
-
-	    video_switch();
-	    break;
-
-	  case KEY_KBDILLUMTOGGLE:
-	    logdebug("\nKEY: keyboard backlight off\n");
-
-	    if (!has_kbd_backlight())
-	      break;
-
-	    if (kbd_cfg.auto_on)
-	      kbd_backlight_inhibit_toggle(KBD_INHIBIT_USER);
-	    else
-	      kbd_backlight_toggle();
-	    break;
-
-	  case KEY_KBDILLUMDOWN:
-	    logdebug("\nKEY: keyboard backlight down\n");
-
-	    if (!has_kbd_backlight())
-	      break;
-
-	    kbd_backlight_step(STEP_DOWN);
-	    if (kbd_bck_info.level == KBD_BACKLIGHT_OFF)
-	      kbd_backlight_inhibit_set(KBD_INHIBIT_USER);
-	    break;
-
-	  case KEY_KBDILLUMUP:
-	    logdebug("\nKEY: keyboard backlight up\n");
-
-	    if (!has_kbd_backlight())
-	      break;
-
-	    kbd_backlight_inhibit_clear(KBD_INHIBIT_USER);
-	    kbd_backlight_step(STEP_UP);
-	    break;
-
-	  case KEY_EJECTCD:
-	    logdebug("\nKEY: CD eject\n");
-
-	    cd_eject();
-	    break;
-
-	  case KEY_NEXTSONG:
-	    logdebug("\nKEY: IR fast forward\n");
-	    break;
-
-	  case KEY_PREVIOUSSONG:
-	    logdebug("\nKEY: IR rewind\n");
-	    break;
-
-	  case KEY_PLAYPAUSE:
-	    logdebug("\nKEY: IR play/pause\n");
-	    break;
-
-	  case KEY_MENU:
-	    logdebug("\nKEY: IR menu\n");
-	    break;
-
-	  default:
-#if 0
-	    logdebug("\nKEY: %x\n", ev.code);
-#endif /* 0 */
-	    break;
-	}
+      keymap_dispatch(ev.code);
     }
   else if (ev.type == EV_SW)
     {
@@ -218,28 +289,77 @@ evdev_process_events(int fd, uint32_t events)
 	      logdebug("\nLID: closed\n");
 
 	      kbd_backlight_inhibit_set(KBD_INHIBIT_LID);
+
+	      hooks_event(HOOK_LID_CLOSED);
 	    }
 	  else
 	    {
 	      logdebug("\nLID: open\n");
 
 	      kbd_backlight_inhibit_clear(KBD_INHIBIT_LID);
+
+	      hooks_event(HOOK_LID_OPENED);
 	    }
 	}
     }
 }
 
 
+/* Creation bursts settled down, open what's left */
+static void
+evdev_hotplug_timer(int fd, uint32_t events)
+{
+  uint64_t ticks;
+  char evdev[32];
+  int ret;
+  int i;
+
+  read(fd, &ticks, sizeof(ticks));
+
+  for (i = 0; i < EVDEV_HOTPLUG_MAX; i++)
+    {
+      if (!test_bit(i, hotplug_pending))
+	continue;
+
+      hotplug_pending[LONG(i)] &= ~BIT(i);
+
+      ret = snprintf(evdev, sizeof(evdev), "%s%d", EVDEV_BASE, i);
+      if ((ret <= 0) || (ret >= sizeof(evdev)))
+	continue;
+
+      logdebug("Found new event device %s\n", evdev);
+
+      evdev_open_add(evdev, i, NULL);
+    }
+}
+
+static void
+evdev_hotplug_schedule(int num)
+{
+  struct itimerspec timing;
+  int ret;
+
+  hotplug_pending[LONG(num)] |= BIT(num);
+
+  /* (Re)start the one-shot timer, so a burst ends up in a single pass */
+  memset(&timing, 0, sizeof(timing));
+  timing.it_value.tv_sec = EVDEV_HOTPLUG_DEBOUNCE / 1000;
+  timing.it_value.tv_nsec = (EVDEV_HOTPLUG_DEBOUNCE % 1000) * 1000000;
+
+  ret = timerfd_settime(hotplug_timer_fd, 0, &timing, NULL);
+  if (ret < 0)
+    logmsg(LOG_ERR, "Could not arm hotplug timer: %s", strerror(errno));
+}
+
 void
 evdev_inotify_process(int fd, uint32_t events)
 {
   int ret;
-  int efd;
-  int qsize;
+  int num;
+  ssize_t len;
+  char *p;
 
-  struct inotify_event *all_ie;
   struct inotify_event *ie;
-  char evdev[32];
 
   if (events & (EPOLLERR | EPOLLHUP))
     {
@@ -254,1008 +374,1088 @@ evdev_inotify_process(int fd, uint32_t events)
       return;
     }
 
-  /* Determine the size of the inotify queue */
-  ret = ioctl(fd, FIONREAD, &qsize);
-  if (ret < 0)
-    {
-      logmsg(LOG_ERR, "Could not determine inotify queue size: %s", strerror(errno));
-
-      return;
-    }
-
-  all_ie = (struct inotify_event *) malloc(qsize);
-  if (all_ie == NULL)
-    {
-      logmsg(LOG_ERR, "Could not allocate %d bytes for inotify events", qsize);
-
-      return;
-    }
-
-  ret = read(fd, all_ie, qsize);
-  if (ret < 0)
+  for (;;)
     {
-      logmsg(LOG_WARNING, "inotify read failed: %s", strerror(errno));
-
-      free(all_ie);
-      return;
-    }
+      len = read(fd, inotify_buf, sizeof(inotify_buf));
+      if (len < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
 
-  /* ioctl(FIONREAD) returns the number of bytes, now we need the number of elements */
-  qsize /= sizeof(struct inotify_event);
+	  if (errno != EAGAIN)
+	    logmsg(LOG_WARNING, "inotify read failed: %s", strerror(errno));
 
-  /* Loop through all the events we got */
-  for (ie = all_ie; (ie - all_ie) < qsize; ie += (1 + (ie->len / sizeof(struct inotify_event))))
-    {
-      /* ie[0] contains the inotify event information
-       * the memory space for ie[1+] contains the name of the file
-       * see the inotify documentation
-       */
+	  break;
+	}
 
-      if ((ie->len == 0) || (ie->name == NULL))
+      for (p = inotify_buf; p < inotify_buf + len; p += sizeof(struct inotify_event) + ie->len)
 	{
-	  logdebug("inotify event with no name\n");
+	  ie = (struct inotify_event *)p;
 
-	  continue;
-	}
+	  if (ie->mask & IN_Q_OVERFLOW)
+	    {
+	      logmsg(LOG_WARNING, "inotify queue overflow, hotplug events lost");
 
-      logdebug("Found new event device %s/%s\n", EVDEV_DIR, ie->name);
+	      continue;
+	    }
 
-      if (strncmp("event", ie->name, 5))
-	{
-	  logdebug("Discarding %s/%s\n", EVDEV_DIR, ie->name);
+	  if ((ie->len == 0) || (strncmp("event", ie->name, 5) != 0))
+	    continue;
 
-	  continue;
-	}
+	  num = atoi(ie->name + 5);
+	  if ((num < 0) || (num >= EVDEV_HOTPLUG_MAX))
+	    {
+	      logdebug("Discarding %s/%s\n", EVDEV_DIR, ie->name);
 
-      ret = snprintf(evdev, sizeof(evdev), "%s/%s", EVDEV_DIR, ie->name);
+	      continue;
+	    }
 
-      if ((ret <= 0) || (ret >= sizeof(evdev)))
-	continue;
+	  if (ie->mask & IN_DELETE)
+	    {
+	      /* Gone before we got to it */
+	      hotplug_pending[LONG(num)] &= ~BIT(num);
 
-      efd = open(evdev, O_RDWR);
-      if (efd < 0)
-	{
-	  if (errno != ENOENT)
-	    logmsg(LOG_WARNING, "Could not open %s: %s", evdev, strerror(errno));
+	      continue;
+	    }
 
-	  continue;
+	  /*
+	   * IN_ATTRIB: udev fixed up the permissions after creation;
+	   * already attached devices are skipped when the timer fires
+	   */
+	  if (ie->mask & (IN_CREATE | IN_ATTRIB))
+	    evdev_hotplug_schedule(num);
 	}
-
-      evdev_try_add(efd);
     }
-
-  free(all_ie);
 }
 
 
-#ifdef __powerpc__
-/* PowerBook G4 Titanium */
-static int
-evdev_is_adb(unsigned short *id)
+/* phys NULL drops the candidate */
+static void
+evdev_uevent_candidate_set(int input, const char *phys)
 {
-  unsigned short product = id[ID_PRODUCT];
+  int i;
+  int slot;
 
-  if (id[ID_BUS] != BUS_ADB)
-    return 0;
+  slot = -1;
+  for (i = 0; i < EVDEV_UEVENT_CANDIDATES; i++)
+    {
+      if (uevent_candidates[i].input == input)
+	{
+	  slot = i;
+	  break;
+	}
 
-  if (id[ID_VENDOR] != 0x0001)
-    return 0;
+      if ((slot < 0) && (uevent_candidates[i].input < 0))
+	slot = i;
+    }
 
-  if ((product == ADB_PRODUCT_ID_KEYBOARD_ANSI)
-      || (product == ADB_PRODUCT_ID_KEYBOARD_ISO)
-      || (product == ADB_PRODUCT_ID_KEYBOARD_JIS))
+  if (phys == NULL)
     {
-      logdebug(" -> ADB keyboard\n");
+      if ((slot >= 0) && (uevent_candidates[slot].input == input))
+	uevent_candidates[slot].input = -1;
 
-      return 1;
+      return;
     }
 
-  if (product == ADB_PRODUCT_ID_PBBUTTONS)
+  if (slot < 0)
     {
-      logdebug(" -> ADB PowerBook buttons\n");
+      logmsg(LOG_WARNING, "Too many pending input devices, ignoring input%d", input);
 
-      return 1;
+      return;
     }
 
-  return 0;
+  uevent_candidates[slot].input = input;
+  strncpy(uevent_candidates[slot].phys, phys, EVDEV_PHYS_LEN - 1);
+  uevent_candidates[slot].phys[EVDEV_PHYS_LEN - 1] = '\0';
 }
 
-/* PowerBook G4 */
-static int
-evdev_is_fountain(unsigned short *id)
+/* Returns the physical path of a candidate, NULL if not a candidate */
+static const char *
+evdev_uevent_candidate(int input)
 {
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
-
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  int i;
 
-  if ((product == USB_PRODUCT_ID_FOUNTAIN_ANSI)
-      || (product == USB_PRODUCT_ID_FOUNTAIN_ISO)
-      || (product == USB_PRODUCT_ID_FOUNTAIN_JIS))
+  for (i = 0; i < EVDEV_UEVENT_CANDIDATES; i++)
     {
-      logdebug(" -> Fountain USB assembly\n");
-
-      return 1;
+      if (uevent_candidates[i].input == input)
+	return uevent_candidates[i].phys;
     }
 
-  return 0;
+  return NULL;
 }
 
+/* Parse the inputN number out of the last path component */
 static int
-evdev_is_geyser(unsigned short *id)
+evdev_uevent_input_num(const char *name, size_t len)
 {
-  unsigned short product = id[ID_PRODUCT];
+  if ((len <= 5) || (strncmp(name, "input", 5) != 0))
+    return -1;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  return atoi(name + 5);
+}
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+static void
+evdev_uevent_handle(char *action, char *devpath, char *product, char *phys, char *devname)
+{
+  const char *cphys;
+  char *base;
+  char *parent;
+  char evdev[32];
+  unsigned int pid[4];
+  unsigned short id[4];
+  int input;
+  int ret;
 
-  if ((product == USB_PRODUCT_ID_GEYSER_ANSI)
-      || (product == USB_PRODUCT_ID_GEYSER_ISO)
-      || (product == USB_PRODUCT_ID_GEYSER_JIS))
-    {
-      logdebug(" -> Geyser USB assembly\n");
+  base = strrchr(devpath, '/');
+  if (base == NULL)
+    return;
+  base++;
 
-      kbd_set_fnmode();
+  /* Parent input device: carries the IDs */
+  input = evdev_uevent_input_num(base, strlen(base));
+  if (input >= 0)
+    {
+      if (strcmp(action, "add") != 0)
+	{
+	  evdev_uevent_candidate_set(input, NULL);
 
-      return 1;
-    }
+	  return;
+	}
 
-  return 0;
-}
+      if (product == NULL)
+	return;
 
-/* Any internal keyboard */
-static int
-evdev_is_internal(unsigned short *id)
-{
-  return (evdev_is_adb(id)
-	  || evdev_is_fountain(id)
-	  || evdev_is_geyser(id));
-}
+      ret = sscanf(product, "%x/%x/%x/%x", &pid[ID_BUS], &pid[ID_VENDOR], &pid[ID_PRODUCT], &pid[ID_VERSION]);
+      if (ret != 4)
+	return;
 
+      id[ID_BUS] = pid[ID_BUS];
+      id[ID_VENDOR] = pid[ID_VENDOR];
+      id[ID_PRODUCT] = pid[ID_PRODUCT];
+      id[ID_VERSION] = pid[ID_VERSION];
 
-/* PMU Lid switch */
-static int
-evdev_is_lidswitch(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
+      logdebug("\nuevent: input%d: bus 0x%04x, vid 0x%04x, pid 0x%04x\n", input, id[ID_BUS], id[ID_VENDOR], id[ID_PRODUCT]);
 
-  if (id[ID_BUS] != BUS_HOST)
-    return 0;
+      if (!evdev_match_id(id))
+	{
+	  evdev_uevent_candidate_set(input, NULL);
 
-  if (id[ID_VENDOR] != 0x0001)
-    return 0;
+	  return;
+	}
 
-  if (id[ID_VERSION] != 0x0100)
-    return 0;
+      /* PHYS="usb-0000:00:1d.0-1/input0", maybe missing */
+      if (phys == NULL)
+	phys = "";
+      else if (phys[0] == '"')
+	{
+	  phys++;
+	  if ((strlen(phys) > 0) && (phys[strlen(phys) - 1] == '"'))
+	    phys[strlen(phys) - 1] = '\0';
+	}
 
-  if (product == 0x0001)
-    {
-      logdebug(" -> PMU LID switch\n");
+      evdev_uevent_candidate_set(input, phys);
 
-      return 1;
+      return;
     }
 
-  return 0;
-}
-
-#else
+  /* Event device node, only opened if its parent matched */
+  if ((strncmp(base, "event", 5) != 0) || (strcmp(action, "add") != 0))
+    return;
 
-/* Core Duo MacBook & MacBook Pro */
-static int
-evdev_is_geyser3(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
+  parent = base - 1;
+  while ((parent > devpath) && (*(parent - 1) != '/'))
+    parent--;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  input = evdev_uevent_input_num(parent, base - 1 - parent);
+  cphys = (input >= 0) ? evdev_uevent_candidate(input) : NULL;
+  if (cphys == NULL)
+    {
+      logdebug("uevent: skipping %s\n", base);
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      return;
+    }
 
-  if ((product == USB_PRODUCT_ID_GEYSER3_ANSI)
-      || (product == USB_PRODUCT_ID_GEYSER3_ISO)
-      || (product == USB_PRODUCT_ID_GEYSER3_JIS))
-    {
-      logdebug(" -> Geyser III USB assembly\n");
+  if (devname != NULL)
+    ret = snprintf(evdev, sizeof(evdev), "/dev/%s", devname);
+  else
+    ret = snprintf(evdev, sizeof(evdev), "%s/%s", EVDEV_DIR, base);
 
-      kbd_set_fnmode();
+  if ((ret <= 0) || (ret >= sizeof(evdev)))
+    return;
 
-      return 1;
-    }
+  logdebug("Found new event device %s\n", evdev);
 
-  return 0;
+  evdev_open_add(evdev, atoi(base + 5), cphys);
 }
 
-/* Core2 Duo MacBook & MacBook Pro */
-static int
-evdev_is_geyser4(unsigned short *id)
+static void
+evdev_uevent_process(int fd, uint32_t events)
 {
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
-
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  char buf[EVDEV_UEVENT_BUFSIZE];
+  struct sockaddr_nl sa;
+  socklen_t salen;
+
+  char *p;
+  char *end;
+  char *action;
+  char *devpath;
+  char *subsystem;
+  char *product;
+  char *phys;
+  char *devname;
+  ssize_t len;
+  int ret;
 
-  if ((product == USB_PRODUCT_ID_GEYSER4_ANSI)
-      || (product == USB_PRODUCT_ID_GEYSER4_ISO)
-      || (product == USB_PRODUCT_ID_GEYSER4_JIS))
+  if (events & (EPOLLERR | EPOLLHUP))
     {
-      logdebug(" -> Geyser IV USB assembly\n");
+      logmsg(LOG_WARNING, "uevent socket lost; this should not happen");
 
-      kbd_set_fnmode();
+      ret = evloop_remove(fd);
+      if (ret < 0)
+	logmsg(LOG_ERR, "Could not remove uevent socket from event loop");
 
-      return 1;
-    }
+      close(fd);
 
-  return 0;
-}
-
-/* Core2 Duo Santa Rosa MacBook (MacBook3,1)
-   Core2 Duo MacBook (MacBook4,1, February 2008) */
-static int
-evdev_is_geyser4hf(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
-
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      return;
+    }
 
-  if ((product == USB_PRODUCT_ID_GEYSER4HF_ANSI)
-      || (product == USB_PRODUCT_ID_GEYSER4HF_ISO)
-      || (product == USB_PRODUCT_ID_GEYSER4HF_JIS))
+  for (;;)
     {
-      logdebug(" -> Geyser IV-HF USB assembly\n");
+      salen = sizeof(sa);
+      len = recvfrom(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT, (struct sockaddr *)&sa, &salen);
+      if (len < 0)
+	{
+	  if ((errno != EAGAIN) && (errno != EINTR))
+	    logmsg(LOG_WARNING, "uevent read failed: %s", strerror(errno));
 
-      kbd_set_fnmode();
+	  /* ENOBUFS: events were lost, nothing we can do about it */
+	  if (errno == EINTR)
+	    continue;
 
-      return 1;
-    }
+	  break;
+	}
 
-  return 0;
-}
+      /* Only trust the kernel */
+      if (sa.nl_pid != 0)
+	continue;
 
-/* MacBook Air (MacBookAir1,1, January 2008) */
-static int
-evdev_is_wellspring(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
+      buf[len] = '\0';
+      end = buf + len;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+      action = NULL;
+      devpath = NULL;
+      subsystem = NULL;
+      product = NULL;
+      phys = NULL;
+      devname = NULL;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      /* Header (action@devpath), then NUL-separated KEY=value pairs */
+      for (p = buf + strlen(buf) + 1; p < end; p += strlen(p) + 1)
+	{
+	  if (strncmp(p, "ACTION=", 7) == 0)
+	    action = p + 7;
+	  else if (strncmp(p, "DEVPATH=", 8) == 0)
+	    devpath = p + 8;
+	  else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+	    subsystem = p + 10;
+	  else if (strncmp(p, "PRODUCT=", 8) == 0)
+	    product = p + 8;
+	  else if (strncmp(p, "PHYS=", 5) == 0)
+	    phys = p + 5;
+	  else if (strncmp(p, "DEVNAME=", 8) == 0)
+	    devname = p + 8;
+	}
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING_ANSI)
-      || (product == USB_PRODUCT_ID_WELLSPRING_ISO)
-      || (product == USB_PRODUCT_ID_WELLSPRING_JIS))
-    {
-      logdebug(" -> WellSpring USB assembly\n");
+      if ((action == NULL) || (devpath == NULL) || (subsystem == NULL))
+	continue;
 
-      kbd_set_fnmode();
+      if (strcmp(subsystem, "input") != 0)
+	continue;
 
-      return 1;
+      evdev_uevent_handle(action, devpath, product, phys, devname);
     }
-
-  return 0;
 }
 
-/* Core2 Duo MacBook Pro (MacBookPro4,1, February 2008) */
-static int
-evdev_is_wellspring2(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+/*
+ * Known devices, generated from evdev.h by evdev_ids.awk and sorted
+ * by bus, vendor and product
+ */
+static const struct evdev_known_id evdev_known_ids[] =
+  {
+#include "evdev_ids.h"
+  };
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING2_ANSI)
-      || (product == USB_PRODUCT_ID_WELLSPRING2_ISO)
-      || (product == USB_PRODUCT_ID_WELLSPRING2_JIS))
-    {
-      logdebug(" -> WellSpring II USB assembly\n");
+#ifdef __powerpc__
+# define EVDEV_CLASS_OTHER_ARCH  EVDEV_CLASS_X86
+#else
+# define EVDEV_CLASS_OTHER_ARCH  EVDEV_CLASS_PPC
+#endif
 
-      kbd_set_fnmode();
+/* An unknown Apple device needs one of these to be taken as a keyboard */
+static const int evdev_probe_keys[] =
+  {
+    KEY_BRIGHTNESSDOWN,
+    KEY_BRIGHTNESSUP,
+    KEY_MUTE,
+    KEY_VOLUMEDOWN,
+    KEY_VOLUMEUP,
+    KEY_KBDILLUMTOGGLE,
+    KEY_KBDILLUMDOWN,
+    KEY_KBDILLUMUP,
+    KEY_EJECTCD
+  };
 
-      return 1;
-    }
 
-  return 0;
-}
-
-/* Core2 Duo MacBook Pro (MacBookPro5,1, October 2008)
- * Core2 Duo MacBook (MacBook5,1, October 2008)
- * MacBook Air (MacBookAir2,1, October 2008) */
 static int
-evdev_is_wellspring3(unsigned short *id)
+evdev_known_id_cmp(const void *key, const void *elem)
 {
-  unsigned short product = id[ID_PRODUCT];
+  const unsigned short *id = key;
+  const struct evdev_known_id *known = elem;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  if (id[ID_BUS] != known->bus)
+    return id[ID_BUS] - known->bus;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  if (id[ID_VENDOR] != known->vendor)
+    return id[ID_VENDOR] - known->vendor;
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING3_ANSI)
-      || (product == USB_PRODUCT_ID_WELLSPRING3_ISO)
-      || (product == USB_PRODUCT_ID_WELLSPRING3_JIS))
-    {
-      logdebug(" -> WellSpring III USB assembly\n");
-
-      kbd_set_fnmode();
-
-      return 1;
-    }
-
-  return 0;
+  return id[ID_PRODUCT] - known->product;
 }
 
-/* MacBookAir3,2 (October 2010) */
-static int
-evdev_is_wellspring4(unsigned short *id)
+static const struct evdev_known_id *
+evdev_lookup_id(unsigned short *id)
 {
-  unsigned short product = id[ID_PRODUCT];
+  const struct evdev_known_id *known;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  known = bsearch(id, evdev_known_ids,
+		  sizeof(evdev_known_ids) / sizeof(*evdev_known_ids),
+		  sizeof(*evdev_known_ids), evdev_known_id_cmp);
+  if (known == NULL)
+    return NULL;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  if ((known->version != 0) && (known->version != id[ID_VERSION]))
+    return NULL;
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING4_ANSI)
-      || (product == USB_PRODUCT_ID_WELLSPRING4_ISO)
-      || (product == USB_PRODUCT_ID_WELLSPRING4_JIS))
-    {
-      logdebug(" -> WellSpring IV USB assembly\n");
+  if (known->class & EVDEV_CLASS_OTHER_ARCH)
+    return NULL;
 
-      kbd_set_fnmode();
-
-      return 1;
-    }
-
-  return 0;
+  return known;
 }
 
-/* MacBookAir3,1 (October 2010) */
+/*
+ * Any device we want to listen to; the checks only use the IDs.
+ * Returns EVDEV_CLASS_* flags, 0 if we're not interested.
+ */
 static int
-evdev_is_wellspring4a(unsigned short *id)
+evdev_match_id(unsigned short *id)
 {
-  unsigned short product = id[ID_PRODUCT];
+  const struct evdev_known_id *known;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  known = evdev_lookup_id(id);
+  if (known == NULL)
+    {
+      /* Unknown Apple keyboard? evdev_probe() will check its keys */
+      if ((id[ID_VENDOR] == USB_VENDOR_ID_APPLE)
+	  && ((id[ID_BUS] == BUS_USB) || (id[ID_BUS] == BUS_BLUETOOTH)))
+	return EVDEV_CLASS_PROBE;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      return 0;
+    }
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING4A_ANSI)
-      || (product == USB_PRODUCT_ID_WELLSPRING4A_ISO)
-      || (product == USB_PRODUCT_ID_WELLSPRING4A_JIS))
-    {
-      logdebug(" -> WellSpring IVa USB assembly\n");
+#ifndef __powerpc__
+  if ((known->class & EVDEV_CLASS_APPLEIR) && !appleir_cfg.enabled)
+    return 0;
+#endif
 
-      kbd_set_fnmode();
+  /* Lid switch: keyboard backlight and hooks */
+  if ((known->class & EVDEV_CLASS_LID) && !has_kbd_backlight()
+      && (hooks_cfg.lid_closed[0] == '\0') && (hooks_cfg.lid_opened[0] == '\0'))
+    return 0;
 
-      return 1;
-    }
+  logdebug(" -> %s\n", known->name);
 
-  return 0;
+  return known->class;
 }
 
-/* MacBookAir4,2 (Mid 2011)
- * MacBookAir4,1 (Mid 2011)
- */
+/* Does the device have any of the hotkeys we handle? */
 static int
-evdev_is_2011mba(unsigned short *id)
+evdev_has_hotkeys(int fd)
 {
-  unsigned short product = id[ID_PRODUCT];
+  unsigned long keys[NBITS(KEY_MAX)];
+  int i;
+  int ret;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  memset(keys, 0, sizeof(keys));
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
+  ret = ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys);
+  if (ret < 0)
     return 0;
 
-  if ((product == USB_PRODUCT_ID_2011MBA_ANSI)
-      || (product == USB_PRODUCT_ID_2011MBA_ISO)
-      || (product == USB_PRODUCT_ID_2011MBA_JIS)
-      || (product == USB_PRODUCT_ID_2011MBA_EUR))
+  for (i = 0; i < sizeof(evdev_probe_keys) / sizeof(*evdev_probe_keys); i++)
     {
-      logdebug(" -> 2011MBA USB assembly\n");
-
-      kbd_set_fnmode();
-
-      return 1;
+      if (test_bit(evdev_probe_keys[i], keys))
+	return 1;
     }
 
   return 0;
 }
 
-/* MacBookAir5,2 (June 2012)
- * MacBookAir5,1 (June 2012)
+
+/*
+ * Identity cache: devices come and go across suspend/resume, remember
+ * how we classified them so they can be re-attached without a full probe
  */
-static int
-evdev_is_2012mba(unsigned short *id)
+static void
+evdev_ident_get_phys(int fd, char *phys)
 {
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
-
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
-
-  if ((product == USB_PRODUCT_ID_2012MBA_ANSI)
-      || (product == USB_PRODUCT_ID_2012MBA_ISO)
-      || (product == USB_PRODUCT_ID_2012MBA_JIS)
-      || (product == USB_PRODUCT_ID_2012MBA_EUR))
-    {
-      logdebug(" -> 2012MBA USB assembly\n");
-
-      kbd_set_fnmode();
+  int ret;
 
-      return 1;
-    }
+  memset(phys, 0, EVDEV_PHYS_LEN);
 
-  return 0;
+  ret = ioctl(fd, EVIOCGPHYS(EVDEV_PHYS_LEN - 1), phys);
+  if (ret < 0)
+    phys[0] = '\0';
 }
 
 /*
- * MacBookAir6,2 (Mid 2014)
- * MacBookAir6,1 (Mid 2014)
+ * Returns 1 and the cached flags on a hit. The physical path is part of
+ * the key: the interfaces of the internal USB assembly share the same
+ * IDs but are classified differently
  */
 static int
-evdev_is_2014mba(unsigned short *id)
+evdev_ident_lookup(unsigned short *id, const char *phys, int *flags)
 {
-  unsigned short product = id[ID_PRODUCT];
+  int found;
+  int i;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  found = 0;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  pthread_mutex_lock(&ident_mutex);
 
-  if ((product == USB_PRODUCT_ID_2014MBA_ANSI)
-      || (product == USB_PRODUCT_ID_2014MBA_ISO)
-      || (product == USB_PRODUCT_ID_2014MBA_JIS)
-      || (product == USB_PRODUCT_ID_2014MBA_EUR))
+  for (i = 0; i < ident_count; i++)
     {
-      logdebug(" -> 2014MBA USB assembly\n");
-
-      kbd_set_fnmode();
+      if ((ident_cache[i].id[ID_BUS] == id[ID_BUS])
+	  && (ident_cache[i].id[ID_VENDOR] == id[ID_VENDOR])
+	  && (ident_cache[i].id[ID_PRODUCT] == id[ID_PRODUCT])
+	  && (strcmp(ident_cache[i].phys, phys) == 0))
+	{
+	  *flags = ident_cache[i].flags;
+	  found = 1;
 
-      return 1;
+	  break;
+	}
     }
 
-  return 0;
+  pthread_mutex_unlock(&ident_mutex);
+
+  return found;
 }
 
-/* 
- * MacBookAir7,2 (Early 2015) 
- * MacBookAir7,1 (Early 2015) 
- */ 
-static int 
-evdev_is_2015mba(unsigned short *id) 
-{ 
-  unsigned short product = id[ID_PRODUCT]; 
- 
-  if (id[ID_BUS] != BUS_USB) 
-    return 0; 
- 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE) 
-    return 0; 
- 
-  if ((product == USB_PRODUCT_ID_2015MBA_ANSI) 
-      || (product == USB_PRODUCT_ID_2015MBA_ISO) 
-      || (product == USB_PRODUCT_ID_2015MBA_JIS) 
-      || (product == USB_PRODUCT_ID_2015MBA_EUR)) 
-    { 
-      logdebug(" -> 2015MBA USB assembly\n"); 
- 
-      kbd_set_fnmode(); 
- 
-      return 1; 
-    } 
- 
-  return 0; 
-} 
-
-/* MacBookPro8,1 (13" Early 2011)
- * MacBookPro8,2 (15" Early 2011)
- * MacBookPro8,3 (17" Early 2011)
+/*
+ * When full, rejected devices (mice & co.) are evicted first, and never
+ * push out an accepted one: the keyboards are what resume must not probe
  */
-static int
-evdev_is_wellspring5(unsigned short *id)
+static void
+evdev_ident_store(unsigned short *id, const char *phys, int flags)
 {
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  static int next;
+  struct evdev_ident *ident;
+  int slot;
+  int i;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  pthread_mutex_lock(&ident_mutex);
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING5_ANSI)
-      || (product == USB_PRODUCT_ID_WELLSPRING5_ISO)
-      || (product == USB_PRODUCT_ID_WELLSPRING5_JIS))
+  if (ident_count < EVDEV_IDENT_CACHE)
+    ident = &ident_cache[ident_count++];
+  else
     {
-      logdebug(" -> WellSpring V USB assembly\n");
+      ident = NULL;
+      for (i = 0; i < EVDEV_IDENT_CACHE; i++)
+	{
+	  slot = (next + i) % EVDEV_IDENT_CACHE;
 
-      kbd_set_fnmode();
+	  if (!(ident_cache[slot].flags & EVDEV_IDENT_ACCEPT))
+	    {
+	      ident = &ident_cache[slot];
+	      next = (slot + 1) % EVDEV_IDENT_CACHE;
 
-      return 1;
+	      break;
+	    }
+	}
+
+      if (ident == NULL)
+	{
+	  /* Only accepted devices in there */
+	  if (!(flags & EVDEV_IDENT_ACCEPT))
+	    {
+	      pthread_mutex_unlock(&ident_mutex);
+
+	      return;
+	    }
+
+	  /* Recycle the oldest entries */
+	  ident = &ident_cache[next];
+	  next = (next + 1) % EVDEV_IDENT_CACHE;
+	}
     }
 
-  return 0;
+  memcpy(ident->id, id, sizeof(ident->id));
+  strncpy(ident->phys, phys, EVDEV_PHYS_LEN - 1);
+  ident->phys[EVDEV_PHYS_LEN - 1] = '\0';
+  ident->flags = flags;
+
+  pthread_mutex_unlock(&ident_mutex);
 }
 
-/* MacBookPro10,1 (15" 2012)
- * MacBookPro9,2  (13" 2012)
- */
-static int
-evdev_is_apple_internal_keyboard(unsigned short *id)
+/* Seed the identity cache from the probe cache, before the scan */
+static void
+evdev_ident_load(void)
 {
-  unsigned short product = id[ID_PRODUCT];
+  char key[PROBECACHE_KEY_LEN];
+  char phys[EVDEV_PHYS_LEN];
+  const char *val;
+  unsigned short id[4];
+  int flags;
+  int ret;
+  int i;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  for (i = 0; i < EVDEV_IDENT_CACHE; i++)
+    {
+      snprintf(key, sizeof(key), "evdev.%d", i);
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      val = probecache_get(key);
+      if (val == NULL)
+	break;
 
-  if ((product == USB_PRODUCT_ID_APPLE_INTERNAL_KEYBOARD_ANSI) ||
-      (product == USB_PRODUCT_ID_APPLE_INTERNAL_KEYBOARD_ISO))
-    {
-      logdebug(" -> Apple Internal Keyboard USB assembly\n");
+      memset(id, 0, sizeof(id));
+      phys[0] = '\0';
 
-      kbd_set_fnmode();
+      /* phys is EVDEV_PHYS_LEN - 1 long at most */
+      ret = sscanf(val, "%hx %hx %hx %x %63s", &id[ID_BUS], &id[ID_VENDOR], &id[ID_PRODUCT], &flags, phys);
+      if (ret < 4)
+	continue;
 
-      return 1;
+      evdev_ident_store(id, phys, flags);
     }
 
-  return 0;
+  logdebug("Identity cache: %d entries from the probe cache\n", ident_count);
 }
 
-/* MacBookPro10,2 (13" 2012)
- */
-static int
-evdev_is_wellspring6(unsigned short *id)
+/* Persist the identity cache, minus the devices the configuration decides on */
+static void
+evdev_ident_save(void)
 {
-  unsigned short product = id[ID_PRODUCT];
+  const struct evdev_known_id *known;
+  struct evdev_ident *ident;
+  char key[PROBECACHE_KEY_LEN];
+  char val[PROBECACHE_VALUE_LEN];
+  int n;
+  int i;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  n = 0;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  pthread_mutex_lock(&ident_mutex);
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING6_ANSI))
+  for (i = 0; i < ident_count; i++)
     {
-      logdebug(" -> WellSpring VI USB assembly\n");
+      ident = &ident_cache[i];
+
+      known = evdev_lookup_id(ident->id);
+      if ((known != NULL) && (known->class & (EVDEV_CLASS_APPLEIR | EVDEV_CLASS_LID)))
+	continue;
 
-      kbd_set_fnmode();
+      snprintf(key, sizeof(key), "evdev.%d", n++);
+      snprintf(val, sizeof(val), "%04x %04x %04x %x %s",
+	       ident->id[ID_BUS], ident->id[ID_VENDOR], ident->id[ID_PRODUCT],
+	       ident->flags, ident->phys);
 
-      return 1;
+      probecache_set(key, val);
     }
 
-  return 0;
+  pthread_mutex_unlock(&ident_mutex);
+
+  /* Drop the leftovers of a previous, longer list */
+  for (; n < EVDEV_IDENT_CACHE; n++)
+    {
+      snprintf(key, sizeof(key), "evdev.%d", n);
+      probecache_del(key);
+    }
 }
 
-/* MacBookPro12,1 (13" Early 2015)
- */
+
+/* Full classification, returns EVDEV_IDENT_* flags */
 static int
-evdev_is_wellspring9(unsigned short *id)
+evdev_probe(int fd, unsigned short *id)
 {
-  unsigned short product = id[ID_PRODUCT];
+  unsigned long bit[EV_MAX][NBITS(KEY_MAX)];
+  char devname[256];
+  int class;
+  int flags;
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  devname[0] = '\0';
+  ioctl(fd, EVIOCGNAME(sizeof(devname)), devname);
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  logdebug("\nInvestigating evdev [%s]\n", devname);
 
-  if ((product == USB_PRODUCT_ID_WELLSPRING9_ANSI)
-      || (product == USB_PRODUCT_ID_WELLSPRING9_ISO)
-      || (product == USB_PRODUCT_ID_WELLSPRING9_JIS))
+  class = evdev_match_id(id);
+  if (class == 0)
     {
-      logdebug(" -> WellSpring IX USB assembly\n");
-
-      kbd_set_fnmode();
+      logdebug("Discarding evdev: bus 0x%04x, vid 0x%04x, pid 0x%04x\n", id[ID_BUS], id[ID_VENDOR], id[ID_PRODUCT]);
 
-      return 1;
+      return 0;
     }
 
-  return 0;
-}
+  memset(bit, 0, sizeof(bit));
 
-/* Any internal keyboard */
-static int
-evdev_is_internal(unsigned short *id)
-{
-  return (evdev_is_geyser3(id)
-	  || evdev_is_geyser4(id)
-	  || evdev_is_geyser4hf(id)
-	  || evdev_is_wellspring(id)
-	  || evdev_is_wellspring2(id)
-	  || evdev_is_wellspring3(id)
-	  || evdev_is_wellspring4(id)
-	  || evdev_is_wellspring4a(id)
-	  || evdev_is_wellspring5(id)
-	  || evdev_is_apple_internal_keyboard(id)
-	  || evdev_is_wellspring6(id)
-	  || evdev_is_wellspring9(id)
-	  || evdev_is_2011mba(id)
-	  || evdev_is_2012mba(id)
-	  || evdev_is_2014mba(id)
-	  );
-}
+  ioctl(fd, EVIOCGBIT(0, EV_MAX), bit[0]);
 
+  if (class & EVDEV_CLASS_PROBE)
+    {
+      if (!test_bit(EV_KEY, bit[0]) || !evdev_has_hotkeys(fd))
+	{
+	  logdebug("Discarding evdev: unknown Apple device without hotkeys\n");
 
-/* Apple Remote IR Receiver */
-static int
-evdev_is_appleir(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
+	  return 0;
+	}
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+      logdebug(" -> Apple keyboard (unknown model)\n");
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      class = EVDEV_CLASS_EXTKBD | EVDEV_CLASS_FNMODE;
+    }
 
-  if ((product == USB_PRODUCT_ID_APPLEIR)
-      || (product == USB_PRODUCT_ID_APPLEIR_2))
+  if (!test_bit(EV_KEY, bit[0]))
     {
-      logdebug(" -> Apple IR receiver\n");
+      logdebug("evdev: no EV_KEY event type (not a keyboard)\n");
 
-      return 1;
-    }
+      if (!test_bit(EV_SW, bit[0]))
+	{
+	  logdebug("Discarding evdev: no EV_SW event type (not a switch)\n");
 
-  return 0;
-}
+	  return 0;
+	}
+    }
+  /* Wireless keyboards advertise EV_ABS events, single them out */
+  else if (test_bit(EV_ABS, bit[0]) && !(class & EVDEV_CLASS_WIRELESS))
+    {
+      logdebug("Discarding evdev with EV_ABS event type (mouse/trackpad)\n");
 
-/* ACPI Lid switch */
-static int
-evdev_is_lidswitch(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
+      return 0;
+    }
 
-  if (id[ID_BUS] != BUS_HOST)
-    return 0;
+  if (class & EVDEV_CLASS_FNMODE)
+    kbd_set_fnmode();
 
-  if (id[ID_VENDOR] != 0)
-    return 0;
+  /* There are 2 keyboards, but one of them only has the eject key;
+     the real keyboard has all the keys and the LEDs. Checking for
+     the LEDs is a quick way of identifying the keyboard we want.
+  */
+  flags = EVDEV_IDENT_ACCEPT;
+  if (class & EVDEV_CLASS_FNMODE)
+    flags |= EVDEV_IDENT_FNMODE;
 
-  if (product == 0x0005)
+  if (test_bit(EV_LED, bit[0]) && (class & EVDEV_CLASS_INTERNAL))
     {
-      logdebug(" -> ACPI LID switch\n");
+      logdebug(" -> Internal keyboard\n");
 
-      return 1;
+      flags |= EVDEV_IDENT_INTERNAL_KBD;
     }
 
-  return 0;
+  return flags;
 }
-#endif /* !__powerpc__ */
 
-/* Apple external USB keyboard, white */
+/*
+ * Classification, safe to run on the scan threads.
+ * phys comes with the uevent if we got one, saves an ioctl.
+ * Returns EVDEV_IDENT_* flags, or -1 if the device was rejected and closed.
+ */
 static int
-evdev_is_extkbd_white(unsigned short *id)
+evdev_classify(int fd, int num, const char *phys)
 {
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
-
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  char devphys[EVDEV_PHYS_LEN];
+  unsigned short id[4];
+  int flags;
+  int ret;
 
-  if (product == USB_PRODUCT_ID_APPLE_EXTKBD_WHITE)
+  ret = ioctl(fd, EVIOCGID, id);
+  if (ret < 0)
     {
-      logdebug(" -> External Apple USB keyboard (white)\n");
+      logdebug("EVIOCGID failed on event%d: %s\n", num, strerror(errno));
 
-      kbd_set_fnmode();
+      close(fd);
 
-      return 1;
+      return -1;
     }
 
-  return 0;
-}
+  if (phys == NULL)
+    {
+      evdev_ident_get_phys(fd, devphys);
+      phys = devphys;
+    }
 
-/* Apple external USB mini keyboard, aluminium */
-static int
-evdev_is_extkbd_mini_alu(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
+  if (evdev_ident_lookup(id, phys, &flags))
+    {
+      logdebug("\nevent%d: known evdev [%s]: bus 0x%04x, vid 0x%04x, pid 0x%04x\n", num, phys, id[ID_BUS], id[ID_VENDOR], id[ID_PRODUCT]);
 
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+      /* Set on the first probe, but the cache may come from an earlier run */
+      if (flags & EVDEV_IDENT_FNMODE)
+	kbd_set_fnmode();
+    }
+  else
+    {
+      flags = evdev_probe(fd, id);
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      evdev_ident_store(id, phys, flags);
+    }
 
-  if ((product == USB_PRODUCT_ID_APPLE_EXTKBD_MINI_ALU_ANSI)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_MINI_ALU_ISO)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_MINI_ALU_JIS))
+  if (!(flags & EVDEV_IDENT_ACCEPT))
     {
-      logdebug(" -> External Apple USB mini keyboard (aluminium)\n");
-
-      kbd_set_fnmode();
+      close(fd);
 
-      return 1;
+      return -1;
     }
 
-  return 0;
+  return flags;
 }
 
-/* Apple external USB keyboard, aluminium */
+/* Start listening to a classified device; main thread only */
 static int
-evdev_is_extkbd_alu(unsigned short *id)
+evdev_register(int fd, int num, int flags)
 {
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  int ret;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  if (flags & EVDEV_IDENT_INTERNAL_KBD)
+    internal_kbd_fd = fd;
 
-  if ((product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_ANSI)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_ISO)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_JIS))
+  ret = evdev_attach(fd, num);
+  if (ret < 0)
     {
-      logdebug(" -> External Apple USB keyboard (aluminium)\n");
+      if (fd == internal_kbd_fd)
+	internal_kbd_fd = -1;
 
-      kbd_set_fnmode();
+      close(fd);
 
-      return 1;
+      return -1;
     }
 
-  return 0;
-}
-
-/* Apple external USB keyboard, aluminium */
-static int
-evdev_is_extkbd_alu_rev_b(unsigned short *id)
-{
-  unsigned short product = id[ID_PRODUCT];
-
-  if (id[ID_BUS] != BUS_USB)
-    return 0;
+  ret = evloop_add(fd, EPOLLIN, EVLOOP_PRIO_INPUT, evdev_process_events);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not add device to event loop");
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      if (fd == internal_kbd_fd)
+	internal_kbd_fd = -1;
 
-  if ((product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_REV_B_ANSI)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_REV_B_ISO)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_REV_B_JIS))
-    {
-      logdebug(" -> External Apple USB keyboard (aluminium, revision B)\n");
+      evdev_detach(fd);
 
-      kbd_set_fnmode();
+      close(fd);
 
-      return 1;
+      return -1;
     }
 
   return 0;
 }
 
-/* Apple external wireless keyboard, aluminium */
 static int
-evdev_is_extkbd_alu_wl(unsigned short *id)
+evdev_try_add(int fd, int num, const char *phys)
 {
-  unsigned short product = id[ID_PRODUCT];
+  int flags;
 
-  if (id[ID_BUS] != BUS_BLUETOOTH)
-    return 0;
+  flags = evdev_classify(fd, num, phys);
+  if (flags < 0)
+    return -1;
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+  return evdev_register(fd, num, flags);
+}
+
+
+/*
+ * Startup scan: the opens and ioctls can stall on some USB and Bluetooth
+ * devices, so the nodes found in EVDEV_DIR are classified by a few threads
+ * and registered by the main thread as they complete.
+ */
+static void *
+evdev_scan_thread(void *arg)
+{
+  struct evdev_scan *scan = arg;
+  char evdev[32];
+  int fd;
+  int i;
+  int ret;
 
-  if ((product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_ANSI)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_ISO)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_JIS))
+  for (;;)
     {
-      logdebug(" -> External Apple wireless keyboard (aluminium)\n");
+      pthread_mutex_lock(&scan->mutex);
+      i = scan->next++;
+      pthread_mutex_unlock(&scan->mutex);
+
+      if (i >= scan->count)
+	break;
 
-      kbd_set_fnmode();
+      fd = -1;
 
-      return 1;
+      ret = snprintf(evdev, sizeof(evdev), "%s%d", EVDEV_BASE, scan->devs[i].num);
+      if ((ret > 0) && (ret < sizeof(evdev)))
+	{
+	  fd = open(evdev, O_RDWR);
+	  if (fd < 0)
+	    {
+	      if (errno != ENOENT)
+		logmsg(LOG_WARNING, "Could not open %s: %s", evdev, strerror(errno));
+	    }
+	  else
+	    {
+	      scan->devs[i].flags = evdev_classify(fd, scan->devs[i].num, NULL);
+	      if (scan->devs[i].flags < 0)
+		fd = -1;
+	    }
+	}
+
+      pthread_mutex_lock(&scan->mutex);
+      scan->devs[i].fd = fd;
+      scan->done[scan->ndone++] = i;
+      pthread_cond_signal(&scan->cond);
+      pthread_mutex_unlock(&scan->mutex);
     }
 
-  return 0;
+  return NULL;
 }
 
-/* Apple external wireless keyboard, aluminium, newer model */
 static int
-evdev_is_extkbd_alu_wl_2(unsigned short *id)
+evdev_scan_list(struct evdev_scan *scan)
 {
-  unsigned short product = id[ID_PRODUCT];
+  DIR *dir;
+  struct dirent *de;
+  char *end;
+  long num;
 
-  if (id[ID_BUS] != BUS_BLUETOOTH)
-    return 0;
+  dir = opendir(EVDEV_DIR);
+  if (dir == NULL)
+    {
+      logmsg(LOG_ERR, "Could not open %s: %s", EVDEV_DIR, strerror(errno));
 
-  if (id[ID_VENDOR] != USB_VENDOR_ID_APPLE)
-    return 0;
+      return -1;
+    }
 
-  if ((product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_2_ANSI)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_2_ISO)
-      || (product == USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_2_JIS))
+  scan->count = 0;
+  while ((de = readdir(dir)) != NULL)
     {
-      logdebug(" -> External Apple wireless keyboard 2 (aluminium)\n");
+      if (strncmp(de->d_name, "event", 5) != 0)
+	continue;
+
+      num = strtol(de->d_name + 5, &end, 10);
+      if ((end == de->d_name + 5) || (*end != '\0'))
+	continue;
+
+      if ((num < 0) || (num >= EVDEV_HOTPLUG_MAX))
+	{
+	  logdebug("Ignoring %s, out of range\n", de->d_name);
+
+	  continue;
+	}
 
-      kbd_set_fnmode();
+      scan->devs[scan->count].num = num;
+      scan->devs[scan->count].fd = -1;
+      scan->count++;
 
-      return 1;
+      if (scan->count == EVDEV_HOTPLUG_MAX)
+	break;
     }
 
-  return 0;
-}
+  closedir(dir);
 
-/* Any external Apple USB keyboard */
-static int
-evdev_is_extkbd(unsigned short *id)
-{
-  return (evdev_is_extkbd_white(id)
-	  || evdev_is_extkbd_mini_alu(id)
-	  || evdev_is_extkbd_alu(id)
-	  || evdev_is_extkbd_alu_rev_b(id)
-	  || evdev_is_extkbd_alu_wl(id)
-	  || evdev_is_extkbd_alu_wl_2(id));
+  return scan->count;
 }
 
-/* Mouseemu virtual keyboard */
-static int
-evdev_is_mouseemu(unsigned short *id)
+/* Started by evdev_scan_start(), finished by evdev_init() */
+static struct evdev_scan scan;
+static pthread_t scan_threads[EVDEV_SCAN_THREADS];
+static int scan_nthreads = -1;
+
+/*
+ * Start classifying the event devices in the background, so the main
+ * thread can probe the rest of the hardware meanwhile; the devices are
+ * registered by evdev_init()
+ */
+void
+evdev_scan_start(void)
 {
-  unsigned short product = id[ID_PRODUCT];
+  int ret;
 
-  if (id[ID_BUS] != BUS_VIRTUAL)
-    return 0;
+  if (scan_nthreads >= 0)
+    return;
 
-  if (id[ID_VENDOR] != 0x001f)
-    return 0;
+  evdev_ident_load();
+
+  scan.count = 0;
+  scan.next = 0;
+  scan.ndone = 0;
+  pthread_mutex_init(&scan.mutex, NULL);
+  pthread_cond_init(&scan.cond, NULL);
+
+  scan_nthreads = 0;
 
-  if (product == 0x001f)
+  ret = evdev_scan_list(&scan);
+  if (ret <= 0)
+    return;
+
+  for (scan_nthreads = 0; (scan_nthreads < EVDEV_SCAN_THREADS) && (scan_nthreads < scan.count); scan_nthreads++)
     {
-      logdebug(" -> Mouseemu virtual keyboard\n");
+      ret = pthread_create(&scan_threads[scan_nthreads], NULL, evdev_scan_thread, &scan);
+      if (ret != 0)
+	{
+	  logmsg(LOG_WARNING, "Could not create scan thread: %s", strerror(ret));
 
-      return 1;
+	  break;
+	}
     }
-
-  return 0;
 }
 
-
 static int
-evdev_try_add(int fd)
+evdev_scan_finish(void)
 {
-  unsigned short id[4];
-  unsigned long bit[EV_MAX][NBITS(KEY_MAX)];
-  char devname[256];
-
+  int ndevs;
+  int i;
   int ret;
 
-  devname[0] = '\0';
-  ioctl(fd, EVIOCGNAME(sizeof(devname)), devname);
-
-  logdebug("\nInvestigating evdev [%s]\n", devname);
+  /* No threads, do it ourselves */
+  if ((scan_nthreads == 0) && (scan.count > 0))
+    evdev_scan_thread(&scan);
 
-  ioctl(fd, EVIOCGID, id);
-
-  if ((!evdev_is_internal(id))
-#ifndef __powerpc__
-      && !(appleir_cfg.enabled && evdev_is_appleir(id))
-#endif
-      && !(has_kbd_backlight() && evdev_is_lidswitch(id))
-      && !(evdev_is_mouseemu(id))
-      && !(evdev_is_extkbd(id)))
+  ndevs = 0;
+  for (i = 0; i < scan.count; i++)
     {
-      logdebug("Discarding evdev: bus 0x%04x, vid 0x%04x, pid 0x%04x\n", id[ID_BUS], id[ID_VENDOR], id[ID_PRODUCT]);
+      pthread_mutex_lock(&scan.mutex);
+      while (scan.ndone == i)
+	pthread_cond_wait(&scan.cond, &scan.mutex);
+      ret = scan.done[i];
+      pthread_mutex_unlock(&scan.mutex);
 
-      close(fd);
+      if (scan.devs[ret].fd < 0)
+	continue;
 
-      return -1;
+      if (evdev_register(scan.devs[ret].fd, scan.devs[ret].num, scan.devs[ret].flags) == 0)
+	ndevs++;
     }
 
-  memset(bit, 0, sizeof(bit));
+  /* The threads must be gone before daemon() forks */
+  for (i = 0; i < scan_nthreads; i++)
+    pthread_join(scan_threads[i], NULL);
 
-  ioctl(fd, EVIOCGBIT(0, EV_MAX), bit[0]);
+  pthread_cond_destroy(&scan.cond);
+  pthread_mutex_destroy(&scan.mutex);
 
-  if (!test_bit(EV_KEY, bit[0]))
-    {
-      logdebug("evdev: no EV_KEY event type (not a keyboard)\n");
+  scan_nthreads = -1;
 
-      if (!test_bit(EV_SW, bit[0]))
-	{
-	  logdebug("Discarding evdev: no EV_SW event type (not a switch)\n");
+  return ndevs;
+}
+
+static int
+evdev_inotify_init(void)
+{
+  int ret;
+  int fd;
 
-	  close(fd);
+  memset(hotplug_pending, 0, sizeof(hotplug_pending));
 
-	  return -1;
-	}
+  hotplug_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (hotplug_timer_fd < 0)
+    {
+      logmsg(LOG_ERR, "Failed to create hotplug timer: %s", strerror(errno));
+
+      return -1;
     }
-  /* Wireless keyboards advertise EV_ABS events, single them out */
-  else if (test_bit(EV_ABS, bit[0]) && !(evdev_is_extkbd_alu_wl(id)))
+
+  ret = evloop_add(hotplug_timer_fd, EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, evdev_hotplug_timer);
+  if (ret < 0)
     {
-      logdebug("Discarding evdev with EV_ABS event type (mouse/trackpad)\n");
+      logmsg(LOG_ERR, "Failed to add hotplug timer to event loop");
 
-      close(fd);
+      close(hotplug_timer_fd);
+      hotplug_timer_fd = -1;
 
       return -1;
     }
 
-  /* There are 2 keyboards, but one of them only has the eject key;
-     the real keyboard has all the keys and the LEDs. Checking for
-     the LEDs is a quick way of identifying the keyboard we want.
-  */
-  if (test_bit(EV_LED, bit[0]) && evdev_is_internal(id))
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
     {
-      logdebug(" -> Internal keyboard\n");
+      logmsg(LOG_ERR, "Failed to initialize inotify: %s", strerror(errno));
 
-      internal_kbd_fd = fd;
+      goto out_timer;
     }
 
-  ret = evloop_add(fd, EPOLLIN, evdev_process_events);
+  ret = inotify_add_watch(fd, EVDEV_DIR, IN_CREATE | IN_ATTRIB | IN_DELETE | IN_ONLYDIR);
   if (ret < 0)
     {
-      logmsg(LOG_ERR, "Could not add device to event loop");
+      logmsg(LOG_ERR, "Failed to add inotify watch for %s: %s", EVDEV_DIR, strerror(errno));
 
-      if (fd == internal_kbd_fd)
-	internal_kbd_fd = -1;
+      goto out_inotify;
+    }
 
-      close(fd);
+  ret = evloop_add(fd, EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, evdev_inotify_process);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Failed to add inotify fd to event loop");
 
-      return -1;
+      goto out_inotify;
     }
 
   return 0;
+
+ out_inotify:
+  close(fd);
+
+ out_timer:
+  /* Nothing will ever schedule it */
+  evloop_remove(hotplug_timer_fd);
+  close(hotplug_timer_fd);
+  hotplug_timer_fd = -1;
+
+  return -1;
 }
 
 
+/*
+ * Kernel uevents tell us the IDs of new input devices before their
+ * event nodes show up, so we only open the devices we want
+ */
 static int
-evdev_inotify_init(void)
+evdev_uevent_init(void)
 {
+  struct sockaddr_nl sa;
   int ret;
   int fd;
+  int i;
 
-  fd = inotify_init();
+  for (i = 0; i < EVDEV_UEVENT_CANDIDATES; i++)
+    uevent_candidates[i].input = -1;
+
+  fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
   if (fd < 0)
     {
-      logmsg(LOG_ERR, "Failed to initialize inotify: %s", strerror(errno));
+      logdebug("Failed to open uevent socket: %s\n", strerror(errno));
 
       return -1;
     }
 
-  ret = inotify_add_watch(fd, EVDEV_DIR, IN_CREATE | IN_ONLYDIR);
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  sa.nl_groups = 1; /* kernel events */
+
+  ret = bind(fd, (struct sockaddr *)&sa, sizeof(sa));
   if (ret < 0)
     {
-      logmsg(LOG_ERR, "Failed to add inotify watch for %s: %s", EVDEV_DIR, strerror(errno));
+      logdebug("Failed to bind uevent socket: %s\n", strerror(errno));
 
       close(fd);
-      fd = -1;
 
       return -1;
     }
 
-  ret = evloop_add(fd, EPOLLIN, evdev_inotify_process);
+  ret = evloop_add(fd, EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, evdev_uevent_process);
   if (ret < 0)
     {
-      logmsg(LOG_ERR, "Failed to add inotify fd to event loop");
+      logmsg(LOG_ERR, "Failed to add uevent socket to event loop");
 
       close(fd);
 
@@ -1272,40 +1472,105 @@ evdev_init(void)
   int ret;
   int i;
 
-  char evdev[32];
-
   int ndevs;
-  int fd;
 
   internal_kbd_fd = -1;
 
-  ndevs = 0;
-  for (i = 0; i < EVDEV_MAX; i++)
+  for (i = 0; i < EVDEV_MAX_DEVS; i++)
+    {
+      evdevs[i].fd = -1;
+      evdevs[i].num = -1;
+    }
+
+  /* Normally started earlier on, see main() */
+  evdev_scan_start();
+
+  ndevs = evdev_scan_finish();
+
+  logdebug("\nFound %d devices\n", ndevs);
+
+  evdev_ident_save();
+
+  /* Hotplug: uevents, or inotify if they're not available */
+  ret = evdev_uevent_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_INFO, "uevents not available, falling back to inotify for hotplug");
+
+      evdev_inotify_init();
+    }
+
+  return ndevs;
+}
+
+/*
+ * The configuration changed which devices we listen to (AppleIR, lid
+ * switch): forget how they were classified, let go of the ones we no
+ * longer want and pick up the new ones. Main thread only.
+ */
+void
+evdev_reconfigure(void)
+{
+  const struct evdev_known_id *known;
+  unsigned short id[4];
+  char evdev[32];
+  int ret;
+  int fd;
+  int n;
+  int i;
+
+  pthread_mutex_lock(&ident_mutex);
+
+  for (i = 0, n = 0; i < ident_count; i++)
     {
-      ret = snprintf(evdev, 32, "%s%d", EVDEV_BASE, i);
+      known = evdev_lookup_id(ident_cache[i].id);
+      if ((known != NULL) && (known->class & (EVDEV_CLASS_APPLEIR | EVDEV_CLASS_LID)))
+	continue;
+
+      ident_cache[n++] = ident_cache[i];
+    }
 
-      if ((ret <= 0) || (ret > 31))
-	return -1;
+  ident_count = n;
 
-      fd = open(evdev, O_RDWR);
+  pthread_mutex_unlock(&ident_mutex);
+
+  for (i = 0; i < EVDEV_MAX_DEVS; i++)
+    {
+      fd = evdevs[i].fd;
       if (fd < 0)
-	{
-	  if (errno != ENOENT)
-	    logmsg(LOG_WARNING, "Could not open %s: %s", evdev, strerror(errno));
+	continue;
 
-	  continue;
-	}
+      ret = ioctl(fd, EVIOCGID, id);
+      if (ret < 0)
+	continue;
 
-      if (evdev_try_add(fd) == 0)
-	ndevs++;
+      known = evdev_lookup_id(id);
+      if ((known == NULL) || !(known->class & (EVDEV_CLASS_APPLEIR | EVDEV_CLASS_LID)))
+	continue;
+
+      if (evdev_match_id(id) != 0)
+	continue;
+
+      logdebug("Releasing event%d\n", evdevs[i].num);
+
+      evloop_remove(fd);
+      evdev_detach(fd);
+
+      close(fd);
     }
 
-  logdebug("\nFound %d devices\n", ndevs);
+  /* The devices we rejected before hit the cache */
+  for (i = 0; i < EVDEV_HOTPLUG_MAX; i++)
+    {
+      if (evdev_attached(i))
+	continue;
 
-  /* Initialize inotify */
-  evdev_inotify_init();
+      ret = snprintf(evdev, sizeof(evdev), "%s%d", EVDEV_BASE, i);
+      if ((ret <= 0) || (ret >= sizeof(evdev)))
+	continue;
 
-  return ndevs;
+      evdev_open_add(evdev, i, NULL);
+    }
 }
 
 void
@@ -8,6 +8,9 @@
 
 /****** ADB Devices ******/
 
+#define ADB_VENDOR_ID                 0x0001
+
+/* ADB keyboard */
 #define ADB_PRODUCT_ID_KEYBOARD_ANSI  0x22c3
 #define ADB_PRODUCT_ID_KEYBOARD_ISO   0x22c4
 #define ADB_PRODUCT_ID_KEYBOARD_JIS   0x22c5
@@ -147,14 +150,79 @@
 #define USB_PRODUCT_ID_APPLEIR_2      0x8242
 
 
+/****** Switches ******/
+
+#define HOST_VENDOR_ID_ACPI           0x0000
+#define HOST_VENDOR_ID_PMU            0x0001
+
+/* ACPI lid switch */
+#define HOST_PRODUCT_ID_ACPI_LID      0x0005
+
+/* PMU lid switch */
+#define HOST_VERSION_PMU_LID          0x0100
+#define HOST_PRODUCT_ID_PMU_LID       0x0001
+
+
+/****** Virtual devices ******/
+
+#define VIRTUAL_VENDOR_ID_MOUSEEMU    0x001f
+
+/* Mouseemu virtual keyboard */
+#define VIRTUAL_PRODUCT_ID_MOUSEEMU   0x001f
+
+
+/*
+ * Device classes; the table of known devices is generated from the
+ * IDs above by evdev_ids.awk
+ */
+#define EVDEV_CLASS_INTERNAL    (1 << 0)  /* laptop keyboard */
+#define EVDEV_CLASS_EXTKBD      (1 << 1)  /* external Apple keyboard */
+#define EVDEV_CLASS_APPLEIR     (1 << 2)
+#define EVDEV_CLASS_LID         (1 << 3)
+#define EVDEV_CLASS_MOUSEEMU    (1 << 4)
+#define EVDEV_CLASS_FNMODE      (1 << 5)  /* handled by hid-apple */
+#define EVDEV_CLASS_WIRELESS    (1 << 6)  /* advertises EV_ABS */
+#define EVDEV_CLASS_PPC         (1 << 7)  /* PowerPC only */
+#define EVDEV_CLASS_X86         (1 << 8)  /* x86 only */
+#define EVDEV_CLASS_PROBE       (1 << 9)  /* unknown Apple device, check its keys */
+
+
 #define EVDEV_DIR               "/dev/input"
 #define EVDEV_BASE              "/dev/input/event"
-#define EVDEV_MAX               32
 
+/* Threads classifying the devices found at startup */
+#define EVDEV_SCAN_THREADS      4
+
+/* Event devices we can listen to at once */
+#define EVDEV_MAX_DEVS          32
+
+/* Identity cache */
+#define EVDEV_IDENT_CACHE       32
+#define EVDEV_PHYS_LEN          64
+
+#define EVDEV_IDENT_ACCEPT        (1 << 0)
+#define EVDEV_IDENT_INTERNAL_KBD  (1 << 1)
+#define EVDEV_IDENT_FNMODE        (1 << 2)
+
+/* inotify hotplug */
+#define EVDEV_INOTIFY_BUFSIZE   4096
+#define EVDEV_HOTPLUG_MAX       256 /* highest eventN + 1 */
+#define EVDEV_HOTPLUG_DEBOUNCE  100 /* milliseconds */
+
+/* uevent hotplug */
+#define EVDEV_UEVENT_BUFSIZE    4096
+#define EVDEV_UEVENT_CANDIDATES 16
+
+
+void
+evdev_scan_start(void);
 
 int
 evdev_init(void);
 
+void
+evdev_reconfigure(void);
+
 void
 evdev_cleanup(void);
 
@@ -0,0 +1,116 @@
+#
+# pommed - evdev_ids.awk
+#
+# Generates the table of known input devices from the IDs in evdev.h,
+# one initializer per line:
+#   { bus, vendor, product, version, class, "name" },
+#
+# The output is piped through sort -u, see the Makefile; every numeric
+# field is printed as 4 hex digits so the lexical order of the lines is
+# the numeric order of (bus, vendor, product) the lookup relies on.
+#
+# Product IDs are classified by the prefix of their name; anything new
+# under USB_PRODUCT_ID_ is taken as an internal keyboard.
+#
+
+function hex4(s)
+{
+  s = tolower(s)
+  sub(/^0x/, "", s)
+  while (length(s) < 4)
+    s = "0" s
+
+  return "0x" s
+}
+
+function entry(bus, vendor, product, version, class)
+{
+  printf("  { %s, %s, %s, %s, %s, \"%s\" },\n", bus, vendor, hex4(product), version, class, name)
+}
+
+BEGIN {
+  # linux/input.h
+  BUS_USB = "0x0003"
+  BUS_BLUETOOTH = "0x0005"
+  BUS_VIRTUAL = "0x0006"
+  BUS_ADB = "0x0017"
+  BUS_HOST = "0x0019"
+
+  ANY = "0x0000"
+}
+
+# Last comment before a define names the device
+/^\/\* .* \*\/$/ {
+  name = $0
+  sub(/^\/\* */, "", name)
+  sub(/ *\*\/$/, "", name)
+  gsub(/["\\]/, "", name)
+  next
+}
+
+$1 != "#define" {
+  next
+}
+
+$2 == "ADB_VENDOR_ID" { adb = hex4($3); next }
+$2 == "USB_VENDOR_ID_APPLE" { apple = hex4($3); next }
+$2 == "HOST_VENDOR_ID_ACPI" { acpi = hex4($3); next }
+$2 == "HOST_VENDOR_ID_PMU" { pmu = hex4($3); next }
+$2 == "HOST_VERSION_PMU_LID" { pmu_lid = hex4($3); next }
+$2 == "VIRTUAL_VENDOR_ID_MOUSEEMU" { mouseemu = hex4($3); next }
+
+$2 ~ /^ADB_PRODUCT_ID_/ {
+  entry(BUS_ADB, adb, $3, ANY, "EVDEV_CLASS_INTERNAL | EVDEV_CLASS_PPC")
+  next
+}
+
+$2 ~ /^USB_PRODUCT_ID_FOUNTAIN_/ {
+  entry(BUS_USB, apple, $3, ANY, "EVDEV_CLASS_INTERNAL | EVDEV_CLASS_PPC")
+  next
+}
+
+$2 ~ /^USB_PRODUCT_ID_GEYSER_/ {
+  entry(BUS_USB, apple, $3, ANY, "EVDEV_CLASS_INTERNAL | EVDEV_CLASS_FNMODE | EVDEV_CLASS_PPC")
+  next
+}
+
+# Only the first aluminium wireless models are known to send EV_ABS
+$2 ~ /^USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_(ANSI|ISO|JIS)$/ {
+  entry(BUS_BLUETOOTH, apple, $3, ANY, "EVDEV_CLASS_EXTKBD | EVDEV_CLASS_FNMODE | EVDEV_CLASS_WIRELESS")
+  next
+}
+
+$2 ~ /^USB_PRODUCT_ID_APPLE_EXTKBD_ALU_WL_/ {
+  entry(BUS_BLUETOOTH, apple, $3, ANY, "EVDEV_CLASS_EXTKBD | EVDEV_CLASS_FNMODE")
+  next
+}
+
+$2 ~ /^USB_PRODUCT_ID_APPLE_EXTKBD_/ {
+  entry(BUS_USB, apple, $3, ANY, "EVDEV_CLASS_EXTKBD | EVDEV_CLASS_FNMODE")
+  next
+}
+
+$2 ~ /^USB_PRODUCT_ID_APPLEIR/ {
+  entry(BUS_USB, apple, $3, ANY, "EVDEV_CLASS_APPLEIR | EVDEV_CLASS_X86")
+  next
+}
+
+$2 ~ /^USB_PRODUCT_ID_/ {
+  entry(BUS_USB, apple, $3, ANY, "EVDEV_CLASS_INTERNAL | EVDEV_CLASS_FNMODE | EVDEV_CLASS_X86")
+  next
+}
+
+$2 == "HOST_PRODUCT_ID_ACPI_LID" {
+  entry(BUS_HOST, acpi, $3, ANY, "EVDEV_CLASS_LID | EVDEV_CLASS_X86")
+  next
+}
+
+$2 == "HOST_PRODUCT_ID_PMU_LID" {
+  entry(BUS_HOST, pmu, $3, pmu_lid, "EVDEV_CLASS_LID | EVDEV_CLASS_PPC")
+  next
+}
+
+$2 == "VIRTUAL_PRODUCT_ID_MOUSEEMU" {
+  entry(BUS_VIRTUAL, mouseemu, $3, ANY, "EVDEV_CLASS_MOUSEEMU")
+  next
+}
@@ -30,6 +30,10 @@
 #include <errno.h>
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include <pthread.h>
 
 #ifndef NO_SYS_TIMERFD_H
 # include <sys/timerfd.h>
@@ -41,126 +45,286 @@
 #include "evloop.h"
 
 
+/* I/O backend, epoll unless io_uring was requested */
+static struct evloop_backend *backend;
+
 /* epoll fd */
 static int epfd;
 
-/* event sources registered on the main loop */
-static struct pommed_event *sources;
+/*
+ * Event sources live in a slab; epoll carries (generation, slot) handles
+ * so events for a source removed earlier in the same batch are dropped.
+ *
+ * All the pools are allocated once by evloop_init(), so adding and
+ * removing sources and timers never touches the heap.
+ */
+static struct pommed_event *src_slab;
+static int src_free;
+static int nsources;
+
+/* fd -> source slot */
+static int *fd_map;
+static int fd_map_size;
+
+/* epoll_wait() results, one per source */
+static struct epoll_event *epoll_evs;
+
+/*
+ * Ready sources of the current batch, copied before any callback runs;
+ * a callback may remove any source, the slab is only read again to check
+ * the source is still there
+ */
+struct evloop_ready
+{
+  uint64_t handle;
+  uint32_t events;
+  int prio;
+  int fd;
+  pommed_event_cb cb;
+};
+
+static struct evloop_ready ready_evs[EVLOOP_MAX_SOURCES];
 
-/* timers */
+/* active timers, free timers, and their jobs in a slab */
 static struct pommed_timer *timers;
-static int timer_job_id;
+static struct pommed_timer *timer_pool;
+static struct pommed_timer *timer_free;
+static struct pommed_timer_job *job_slab;
+static int job_free;
+
+/*
+ * Work queued by callbacks (or other threads) to run once all ready I/O
+ * has been dispatched; idle work only runs when nothing else is pending.
+ */
+struct work_queue
+{
+  struct pommed_work work[EVLOOP_WORK_QUEUE];
+  unsigned int head;
+  unsigned int count;
+};
+
+static struct work_queue defer_q;
+static struct work_queue idle_q;
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* eventfd keeping epoll_wait() from sleeping while work is pending */
+static int workfd;
 
 static int running;
 
 
-int
-evloop_add(int fd, uint32_t events, pommed_event_cb cb)
+/* epoll backend */
+static int
+evloop_epoll_init(void)
 {
-  int ret;
+  epfd = epoll_create(EVLOOP_MAX_SOURCES);
+  if (epfd < 0)
+    {
+      logmsg(LOG_ERR, "Could not create epoll fd: %s", strerror(errno));
+
+      return -1;
+    }
 
+  return 0;
+}
+
+static int
+evloop_epoll_add(int fd, uint32_t events, uint64_t handle)
+{
   struct epoll_event epoll_ev;
+
+  epoll_ev.events = events;
+  epoll_ev.data.u64 = handle;
+
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &epoll_ev);
+}
+
+static int
+evloop_epoll_remove(int fd, uint64_t handle)
+{
+  return epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int
+evloop_epoll_wait(struct epoll_event *evs, int maxevents)
+{
+  return epoll_wait(epfd, evs, maxevents, -1);
+}
+
+static void
+evloop_epoll_cleanup(void)
+{
+  close(epfd);
+}
+
+static struct evloop_backend evloop_epoll_backend =
+  {
+    .name = "epoll",
+    .init = evloop_epoll_init,
+    .add = evloop_epoll_add,
+    .remove = evloop_epoll_remove,
+    .wait = evloop_epoll_wait,
+    .rearm = NULL,
+    .cleanup = evloop_epoll_cleanup,
+  };
+
+
+#define evloop_handle(slot, gen)   (((uint64_t)(gen) << 32) | (uint32_t)(slot))
+#define evloop_handle_slot(h)      ((int)((h) & 0xffffffff))
+#define evloop_handle_gen(h)       ((uint32_t)((h) >> 32))
+
+/* Timer job ids must be > 0 and fit in an int */
+#define evloop_job_id(slot, gen)   ((int)((((gen) & 0x7fff) << 16) | ((slot) + 1)))
+#define evloop_job_id_slot(id)     (((id) & 0xffff) - 1)
+#define evloop_job_id_gen(id)      (((id) >> 16) & 0x7fff)
+
+
+static int
+evloop_add_source(int fd, uint32_t events, int prio, pommed_event_cb cb, void *data)
+{
+  int ret;
+  int slot;
+
   struct pommed_event *pommed_ev;
 
-  pommed_ev = (struct pommed_event *)malloc(sizeof(*pommed_ev));
+  if (fd < 0)
+    return -1;
 
-  if (pommed_ev == NULL)
+  if (fd >= fd_map_size)
     {
-      logmsg(LOG_ERR, "Could not allocate memory for new source");
+      logmsg(LOG_ERR, "Source fd %d out of range", fd);
 
       return -1;
     }
 
-  pommed_ev->fd = fd;
-  pommed_ev->cb = cb;
-  pommed_ev->next = sources;
+  if (fd_map[fd] >= 0)
+    {
+      logmsg(LOG_ERR, "Source fd %d already registered", fd);
 
-  epoll_ev.events = events;
-  epoll_ev.data.ptr = pommed_ev;
+      return -1;
+    }
 
-  ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &epoll_ev);
+  if (src_free < 0)
+    {
+      logmsg(LOG_ERR, "Too many event sources");
+
+      return -1;
+    }
+
+  slot = src_free;
+  pommed_ev = &src_slab[slot];
+
+  ret = backend->add(fd, events, evloop_handle(slot, pommed_ev->gen));
 
   if (ret < 0)
     {
-      logmsg(LOG_ERR, "Could not add source to epoll: %s", strerror(errno));
+      logmsg(LOG_ERR, "Could not add source to %s: %s", backend->name, strerror(errno));
 
-      free(pommed_ev);
       return -1;
     }
 
-  sources = pommed_ev;
+  src_free = pommed_ev->next_free;
+
+  pommed_ev->fd = fd;
+  pommed_ev->events = events;
+  pommed_ev->prio = prio;
+  pommed_ev->cb = cb;
+  pommed_ev->data = data;
+  pommed_ev->next_free = -1;
+
+  fd_map[fd] = slot;
+  nsources++;
 
   return 0;
 }
 
+int
+evloop_add(int fd, uint32_t events, int prio, pommed_event_cb cb)
+{
+  return evloop_add_source(fd, events, prio, cb, NULL);
+}
+
 int
 evloop_remove(int fd)
 {
   int ret;
+  int slot;
 
-  struct pommed_event *p;
-  struct pommed_event *e;
-
-  ret = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+  struct pommed_event *pommed_ev;
 
-  if (ret < 0)
+  if ((fd < 0) || (fd >= fd_map_size) || (fd_map[fd] < 0))
     {
-      logmsg(LOG_ERR, "Could not remove source from epoll: %s", strerror(errno));
+      logmsg(LOG_ERR, "Could not remove source: fd %d not registered", fd);
 
       return -1;
     }
 
-  for (p = NULL, e = sources; e != NULL; p = e, e = e->next)
-    {
-      if (e->fd != fd)
-	continue;
+  slot = fd_map[fd];
 
-      if (p != NULL)
-	p->next = e->next;
-      else
-	sources = e->next;
+  ret = backend->remove(fd, evloop_handle(slot, src_slab[slot].gen));
 
-      free(e);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not remove source from %s: %s", backend->name, strerror(errno));
 
-      break;
+      return -1;
     }
 
+  fd_map[fd] = -1;
+
+  /* Bumping the generation invalidates events still in flight */
+  pommed_ev = &src_slab[slot];
+  pommed_ev->gen++;
+  pommed_ev->fd = -1;
+  pommed_ev->cb = NULL;
+  pommed_ev->data = NULL;
+  pommed_ev->next_free = src_free;
+  src_free = slot;
+
+  nsources--;
+
   return 0;
 }
 
 
+static int
+evloop_job_valid(int slot, uint32_t gen)
+{
+  return ((slot >= 0) && (slot < EVLOOP_MAX_JOBS)
+	  && (job_slab[slot].cb != NULL)
+	  && (job_slab[slot].gen == gen));
+}
+
 static void
 evloop_timer_callback(int fd, uint32_t events)
 {
   uint64_t ticks;
+  int j;
+  int next;
+  uint32_t next_gen;
 
   struct pommed_timer *t;
-  struct pommed_timer_job *j;
 
   /* Acknowledge timer */
   read(fd, &ticks, sizeof(ticks));
 
-  j = NULL;
-  for (t = timers; t != NULL; t = t->next)
-    {
-      if (t->fd == fd)
-	{
-	  j = t->jobs;
-
-	  break;
-	}
-    }
+  t = src_slab[fd_map[fd]].data;
 
-  while (j != NULL)
+  /* Jobs may remove themselves, or each other, from their callback */
+  for (j = t->jobs; j >= 0; j = next)
     {
-      j->cb(j->id, ticks);
+      next = job_slab[j].next;
+      next_gen = (next >= 0) ? job_slab[next].gen : 0;
+
+      job_slab[j].cb(evloop_job_id(j, job_slab[j].gen), ticks);
 
-      j = j->next;
+      if ((next >= 0) && !evloop_job_valid(next, next_gen))
+	break;
     }
 }
 
 static int
-evloop_create_timer(int timeout)
+evloop_create_timer(int timeout, struct pommed_timer *t)
 {
   int fd;
   int ret;
@@ -204,7 +368,7 @@ evloop_create_timer(int timeout)
       return -1;
     }
 
-  ret = evloop_add(fd, EPOLLIN, evloop_timer_callback);
+  ret = evloop_add_source(fd, EPOLLIN, EVLOOP_PRIO_DEFAULT, evloop_timer_callback, t);
   if (ret < 0)
     {
       close(fd);
@@ -214,24 +378,38 @@ evloop_create_timer(int timeout)
   return fd;
 }
 
+static int
+evloop_destroy_timer(struct pommed_timer *t)
+{
+  int ret;
+
+  ret = evloop_remove(t->fd);
+  if (ret < 0)
+    return ret;
+
+  close(t->fd);
+
+  if (t->prev != NULL)
+    t->prev->next = t->next;
+  else
+    timers = t->next;
+
+  if (t->next != NULL)
+    t->next->prev = t->prev;
+
+  t->next = timer_free;
+  timer_free = t;
+
+  return 0;
+}
+
 int
 evloop_add_timer(int timeout, pommed_timer_cb cb)
 {
   int fd;
+  int j;
 
   struct pommed_timer *t;
-  struct pommed_timer_job *j;
-
-  j = (struct pommed_timer_job *)malloc(sizeof(struct pommed_timer_job));
-  if (j == NULL)
-    {
-      logmsg(LOG_ERR, "Could not allocate memory for timer job");
-      return -1;
-    }
-
-  j->cb = cb;
-  j->id = timer_job_id;
-  timer_job_id++;
 
   for (t = timers; t != NULL; t = t->next)
     {
@@ -241,88 +419,215 @@ evloop_add_timer(int timeout, pommed_timer_cb cb)
 
   if (t == NULL)
     {
-      t = (struct pommed_timer *)malloc(sizeof(struct pommed_timer));
-      if (t == NULL)
+      if ((timer_free == NULL) || (job_free < 0))
 	{
-	  logmsg(LOG_ERR, "Could not allocate memory for timer");
+	  logmsg(LOG_ERR, "Too many timers");
 	  return -1;
 	}
 
-      fd = evloop_create_timer(timeout);
+      t = timer_free;
+
+      fd = evloop_create_timer(timeout, t);
       if (fd < 0)
-	{
-	  free(t);
-	  return -1;
-	}
+	return -1;
+
+      timer_free = t->next;
 
       t->fd = fd;
       t->timeout = timeout;
-      t->jobs = NULL;
+      t->jobs = -1;
+      t->prev = NULL;
       t->next = timers;
+      if (timers != NULL)
+	timers->prev = t;
       timers = t;
     }
 
-  j->next = t->jobs;
+  if (job_free < 0)
+    {
+      logmsg(LOG_ERR, "Too many timer jobs");
+
+      return -1;
+    }
+
+  j = job_free;
+  job_free = job_slab[j].next;
+
+  job_slab[j].cb = cb;
+  job_slab[j].timer = t;
+  job_slab[j].prev = -1;
+  job_slab[j].next = t->jobs;
+  if (t->jobs >= 0)
+    job_slab[t->jobs].prev = j;
   t->jobs = j;
 
-  return 0;
+  return evloop_job_id(j, job_slab[j].gen);
 }
 
 int
 evloop_remove_timer(int id)
 {
-  int found;
-  int ret;
+  int j;
 
   struct pommed_timer *t;
-  struct pommed_timer *pt;
-  struct pommed_timer_job *j;
-  struct pommed_timer_job *pj;
+  struct pommed_timer_job *job;
+
+  j = evloop_job_id_slot(id);
+
+  if ((j < 0) || (j >= EVLOOP_MAX_JOBS) || (job_slab[j].cb == NULL)
+      || ((job_slab[j].gen & 0x7fff) != (uint32_t)evloop_job_id_gen(id)))
+    return 0;
+
+  job = &job_slab[j];
+  t = job->timer;
+
+  if (job->prev >= 0)
+    job_slab[job->prev].next = job->next;
+  else
+    t->jobs = job->next;
+
+  if (job->next >= 0)
+    job_slab[job->next].prev = job->prev;
+
+  job->gen++;
+  job->cb = NULL;
+  job->timer = NULL;
+  job->prev = -1;
+  job->next = job_free;
+  job_free = j;
 
-  found = 0;
-  for (pt = NULL, t = timers; t != NULL; pt = t, t = t->next)
+  if (t->jobs < 0)
+    return evloop_destroy_timer(t);
+
+  return 0;
+}
+
+
+static void
+evloop_work_wakeup(void)
+{
+  uint64_t one = 1;
+  int ret;
+
+  ret = write(workfd, &one, sizeof(one));
+  if ((ret < 0) && (errno != EAGAIN))
+    logmsg(LOG_ERR, "Could not signal pending work: %s", strerror(errno));
+}
+
+static int
+evloop_queue_work(struct work_queue *q, pommed_work_cb cb, void *data)
+{
+  unsigned int tail;
+  int wakeup;
+
+  pthread_mutex_lock(&work_mutex);
+
+  if (q->count == EVLOOP_WORK_QUEUE)
     {
-      for (pj = NULL, j = t->jobs; j != NULL; pj = j, j = j->next)
-	{
-	  if (j->id == id)
-	    {
-	      if (pj != NULL)
-		pj->next = j->next;
-	      else
-		t->jobs = j->next;
+      pthread_mutex_unlock(&work_mutex);
+
+      logmsg(LOG_ERR, "Work queue full, dropping work");
+
+      return -1;
+    }
 
-	      free(j);
+  tail = (q->head + q->count) % EVLOOP_WORK_QUEUE;
+  q->work[tail].cb = cb;
+  q->work[tail].data = data;
+  q->count++;
 
-	      found = 1;
+  /* Otherwise the loop already knows there is work pending */
+  wakeup = ((defer_q.count + idle_q.count) == 1);
 
-	      break;
-	    }
-	}
+  pthread_mutex_unlock(&work_mutex);
 
-      if (found)
-	break;
+  if (wakeup)
+    evloop_work_wakeup();
+
+  return 0;
+}
+
+static int
+evloop_dequeue_work(struct work_queue *q, struct pommed_work *w)
+{
+  pthread_mutex_lock(&work_mutex);
+
+  if (q->count == 0)
+    {
+      pthread_mutex_unlock(&work_mutex);
+
+      return 0;
     }
 
-  if (t == NULL)
-    return 0;
+  *w = q->work[q->head];
+  q->head = (q->head + 1) % EVLOOP_WORK_QUEUE;
+  q->count--;
+
+  pthread_mutex_unlock(&work_mutex);
+
+  return 1;
+}
 
-  if (t->jobs == NULL)
+/* Safe to call from any thread */
+int
+evloop_defer(pommed_work_cb cb, void *data)
+{
+  return evloop_queue_work(&defer_q, cb, data);
+}
+
+/* Safe to call from any thread */
+int
+evloop_idle(pommed_work_cb cb, void *data)
+{
+  return evloop_queue_work(&idle_q, cb, data);
+}
+
+static void
+evloop_work_callback(int fd, uint32_t events)
+{
+  uint64_t count;
+
+  /* Acknowledge; the work itself runs after I/O dispatch */
+  read(fd, &count, sizeof(count));
+}
+
+static void
+evloop_run_work(int busy)
+{
+  struct pommed_work w;
+  int budget;
+  int pending;
+
+  for (budget = EVLOOP_WORK_BUDGET; budget > 0; budget--)
     {
-      ret = evloop_remove(t->fd);
-      if (ret < 0)
-	return ret;
+      if (!evloop_dequeue_work(&defer_q, &w))
+	break;
 
-      close(t->fd);
+      w.cb(w.data);
+    }
 
-      if (pt != NULL)
-	pt->next = t->next;
-      else
-	timers = t->next;
+  /* Idle work waits until the loop is quiet */
+  if (!busy)
+    {
+      for (; budget > 0; budget--)
+	{
+	  if (defer_q.count > 0)
+	    break;
+
+	  if (!evloop_dequeue_work(&idle_q, &w))
+	    break;
 
-      free(t);
+	  w.cb(w.data);
+	}
     }
 
-  return 0;
+  pthread_mutex_lock(&work_mutex);
+  pending = defer_q.count + idle_q.count;
+  pthread_mutex_unlock(&work_mutex);
+
+  /* Come back for the rest after polling I/O again */
+  if (pending > 0)
+    evloop_work_wakeup();
 }
 
 
@@ -331,14 +636,17 @@ evloop_iteration(void)
 {
   int i;
   int nfds;
+  int prio;
+  int slot;
+  int ready[EVLOOP_PRIO_MAX];
 
-  struct epoll_event epoll_ev[MAX_EPOLL_EVENTS];
   struct pommed_event *pommed_ev;
+  struct evloop_ready *rev;
 
   if (!running)
     return -1;
 
-  nfds = epoll_wait(epfd, epoll_ev, MAX_EPOLL_EVENTS, -1);
+  nfds = backend->wait(epoll_evs, EVLOOP_MAX_SOURCES);
 
   if (nfds < 0)
     {
@@ -346,18 +654,64 @@ evloop_iteration(void)
 	return 0; /* pommed.c will continue */
       else
 	{
-	  logmsg(LOG_ERR, "epoll_wait() error: %s", strerror(errno));
+	  logmsg(LOG_ERR, "%s wait error: %s", backend->name, strerror(errno));
 
 	  return -1; /* pommed.c will exit */
 	}
     }
 
+  memset(ready, 0, sizeof(ready));
   for (i = 0; i < nfds; i++)
     {
-      pommed_ev = epoll_ev[i].data.ptr;
-      pommed_ev->cb(pommed_ev->fd, epoll_ev[i].events);
+      rev = &ready_evs[i];
+
+      rev->handle = epoll_evs[i].data.u64;
+      rev->events = epoll_evs[i].events;
+
+      pommed_ev = &src_slab[evloop_handle_slot(rev->handle)];
+
+      rev->prio = pommed_ev->prio;
+      rev->fd = pommed_ev->fd;
+      rev->cb = pommed_ev->cb;
+
+      ready[rev->prio]++;
     }
 
+  /*
+   * The kernel returns ready sources in no particular order;
+   * drain the input devices first, then everything else by priority
+   */
+  for (prio = EVLOOP_PRIO_INPUT; prio < EVLOOP_PRIO_MAX; prio++)
+    {
+      for (i = 0; (i < nfds) && (ready[prio] > 0); i++)
+	{
+	  rev = &ready_evs[i];
+
+	  if (rev->prio != prio)
+	    continue;
+
+	  ready[prio]--;
+
+	  slot = evloop_handle_slot(rev->handle);
+	  pommed_ev = &src_slab[slot];
+
+	  /* Removed (and maybe reused) by an earlier callback */
+	  if ((pommed_ev->cb == NULL) || (pommed_ev->gen != evloop_handle_gen(rev->handle)))
+	    continue;
+
+	  rev->cb(rev->fd, rev->events);
+
+	  /* Poll requests are one-shot with io_uring */
+	  if (backend->rearm == NULL)
+	    continue;
+
+	  if ((pommed_ev->cb != NULL) && (pommed_ev->gen == evloop_handle_gen(rev->handle)))
+	    backend->rearm(pommed_ev->fd, pommed_ev->events, rev->handle);
+	}
+    }
+
+  evloop_run_work(nfds == EVLOOP_MAX_SOURCES);
+
   return nfds;
 }
 
@@ -368,61 +722,164 @@ evloop_stop(void)
 }
 
 
-int
-evloop_init(void)
+static void
+evloop_free_pools(void)
 {
-  sources = NULL;
+  free(epoll_evs);
+  epoll_evs = NULL;
 
+  free(src_slab);
+  src_slab = NULL;
+  src_free = -1;
+  nsources = 0;
+
+  free(fd_map);
+  fd_map = NULL;
+  fd_map_size = 0;
+
+  free(timer_pool);
+  timer_pool = NULL;
+  timer_free = NULL;
   timers = NULL;
-  timer_job_id = 0;
 
-  running = 1;
+  free(job_slab);
+  job_slab = NULL;
+  job_free = -1;
+}
 
-  epfd = epoll_create(MAX_EPOLL_EVENTS);
-  if (epfd < 0)
+static int
+evloop_alloc_pools(void)
+{
+  struct rlimit rlim;
+  int i;
+  int ret;
+
+  /* No fd can be above the limit, so the map never needs to grow */
+  ret = getrlimit(RLIMIT_NOFILE, &rlim);
+  if ((ret < 0) || (rlim.rlim_cur == RLIM_INFINITY) || (rlim.rlim_cur > EVLOOP_MAX_FDS))
+    fd_map_size = EVLOOP_MAX_FDS;
+  else
+    fd_map_size = rlim.rlim_cur;
+
+  epoll_evs = (struct epoll_event *)calloc(EVLOOP_MAX_SOURCES, sizeof(*epoll_evs));
+  src_slab = (struct pommed_event *)calloc(EVLOOP_MAX_SOURCES, sizeof(*src_slab));
+  fd_map = (int *)malloc(fd_map_size * sizeof(*fd_map));
+  timer_pool = (struct pommed_timer *)calloc(EVLOOP_MAX_TIMERS, sizeof(*timer_pool));
+  job_slab = (struct pommed_timer_job *)calloc(EVLOOP_MAX_JOBS, sizeof(*job_slab));
+
+  if ((epoll_evs == NULL) || (src_slab == NULL) || (fd_map == NULL)
+      || (timer_pool == NULL) || (job_slab == NULL))
     {
-      logmsg(LOG_ERR, "Could not create epoll fd: %s", strerror(errno));
+      logmsg(LOG_ERR, "Could not allocate memory for the event loop");
+
+      evloop_free_pools();
 
       return -1;
     }
 
+  /* Chain the free slots */
+  src_free = -1;
+  for (i = EVLOOP_MAX_SOURCES - 1; i >= 0; i--)
+    {
+      src_slab[i].fd = -1;
+      src_slab[i].next_free = src_free;
+      src_free = i;
+    }
+  nsources = 0;
+
+  for (i = 0; i < fd_map_size; i++)
+    fd_map[i] = -1;
+
+  timers = NULL;
+  timer_free = NULL;
+  for (i = EVLOOP_MAX_TIMERS - 1; i >= 0; i--)
+    {
+      timer_pool[i].next = timer_free;
+      timer_free = &timer_pool[i];
+    }
+
+  job_free = -1;
+  for (i = EVLOOP_MAX_JOBS - 1; i >= 0; i--)
+    {
+      job_slab[i].next = job_free;
+      job_free = i;
+    }
+
   return 0;
 }
 
-void
-evloop_cleanup(void)
+
+int
+evloop_init(int use_uring)
 {
-  struct pommed_event *p;
-  struct pommed_timer *t;
-  struct pommed_timer_job *j;
-  struct pommed_timer_job *jobs;
+  int ret;
 
-  close(epfd);
+  memset(&defer_q, 0, sizeof(defer_q));
+  memset(&idle_q, 0, sizeof(idle_q));
+
+  ret = evloop_alloc_pools();
+  if (ret < 0)
+    return -1;
+
+  running = 1;
+
+  backend = &evloop_epoll_backend;
 
-  while (sources != NULL)
+  if (use_uring)
     {
-      p = sources;
-      sources = sources->next;
+      ret = evloop_uring_backend.init();
+      if (ret == 0)
+	backend = &evloop_uring_backend;
+      else
+	logmsg(LOG_WARNING, "io_uring not available, falling back to epoll");
+    }
+
+  if (backend == &evloop_epoll_backend)
+    {
+      ret = backend->init();
+      if (ret < 0)
+	{
+	  evloop_free_pools();
+	  return -1;
+	}
+    }
 
-      close(p->fd);
+  logdebug("Event loop using %s\n", backend->name);
 
-      free(p);
+  workfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (workfd < 0)
+    {
+      logmsg(LOG_ERR, "Could not create work eventfd: %s", strerror(errno));
+
+      backend->cleanup();
+      evloop_free_pools();
+      return -1;
     }
 
-  while (timers != NULL)
+  ret = evloop_add(workfd, EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, evloop_work_callback);
+  if (ret < 0)
     {
-      t = timers;
-      timers = timers->next;
+      close(workfd);
+      backend->cleanup();
+      evloop_free_pools();
+      return -1;
+    }
 
-      jobs = t->jobs;
-      while (jobs != NULL)
-	{
-	  j = jobs;
-	  jobs = jobs->next;
+  return 0;
+}
 
-	  free(j);
-	}
+void
+evloop_cleanup(void)
+{
+  int i;
+
+  backend->cleanup();
 
-      free(t);
+  for (i = 0; i < EVLOOP_MAX_SOURCES; i++)
+    {
+      if (src_slab[i].cb != NULL)
+	close(src_slab[i].fd);
     }
+
+  evloop_free_pools();
 }
@@ -6,39 +6,103 @@
 #define __EVLOOP_H__
 
 
-#define MAX_EPOLL_EVENTS        8
+/* Source priorities, ready sources are dispatched in this order */
+enum
+  {
+    EVLOOP_PRIO_INPUT = 0,     /* input devices */
+    EVLOOP_PRIO_DEFAULT,       /* timers, mixer, ... */
+    EVLOOP_PRIO_HOUSEKEEPING,  /* hotplug, internal */
+    EVLOOP_PRIO_MAX /* keep this one last */
+  };
+
+/*
+ * Capacity of the source, timer and timer job pools; they are allocated
+ * by evloop_init() and never grow
+ */
+#define EVLOOP_MAX_SOURCES      64  /* evdev, control clients, mixer, ... */
+#define EVLOOP_MAX_TIMERS       8   /* distinct timeouts */
+#define EVLOOP_MAX_JOBS         32
+
+/* Upper bound for the fd -> source map, sized to RLIMIT_NOFILE */
+#define EVLOOP_MAX_FDS          65536
+
+/* Deferred and idle work */
+#define EVLOOP_WORK_QUEUE       32
+#define EVLOOP_WORK_BUDGET      8
 
 typedef void(*pommed_event_cb)(int fd, uint32_t events);
 
+/* Source slab slot; free when cb is NULL */
 struct pommed_event
 {
   int fd;
+  uint32_t events;
+  int prio;
+  uint32_t gen;
   pommed_event_cb cb;
-  struct pommed_event *next;
+  void *data;
+
+  int next_free;
 };
 
 typedef void(*pommed_timer_cb)(int id, uint64_t ticks);
 
+/* Timer job slab slot; free when cb is NULL */
 struct pommed_timer_job
 {
-  int id;
+  uint32_t gen;
   pommed_timer_cb cb;
+  struct pommed_timer *timer;
+
+  /* slab indices, -1 terminated; next doubles as the free list link */
+  int prev;
+  int next;
+};
+
+typedef void(*pommed_work_cb)(void *data);
+
+struct pommed_work
+{
+  pommed_work_cb cb;
+  void *data;
+};
+
+/*
+ * I/O backends; ready sources are reported as epoll_event,
+ * data.u64 being the handle passed to add()
+ */
+struct epoll_event;
 
-  struct pommed_timer_job *next;
+struct evloop_backend
+{
+  const char *name;
+
+  int (*init)(void);
+  int (*add)(int fd, uint32_t events, uint64_t handle);
+  int (*remove)(int fd, uint64_t handle);
+  int (*wait)(struct epoll_event *evs, int maxevents);
+  /* called after dispatch if the backend needs it, may be NULL */
+  void (*rearm)(int fd, uint32_t events, uint64_t handle);
+  void (*cleanup)(void);
 };
 
+/* evloop_uring.c */
+extern struct evloop_backend evloop_uring_backend;
+
+
 struct pommed_timer
 {
   int fd;
   int timeout;
-  struct pommed_timer_job *jobs;
+  int jobs;  /* first job slot, -1 if none */
 
+  struct pommed_timer *prev;
   struct pommed_timer *next;
 };
 
 
 int
-evloop_add(int fd, uint32_t events, pommed_event_cb cb);
+evloop_add(int fd, uint32_t events, int prio, pommed_event_cb cb);
 
 int
 evloop_remove(int fd);
@@ -49,6 +113,12 @@ evloop_add_timer(int timeout, pommed_timer_cb cb);
 int
 evloop_remove_timer(int id);
 
+int
+evloop_defer(pommed_work_cb cb, void *data);
+
+int
+evloop_idle(pommed_work_cb cb, void *data);
+
 int
 evloop_iteration(void);
 
@@ -56,7 +126,7 @@ void
 evloop_stop(void);
 
 int
-evloop_init(void);
+evloop_init(int use_uring);
 
 void
 evloop_cleanup(void);
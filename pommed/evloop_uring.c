@@ -0,0 +1,379 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * io_uring backend for the event loop, using the raw syscalls.
+ *
+ * Sources are watched with one-shot IORING_OP_POLL_ADD requests, re-armed
+ * after dispatch; re-arming polls the current state, which keeps the
+ * level-triggered semantics the callbacks expect from epoll. Re-arms and
+ * removals queued during an iteration go out with the next wait, so a
+ * loop iteration costs a single io_uring_enter().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+
+#include <linux/io_uring.h>
+
+#include "pommed.h"
+#include "evloop.h"
+
+
+#define URING_ENTRIES           64
+
+/* user_data for requests whose completion we don't care about */
+#define URING_IGNORE            (~0ULL)
+
+
+static int ring_fd = -1;
+
+static void *sq_ptr;
+static size_t sq_size;
+static void *cq_ptr;
+static size_t cq_size;
+
+static unsigned int *sq_head;
+static unsigned int *sq_tail;
+static unsigned int *sq_mask;
+static unsigned int *sq_array;
+static struct io_uring_sqe *sqes;
+static size_t sqes_size;
+
+static unsigned int *cq_head;
+static unsigned int *cq_tail;
+static unsigned int *cq_mask;
+static struct io_uring_cqe *cqes;
+
+/* SQEs queued since the last io_uring_enter() */
+static unsigned int to_submit;
+
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int submit, unsigned int min_complete, unsigned int flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+
+static int
+evloop_uring_flush(void)
+{
+  int ret;
+
+  while (to_submit > 0)
+    {
+      ret = sys_io_uring_enter(ring_fd, to_submit, 0, 0);
+      if (ret < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+
+	  return -1;
+	}
+
+      to_submit -= ret;
+    }
+
+  return 0;
+}
+
+static struct io_uring_sqe *
+evloop_uring_get_sqe(void)
+{
+  struct io_uring_sqe *sqe;
+  unsigned int head;
+  unsigned int tail;
+
+  tail = *sq_tail;
+  head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+  /* Ring full, push what we have to the kernel first */
+  if ((tail - head) > *sq_mask)
+    {
+      if (evloop_uring_flush() < 0)
+	return NULL;
+
+      head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      if ((tail - head) > *sq_mask)
+	return NULL;
+    }
+
+  sqe = &sqes[tail & *sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+static void
+evloop_uring_queue_sqe(struct io_uring_sqe *sqe)
+{
+  unsigned int tail;
+
+  tail = *sq_tail;
+
+  sq_array[tail & *sq_mask] = sqe - sqes;
+
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  to_submit++;
+}
+
+
+static int
+evloop_uring_poll(int fd, uint32_t events, uint64_t handle)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = evloop_uring_get_sqe();
+  if (sqe == NULL)
+    {
+      errno = EBUSY;
+      return -1;
+    }
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll_events = (uint16_t)events;
+  sqe->user_data = handle;
+
+  evloop_uring_queue_sqe(sqe);
+
+  return 0;
+}
+
+static int
+evloop_uring_add(int fd, uint32_t events, uint64_t handle)
+{
+  return evloop_uring_poll(fd, events, handle);
+}
+
+static int
+evloop_uring_remove(int fd, uint64_t handle)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = evloop_uring_get_sqe();
+  if (sqe == NULL)
+    {
+      errno = EBUSY;
+      return -1;
+    }
+
+  /* The cancelled poll completes with -ECANCELED; evloop drops it anyway */
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = handle;
+  sqe->user_data = URING_IGNORE;
+
+  evloop_uring_queue_sqe(sqe);
+
+  /* The fd may be closed right after we return */
+  return evloop_uring_flush();
+}
+
+static void
+evloop_uring_rearm(int fd, uint32_t events, uint64_t handle)
+{
+  int ret;
+
+  ret = evloop_uring_poll(fd, events, handle);
+  if (ret < 0)
+    logmsg(LOG_ERR, "Could not re-arm poll on fd %d", fd);
+}
+
+static int
+evloop_uring_wait(struct epoll_event *evs, int maxevents)
+{
+  struct io_uring_cqe *cqe;
+  unsigned int head;
+  unsigned int tail;
+  int ret;
+  int n;
+
+  /* Submit the queued requests and wait, in one go */
+  ret = sys_io_uring_enter(ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+  if (ret < 0)
+    {
+      if (errno == EBUSY)
+	ret = 0; /* CQ overflow, reap what's there */
+      else
+	return -1;
+    }
+
+  to_submit -= ret;
+
+  n = 0;
+  head = *cq_head;
+  tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+  while ((head != tail) && (n < maxevents))
+    {
+      cqe = &cqes[head & *cq_mask];
+      head++;
+
+      if (cqe->user_data == URING_IGNORE)
+	continue;
+
+      if (cqe->res == -ECANCELED)
+	continue;
+
+      evs[n].data.u64 = cqe->user_data;
+      evs[n].events = (cqe->res < 0) ? EPOLLERR : (uint32_t)cqe->res;
+      n++;
+    }
+
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+  return n;
+}
+
+
+static void
+evloop_uring_cleanup(void)
+{
+  if (sqes != NULL)
+    munmap(sqes, sqes_size);
+
+  if ((cq_ptr != NULL) && (cq_ptr != sq_ptr))
+    munmap(cq_ptr, cq_size);
+
+  if (sq_ptr != NULL)
+    munmap(sq_ptr, sq_size);
+
+  sqes = NULL;
+  cq_ptr = NULL;
+  sq_ptr = NULL;
+
+  if (ring_fd >= 0)
+    close(ring_fd);
+
+  ring_fd = -1;
+}
+
+static int
+evloop_uring_init(void)
+{
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+
+  ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+  if (ring_fd < 0)
+    {
+      logdebug("io_uring_setup() failed: %s\n", strerror(errno));
+
+      return -1;
+    }
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      if (cq_size > sq_size)
+	sq_size = cq_size;
+      cq_size = sq_size;
+    }
+
+  sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED)
+    {
+      logdebug("Could not map io_uring SQ ring: %s\n", strerror(errno));
+
+      sq_ptr = NULL;
+      goto out_fail;
+    }
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    cq_ptr = sq_ptr;
+  else
+    {
+      cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring_fd, IORING_OFF_CQ_RING);
+      if (cq_ptr == MAP_FAILED)
+	{
+	  logdebug("Could not map io_uring CQ ring: %s\n", strerror(errno));
+
+	  cq_ptr = NULL;
+	  goto out_fail;
+	}
+    }
+
+  sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	      ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    {
+      logdebug("Could not map io_uring SQEs: %s\n", strerror(errno));
+
+      sqes = NULL;
+      goto out_fail;
+    }
+
+  sq_head = (unsigned int *)((char *)sq_ptr + p.sq_off.head);
+  sq_tail = (unsigned int *)((char *)sq_ptr + p.sq_off.tail);
+  sq_mask = (unsigned int *)((char *)sq_ptr + p.sq_off.ring_mask);
+  sq_array = (unsigned int *)((char *)sq_ptr + p.sq_off.array);
+
+  cq_head = (unsigned int *)((char *)cq_ptr + p.cq_off.head);
+  cq_tail = (unsigned int *)((char *)cq_ptr + p.cq_off.tail);
+  cq_mask = (unsigned int *)((char *)cq_ptr + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)((char *)cq_ptr + p.cq_off.cqes);
+
+  to_submit = 0;
+
+  return 0;
+
+ out_fail:
+  evloop_uring_cleanup();
+
+  return -1;
+}
+
+
+struct evloop_backend evloop_uring_backend =
+  {
+    .name = "io_uring",
+    .init = evloop_uring_init,
+    .add = evloop_uring_add,
+    .remove = evloop_uring_remove,
+    .wait = evloop_uring_wait,
+    .rearm = evloop_uring_rearm,
+    .cleanup = evloop_uring_cleanup,
+  };
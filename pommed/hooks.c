@@ -0,0 +1,547 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * User hooks are run by a small helper process forked once at startup,
+ * so the daemon itself is never forked for a hook. The helper gets the
+ * commands over a socketpair, starts them with posix_spawn() and sends
+ * back a pidfd the main loop watches for completion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include <spawn.h>
+#include <sched.h>
+#include <poll.h>
+#include <dirent.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+
+#include "pommed.h"
+#include "evloop.h"
+#include "conffile.h"
+#include "latency.h"
+#include "hooks.h"
+
+
+/* Linux 5.3 */
+#ifndef __NR_pidfd_open
+# define __NR_pidfd_open 434
+#endif
+
+/* Linux 5.9 */
+#ifndef __NR_close_range
+# define __NR_close_range 436
+#endif
+
+extern char **environ;
+
+
+struct hooks_reply
+{
+  pid_t pid;
+  int err;
+};
+
+struct hooks_running
+{
+  int fd;
+  pid_t pid;
+};
+
+static struct hooks_running running[HOOKS_RUNNING_MAX];
+
+static int hooks_sock = -1;
+static pid_t helper_pid;
+
+
+/* Helper side */
+
+static void
+hooks_helper_close_fds(int keep)
+{
+  struct dirent *de;
+  DIR *dir;
+  long max_fd;
+  int fd;
+  int ret;
+
+  /* One or two system calls, instead of one per possible fd */
+  ret = 0;
+  if (keep > 3)
+    ret = syscall(__NR_close_range, 3, keep - 1, 0);
+  if (ret == 0)
+    ret = syscall(__NR_close_range, keep + 1, ~0U, 0);
+  if (ret == 0)
+    return;
+
+  /* Older kernel, close what's actually open */
+  dir = opendir("/proc/self/fd");
+  if (dir != NULL)
+    {
+      while ((de = readdir(dir)) != NULL)
+	{
+	  fd = atoi(de->d_name);
+
+	  if ((fd < 3) || (fd == keep) || (fd == dirfd(dir)))
+	    continue;
+
+	  close(fd);
+	}
+
+      closedir(dir);
+
+      return;
+    }
+
+  /* No /proc either */
+  max_fd = sysconf(_SC_OPEN_MAX);
+
+  if (max_fd > INT_MAX)
+    max_fd = INT_MAX;
+
+  for (fd = 3; fd < max_fd; fd++)
+    {
+      if (fd != keep)
+	close(fd);
+    }
+}
+
+static void
+hooks_helper_spawn(int sock, char *msg, int len)
+{
+  struct hooks_reply reply;
+  struct msghdr mh;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  posix_spawnattr_t attr;
+  struct sched_param param;
+  sigset_t sigs;
+  short flags;
+  char *argv[4];
+  char *event;
+  char *cmd;
+  pid_t pid;
+  int pidfd;
+
+  msg[len] = '\0';
+
+  event = msg;
+  cmd = memchr(msg, '\0', len);
+  if ((cmd == NULL) || (cmd == msg + len))
+    return;
+  cmd++;
+
+  argv[0] = "sh";
+  argv[1] = "-c";
+  argv[2] = cmd;
+  argv[3] = NULL;
+
+  setenv("POMMED_EVENT", event, 1);
+
+  /* The helper blocks SIGCHLD for its signalfd */
+  sigemptyset(&sigs);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigmask(&attr, &sigs);
+  flags = POSIX_SPAWN_SETSIGMASK;
+
+  /* The helper may be at SCHED_IDLE, the hooks themselves are not */
+  if (general_cfg.lowlatency)
+    {
+      memset(&param, 0, sizeof(param));
+      posix_spawnattr_setschedpolicy(&attr, SCHED_OTHER);
+      posix_spawnattr_setschedparam(&attr, &param);
+      flags |= POSIX_SPAWN_SETSCHEDULER;
+    }
+
+  posix_spawnattr_setflags(&attr, flags);
+
+  reply.err = posix_spawn(&pid, HOOKS_SHELL, NULL, &attr, argv, environ);
+  reply.pid = (reply.err == 0) ? pid : -1;
+
+  posix_spawnattr_destroy(&attr);
+
+  /* Not reaped before we're back to the signalfd, the pid is safe */
+  pidfd = -1;
+  if (reply.err == 0)
+    pidfd = syscall(__NR_pidfd_open, pid, 0);
+
+  memset(&mh, 0, sizeof(mh));
+  iov.iov_base = &reply;
+  iov.iov_len = sizeof(reply);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+
+  if (pidfd >= 0)
+    {
+      mh.msg_control = cbuf;
+      mh.msg_controllen = sizeof(cbuf);
+
+      cmsg = CMSG_FIRSTHDR(&mh);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &pidfd, sizeof(int));
+    }
+
+  sendmsg(sock, &mh, MSG_NOSIGNAL);
+
+  if (pidfd >= 0)
+    close(pidfd);
+}
+
+static void
+hooks_helper(int sock)
+{
+  struct signalfd_siginfo si;
+  struct pollfd pfd[2];
+  char msg[HOOKS_MSG_MAX + 1];
+  sigset_t sigs;
+  pid_t pid;
+  int status;
+  int ret;
+
+  hooks_helper_close_fds(sock);
+
+  latency_idle();
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGPIPE, SIG_IGN);
+
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+
+  pfd[0].fd = sock;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  pfd[1].events = POLLIN;
+
+  for (;;)
+    {
+      ret = poll(pfd, 2, -1);
+      if (ret < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+
+	  break;
+	}
+
+      if (pfd[1].revents & POLLIN)
+	{
+	  while (read(pfd[1].fd, &si, sizeof(si)) == sizeof(si))
+	    ;
+
+	  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	    {
+	      if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+		logmsg(LOG_INFO, "Hook process %d failed", pid);
+	    }
+	}
+
+      if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+	{
+	  ret = recv(sock, msg, HOOKS_MSG_MAX, 0);
+
+	  /* The daemon is gone */
+	  if (ret <= 0)
+	    break;
+
+	  hooks_helper_spawn(sock, msg, ret);
+	}
+    }
+
+  _exit(0);
+}
+
+
+/* Daemon side */
+
+static void
+hooks_process_exit(int fd, uint32_t events)
+{
+  int i;
+
+  for (i = 0; i < HOOKS_RUNNING_MAX; i++)
+    {
+      if (running[i].fd == fd)
+	{
+	  logdebug("Hook process %d done\n", running[i].pid);
+
+	  running[i].fd = -1;
+	  break;
+	}
+    }
+
+  evloop_remove(fd);
+  close(fd);
+}
+
+static void
+hooks_watch(pid_t pid, int pidfd)
+{
+  int ret;
+  int i;
+
+  for (i = 0; i < HOOKS_RUNNING_MAX; i++)
+    {
+      if (running[i].fd < 0)
+	break;
+    }
+
+  if (i == HOOKS_RUNNING_MAX)
+    {
+      close(pidfd);
+
+      return;
+    }
+
+  ret = evloop_add(pidfd, EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, hooks_process_exit);
+  if (ret < 0)
+    {
+      close(pidfd);
+
+      return;
+    }
+
+  running[i].fd = pidfd;
+  running[i].pid = pid;
+}
+
+static void
+hooks_process_reply(int fd, uint32_t events)
+{
+  struct hooks_reply reply;
+  struct msghdr mh;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  int pidfd;
+  int ret;
+
+  if (events & (EPOLLERR | EPOLLHUP))
+    {
+      logmsg(LOG_ERR, "Hook helper exited, hooks disabled");
+
+      evloop_remove(fd);
+      close(fd);
+      hooks_sock = -1;
+
+      waitpid(helper_pid, NULL, WNOHANG);
+      helper_pid = 0;
+
+      return;
+    }
+
+  memset(&mh, 0, sizeof(mh));
+  iov.iov_base = &reply;
+  iov.iov_len = sizeof(reply);
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = cbuf;
+  mh.msg_controllen = sizeof(cbuf);
+
+  ret = recvmsg(fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (ret != sizeof(reply))
+    return;
+
+  pidfd = -1;
+  cmsg = CMSG_FIRSTHDR(&mh);
+  if ((cmsg != NULL) && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+    memcpy(&pidfd, CMSG_DATA(cmsg), sizeof(int));
+
+  if (reply.err != 0)
+    {
+      logmsg(LOG_ERR, "Could not run hook: %s", strerror(reply.err));
+
+      return;
+    }
+
+  logdebug("Hook process %d started\n", reply.pid);
+
+  /* No pidfd before Linux 5.3, the helper reaps it anyway */
+  if (pidfd >= 0)
+    hooks_watch(reply.pid, pidfd);
+}
+
+
+/* Safe to call from the main thread only */
+int
+hooks_exec(const char *event, const char *cmd)
+{
+  char msg[HOOKS_MSG_MAX];
+  int len;
+  int ret;
+
+  if (hooks_sock < 0)
+    {
+      logmsg(LOG_INFO, "Hook helper not running, not running hook for %s", event);
+
+      return -1;
+    }
+
+  len = snprintf(msg, sizeof(msg), "%s%c%s", event, '\0', cmd);
+  if ((len <= 0) || (len >= sizeof(msg)))
+    {
+      logmsg(LOG_ERR, "Hook command for %s too long", event);
+
+      return -1;
+    }
+
+  ret = send(hooks_sock, msg, len + 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not send hook to helper: %s", strerror(errno));
+
+      return -1;
+    }
+
+  return 0;
+}
+
+void
+hooks_event(int event)
+{
+  const char *name;
+  const char *cmd;
+
+  switch (event)
+    {
+      case HOOK_AC_PLUGGED:
+	name = "ac_plugged";
+	cmd = hooks_cfg.ac_plugged;
+	break;
+
+      case HOOK_AC_UNPLUGGED:
+	name = "ac_unplugged";
+	cmd = hooks_cfg.ac_unplugged;
+	break;
+
+      case HOOK_LID_CLOSED:
+	name = "lid_closed";
+	cmd = hooks_cfg.lid_closed;
+	break;
+
+      case HOOK_LID_OPENED:
+	name = "lid_opened";
+	cmd = hooks_cfg.lid_opened;
+	break;
+
+      default:
+	return;
+    }
+
+  if ((cmd == NULL) || (cmd[0] == '\0'))
+    return;
+
+  hooks_exec(name, cmd);
+}
+
+
+/* Must be called before any thread is started */
+int
+hooks_init(void)
+{
+  int sv[2];
+  int ret;
+  int i;
+
+  for (i = 0; i < HOOKS_RUNNING_MAX; i++)
+    running[i].fd = -1;
+
+  ret = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not create hook helper socket: %s", strerror(errno));
+
+      return -1;
+    }
+
+  helper_pid = fork();
+  if (helper_pid < 0)
+    {
+      logmsg(LOG_ERR, "Could not fork hook helper: %s", strerror(errno));
+
+      close(sv[0]);
+      close(sv[1]);
+
+      helper_pid = 0;
+
+      return -1;
+    }
+
+  if (helper_pid == 0)
+    hooks_helper(sv[1]);
+
+  close(sv[1]);
+
+  ret = evloop_add(sv[0], EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, hooks_process_reply);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not add hook helper socket to event loop");
+
+      close(sv[0]);
+
+      waitpid(helper_pid, NULL, 0);
+      helper_pid = 0;
+
+      return -1;
+    }
+
+  hooks_sock = sv[0];
+
+  return 0;
+}
+
+void
+hooks_cleanup(void)
+{
+  /* evloop_cleanup() takes care of the pidfds; EOF tells the helper to exit */
+  if (hooks_sock >= 0)
+    {
+      evloop_remove(hooks_sock);
+      close(hooks_sock);
+
+      hooks_sock = -1;
+    }
+
+  if (helper_pid > 0)
+    {
+      waitpid(helper_pid, NULL, 0);
+
+      helper_pid = 0;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * pommed - hooks.h
+ */
+
+#ifndef __HOOKS_H__
+#define __HOOKS_H__
+
+
+#define HOOKS_SHELL             "/bin/sh"
+
+/* event name + command, NUL-separated */
+#define HOOKS_MSG_MAX           1024
+
+/* Hook processes we watch for completion */
+#define HOOKS_RUNNING_MAX       16
+
+/* Events with a configurable hook */
+enum
+  {
+    HOOK_AC_PLUGGED = 0,
+    HOOK_AC_UNPLUGGED,
+    HOOK_LID_CLOSED,
+    HOOK_LID_OPENED,
+    HOOK_MAX /* keep this one last */
+  };
+
+
+int
+hooks_exec(const char *event, const char *cmd);
+
+void
+hooks_event(int event);
+
+int
+hooks_init(void);
+
+void
+hooks_cleanup(void);
+
+
+#endif /* !__HOOKS_H__ */
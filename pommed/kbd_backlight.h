@@ -43,50 +43,15 @@ struct _kbd_bck_info
 
 extern struct _kbd_bck_info kbd_bck_info;
 
-#ifdef __powerpc__
 static inline int
 has_kbd_backlight(void)
 {
-  return ((mops->type == MACHINE_POWERBOOK_51)
-	  || (mops->type == MACHINE_POWERBOOK_52)
-	  || (mops->type == MACHINE_POWERBOOK_53)
-	  || (mops->type == MACHINE_POWERBOOK_54)
-	  || (mops->type == MACHINE_POWERBOOK_55)
-	  || (mops->type == MACHINE_POWERBOOK_56)
-	  || (mops->type == MACHINE_POWERBOOK_57)
-	  || (mops->type == MACHINE_POWERBOOK_58)
-	  || (mops->type == MACHINE_POWERBOOK_59));
+  return (mops->caps & MACHINE_CAP_KBD_BACKLIGHT);
 }
 
-#else
-
-static inline int
-has_kbd_backlight(void)
-{
-  return ((mops->type == MACHINE_MACBOOKPRO_1)
-	  || (mops->type == MACHINE_MACBOOKPRO_2)
-	  || (mops->type == MACHINE_MACBOOKPRO_3)
-	  || (mops->type == MACHINE_MACBOOKPRO_4)
-	  || (mops->type == MACHINE_MACBOOKPRO_5)
-	  || (mops->type == MACHINE_MACBOOKPRO_6)
-	  || (mops->type == MACHINE_MACBOOKPRO_7)
-	  || (mops->type == MACHINE_MACBOOKPRO_8)
-	  || (mops->type == MACHINE_MACBOOKPRO_9)
-	  || (mops->type == MACHINE_MACBOOKPRO_10)
-	  || (mops->type == MACHINE_MACBOOKPRO_11)
-	  || (mops->type == MACHINE_MACBOOKPRO_12)
-	  || (mops->type == MACHINE_MACBOOK_5)
-	  || (mops->type == MACHINE_MACBOOKAIR_1)
-	  || (mops->type == MACHINE_MACBOOKAIR_2)
-	  || (mops->type == MACHINE_MACBOOKAIR_3)
-	  || (mops->type == MACHINE_MACBOOKAIR_4)
-	  || (mops->type == MACHINE_MACBOOKAIR_5)
-	  || (mops->type == MACHINE_MACBOOKAIR_6)
-		|| (mops->type == MACHINE_MACBOOKAIR_7)
-	  );
-}
-#endif /* __powerpc__ */
 
+void
+kbd_backlight_set(int val, int who);
 
 void
 kbd_backlight_step(int dir);
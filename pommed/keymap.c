@@ -0,0 +1,420 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Key bindings: the defaults and the keys section of the configuration
+ * file are compiled into a table indexed by key code. Each slot holds
+ * the index of the first binding for the key; bindings for the same key
+ * are chained, those requiring a given modifier state coming first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <syslog.h>
+
+#include <linux/input.h>
+
+#include "pommed.h"
+#include "conffile.h"
+#include "keymap.h"
+#include "lcd_backlight.h"
+#include "kbd_backlight.h"
+#include "cd_eject.h"
+#include "audio.h"
+#include "video.h"
+#include "hooks.h"
+
+
+#ifndef KEY_CNT
+# define KEY_CNT (KEY_MAX + 1)
+#endif
+
+
+struct keymap_action
+{
+  const char *name;
+  keymap_fn fn;
+  int arg;
+};
+
+struct keymap_key
+{
+  const char *name;
+  unsigned int code;
+};
+
+struct keymap_default
+{
+  unsigned int code;
+  const char *action;
+};
+
+
+static unsigned char keymap[KEY_CNT];
+
+static struct keymap_binding bindings[KEYMAP_MAX_BINDINGS + 1];
+static int nbindings;
+
+static unsigned char modifiers;
+
+
+static void
+keymap_lcd_backlight(int dir, void *data)
+{
+  mops->lcd_backlight_step(dir);
+}
+
+static void
+keymap_audio_step(int dir, void *data)
+{
+  audio_step(dir);
+}
+
+static void
+keymap_audio_mute(int arg, void *data)
+{
+  audio_toggle_mute();
+}
+
+static void
+keymap_video_switch(int arg, void *data)
+{
+  video_switch();
+}
+
+static void
+keymap_kbd_backlight_toggle(int arg, void *data)
+{
+  if (!has_kbd_backlight())
+    return;
+
+  if (kbd_cfg.auto_on)
+    kbd_backlight_inhibit_toggle(KBD_INHIBIT_USER);
+  else
+    kbd_backlight_toggle();
+}
+
+static void
+keymap_kbd_backlight_step(int dir, void *data)
+{
+  if (!has_kbd_backlight())
+    return;
+
+  if (dir == STEP_UP)
+    {
+      kbd_backlight_inhibit_clear(KBD_INHIBIT_USER);
+      kbd_backlight_step(STEP_UP);
+    }
+  else
+    {
+      kbd_backlight_step(STEP_DOWN);
+      if (kbd_bck_info.level == KBD_BACKLIGHT_OFF)
+	kbd_backlight_inhibit_set(KBD_INHIBIT_USER);
+    }
+}
+
+static void
+keymap_cd_eject(int arg, void *data)
+{
+  cd_eject();
+}
+
+static void
+keymap_exec(int arg, void *data)
+{
+  hooks_exec("key", data);
+}
+
+static void
+keymap_none(int arg, void *data)
+{
+}
+
+
+static struct keymap_action actions[] =
+  {
+    { "lcd_backlight_up", keymap_lcd_backlight, STEP_UP },
+    { "lcd_backlight_down", keymap_lcd_backlight, STEP_DOWN },
+    { "audio_up", keymap_audio_step, STEP_UP },
+    { "audio_down", keymap_audio_step, STEP_DOWN },
+    { "audio_mute", keymap_audio_mute, 0 },
+    { "video_switch", keymap_video_switch, 0 },
+    { "kbd_backlight_toggle", keymap_kbd_backlight_toggle, 0 },
+    { "kbd_backlight_up", keymap_kbd_backlight_step, STEP_UP },
+    { "kbd_backlight_down", keymap_kbd_backlight_step, STEP_DOWN },
+    { "cd_eject", keymap_cd_eject, 0 },
+    { "exec", keymap_exec, 0 },
+    { "none", keymap_none, 0 },
+  };
+
+/* Generated from linux/input.h, see the Makefile */
+static struct keymap_key keys[] =
+  {
+#include "keymap_names.h"
+  };
+
+static struct keymap_default defaults[] =
+  {
+    { KEY_BRIGHTNESSDOWN, "lcd_backlight_down" },
+    { KEY_BRIGHTNESSUP, "lcd_backlight_up" },
+    { KEY_MUTE, "audio_mute" },
+    { KEY_VOLUMEDOWN, "audio_down" },
+    { KEY_VOLUMEUP, "audio_up" },
+    { KEY_SWITCHVIDEOMODE, "video_switch" },
+    { KEY_KBDILLUMTOGGLE, "kbd_backlight_toggle" },
+    { KEY_KBDILLUMDOWN, "kbd_backlight_down" },
+    { KEY_KBDILLUMUP, "kbd_backlight_up" },
+    { KEY_EJECTCD, "cd_eject" },
+  };
+
+
+/* Returns 1 if the key is a modifier, after updating the modifier state */
+int
+keymap_modifier(unsigned int code, int value)
+{
+  unsigned char mod;
+
+  switch (code)
+    {
+      case KEY_LEFTSHIFT:
+      case KEY_RIGHTSHIFT:
+	mod = KEYMAP_MOD_SHIFT;
+	break;
+
+      case KEY_LEFTCTRL:
+      case KEY_RIGHTCTRL:
+	mod = KEYMAP_MOD_CTRL;
+	break;
+
+      case KEY_LEFTALT:
+      case KEY_RIGHTALT:
+	mod = KEYMAP_MOD_ALT;
+	break;
+
+      case KEY_LEFTMETA:
+      case KEY_RIGHTMETA:
+	mod = KEYMAP_MOD_META;
+	break;
+
+      default:
+	return 0;
+    }
+
+  if (value)
+    modifiers |= mod;
+  else
+    modifiers &= ~mod;
+
+  return 1;
+}
+
+void
+keymap_dispatch(unsigned int code)
+{
+  struct keymap_binding *b;
+  int i;
+
+  if (code >= KEY_CNT)
+    return;
+
+  for (i = keymap[code]; i != 0; i = b->next)
+    {
+      b = &bindings[i];
+
+      if ((b->mods == KEYMAP_MOD_ANY) || (b->mods == modifiers))
+	{
+	  logdebug("\nKEY: %s\n", b->name);
+
+	  b->fn(b->arg, b->data);
+
+	  return;
+	}
+    }
+}
+
+
+static int
+keymap_lookup_key(const char *name, unsigned int *code)
+{
+  char *end;
+  long val;
+  int i;
+
+  val = strtol(name, &end, 0);
+  if ((end != name) && (*end == '\0'))
+    {
+      if ((val <= 0) || (val >= KEY_CNT))
+	return -1;
+
+      *code = val;
+
+      return 0;
+    }
+
+  for (i = 0; i < sizeof(keys) / sizeof(*keys); i++)
+    {
+      if (strcasecmp(keys[i].name, name) == 0)
+	{
+	  *code = keys[i].code;
+
+	  return 0;
+	}
+    }
+
+  return -1;
+}
+
+static struct keymap_action *
+keymap_lookup_action(const char *name)
+{
+  int i;
+
+  for (i = 0; i < sizeof(actions) / sizeof(*actions); i++)
+    {
+      if (strcmp(actions[i].name, name) == 0)
+	return &actions[i];
+    }
+
+  return NULL;
+}
+
+/* Run an action by name, for the control socket; commands are not allowed */
+int
+keymap_run(const char *name)
+{
+  struct keymap_action *action;
+
+  action = keymap_lookup_action(name);
+  if ((action == NULL) || (action->fn == keymap_exec))
+    return -1;
+
+  logdebug("\nACTION: %s\n", action->name);
+
+  action->fn(action->arg, NULL);
+
+  return 0;
+}
+
+static int
+keymap_bind(unsigned int code, unsigned char mods, struct keymap_action *action, void *data)
+{
+  struct keymap_binding *b;
+  int i;
+
+  if (nbindings == KEYMAP_MAX_BINDINGS)
+    {
+      logmsg(LOG_ERR, "Too many key bindings, max %d", KEYMAP_MAX_BINDINGS);
+
+      return -1;
+    }
+
+  nbindings++;
+  b = &bindings[nbindings];
+
+  b->fn = action->fn;
+  b->arg = action->arg;
+  b->data = data;
+  b->name = action->name;
+  b->mods = mods;
+  b->next = 0;
+
+  /* Catch-all bindings go last */
+  if ((mods != KEYMAP_MOD_ANY) || (keymap[code] == 0))
+    {
+      b->next = keymap[code];
+      keymap[code] = nbindings;
+
+      return 0;
+    }
+
+  for (i = keymap[code]; bindings[i].next != 0; i = bindings[i].next)
+    ;
+
+  bindings[i].next = nbindings;
+
+  return 0;
+}
+
+int
+keymap_compile(void)
+{
+  unsigned char user[KEY_CNT];
+  struct keymap_action *action;
+  unsigned int code;
+  int ret;
+  int i;
+
+  memset(keymap, 0, sizeof(keymap));
+  memset(bindings, 0, sizeof(bindings));
+  nbindings = 0;
+
+  memset(user, 0, sizeof(user));
+
+  for (i = 0; i < keys_cfg.nbinds; i++)
+    {
+      ret = keymap_lookup_key(keys_cfg.binds[i].key, &code);
+      if (ret < 0)
+	{
+	  logmsg(LOG_ERR, "Unknown key %s in key bindings", keys_cfg.binds[i].key);
+
+	  return -1;
+	}
+
+      action = keymap_lookup_action(keys_cfg.binds[i].action);
+      if (action == NULL)
+	{
+	  logmsg(LOG_ERR, "Unknown action %s for key %s", keys_cfg.binds[i].action, keys_cfg.binds[i].key);
+
+	  return -1;
+	}
+
+      if ((action->fn == keymap_exec) && (keys_cfg.binds[i].command[0] == '\0'))
+	{
+	  logmsg(LOG_ERR, "No command for key %s", keys_cfg.binds[i].key);
+
+	  return -1;
+	}
+
+      ret = keymap_bind(code, keys_cfg.binds[i].mods, action, keys_cfg.binds[i].command);
+      if (ret < 0)
+	return -1;
+
+      user[code] = 1;
+    }
+
+  /* Defaults, unless the key has been bound by the user */
+  for (i = 0; i < sizeof(defaults) / sizeof(*defaults); i++)
+    {
+      if (user[defaults[i].code])
+	continue;
+
+      action = keymap_lookup_action(defaults[i].action);
+
+      ret = keymap_bind(defaults[i].code, KEYMAP_MOD_ANY, action, NULL);
+      if (ret < 0)
+	return -1;
+    }
+
+  logdebug("Key bindings: %d\n", nbindings);
+
+  return 0;
+}
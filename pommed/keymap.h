@@ -0,0 +1,47 @@
+/*
+ * pommed - keymap.h
+ */
+
+#ifndef __KEYMAP_H__
+#define __KEYMAP_H__
+
+
+/* Bindings, including the defaults; index 0 means unbound */
+#define KEYMAP_MAX_BINDINGS     255
+
+/* Modifier state, left and right keys are not told apart */
+#define KEYMAP_MOD_SHIFT        (1 << 0)
+#define KEYMAP_MOD_CTRL         (1 << 1)
+#define KEYMAP_MOD_ALT          (1 << 2)
+#define KEYMAP_MOD_META         (1 << 3)
+/* Binding matches whatever the modifier state */
+#define KEYMAP_MOD_ANY          (1 << 7)
+
+typedef void(*keymap_fn)(int arg, void *data);
+
+struct keymap_binding
+{
+  keymap_fn fn;
+  int arg;
+  void *data;
+  const char *name;  /* action name */
+
+  unsigned char mods;
+  unsigned char next; /* next binding for the same key, 0 terminated */
+};
+
+
+int
+keymap_modifier(unsigned int code, int value);
+
+void
+keymap_dispatch(unsigned int code);
+
+int
+keymap_run(const char *name);
+
+int
+keymap_compile(void);
+
+
+#endif /* !__KEYMAP_H__ */
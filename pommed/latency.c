@@ -0,0 +1,198 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Low latency mode (general { lowlatency = yes; }): after hours of idle
+ * time, the pages needed to handle a keypress may have been reclaimed,
+ * and faulting them back in stalls the first hotkey.
+ *
+ * All current and future memory is locked, the main thread stack is
+ * prefaulted, and the event loop thread, which dispatches input events,
+ * runs at SCHED_FIFO (or at a high nice level if that's not allowed).
+ * The actuator thread does the LCD, keyboard and volume writes for the
+ * hotkeys, it runs at SCHED_FIFO too, one step below the loop: a burst
+ * of keypresses is dispatched first and collapses into a single write.
+ * Non-critical work (the eject worker, the hook helper) drops to
+ * SCHED_IDLE. The beep thread decodes its sample and loads ALSA upfront.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <pthread.h>
+
+#include "pommed.h"
+#include "conffile.h"
+#include "latency.h"
+
+
+/* Linux 2.6.23, only defined with _GNU_SOURCE */
+#ifndef SCHED_IDLE
+# define SCHED_IDLE 5
+#endif
+
+
+static int locked;
+
+
+/* Touch the stack the loop will run on, so it's mapped before mlockall() */
+static void __attribute__ ((noinline))
+latency_prefault_stack(void)
+{
+  volatile char stack[LATENCY_STACK_PREFAULT];
+  int i;
+
+  for (i = 0; i < sizeof(stack); i += sysconf(_SC_PAGESIZE))
+    stack[i] = 0;
+}
+
+/*
+ * SCHED_FIFO for the calling thread, or the nice fallback; returns 0
+ * for SCHED_FIFO, 1 for the nice level, -1 if neither was allowed
+ */
+static int
+latency_raise(int prio)
+{
+  struct sched_param param;
+  int ret;
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = prio;
+
+  ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (ret == 0)
+    return 0;
+
+  logdebug("Could not switch to SCHED_FIFO: %s\n", strerror(ret));
+
+  /* Applies to the calling thread only on Linux */
+  ret = setpriority(PRIO_PROCESS, 0, LATENCY_NICE);
+  if (ret < 0)
+    return -1;
+
+  return 1;
+}
+
+/* Called by the actuator thread, on itself */
+void
+latency_actuator(void)
+{
+  int ret;
+
+  if (!general_cfg.lowlatency)
+    return;
+
+  ret = latency_raise(LATENCY_ACT_PRIO);
+  if (ret < 0)
+    logmsg(LOG_WARNING, "Could not raise actuator priority: %s", strerror(errno));
+}
+
+/* Called by non-critical threads and processes, on themselves */
+void
+latency_idle(void)
+{
+  struct sched_param param;
+  int ret;
+
+  if (!general_cfg.lowlatency)
+    return;
+
+  memset(&param, 0, sizeof(param));
+
+  ret = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  if (ret != 0)
+    logdebug("Could not switch to SCHED_IDLE: %s\n", strerror(ret));
+}
+
+/* Smaller stacks for the threads created afterwards, they're locked too */
+void
+latency_thread_attr(pthread_attr_t *attr)
+{
+  if (!general_cfg.lowlatency)
+    return;
+
+  pthread_attr_setstacksize(attr, LATENCY_THREAD_STACK);
+}
+
+/* Called from the main thread, right before entering the event loop */
+int
+latency_init(void)
+{
+  int ret;
+
+  if (!general_cfg.lowlatency)
+    return 0;
+
+  latency_prefault_stack();
+
+  ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+  if (ret < 0)
+    logmsg(LOG_WARNING, "Could not lock memory: %s", strerror(errno));
+  else
+    locked = 1;
+
+  ret = latency_raise(LATENCY_RT_PRIO);
+  if (ret == 0)
+    {
+      logmsg(LOG_INFO, "Low latency mode: event loop at SCHED_FIFO %d%s",
+	     LATENCY_RT_PRIO, (locked) ? ", memory locked" : "");
+
+      return 0;
+    }
+
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Could not raise event loop priority: %s", strerror(errno));
+
+      return -1;
+    }
+
+  logmsg(LOG_INFO, "Low latency mode: event loop at nice %d%s",
+	 LATENCY_NICE, (locked) ? ", memory locked" : "");
+
+  return 0;
+}
+
+void
+latency_cleanup(void)
+{
+  struct sched_param param;
+
+  if (!general_cfg.lowlatency)
+    return;
+
+  /* Back to normal for the teardown */
+  memset(&param, 0, sizeof(param));
+  pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+  if (locked)
+    munlockall();
+
+  locked = 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * pommed - latency.h
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <pthread.h>
+
+
+/* Event loop priority in low latency mode */
+#define LATENCY_RT_PRIO          10   /* SCHED_FIFO */
+#define LATENCY_NICE             -15  /* if SCHED_FIFO is not allowed */
+
+/* Actuator thread priority, below the event loop */
+#define LATENCY_ACT_PRIO         (LATENCY_RT_PRIO - 1)
+
+/* Main thread stack prefaulted before locking it */
+#define LATENCY_STACK_PREFAULT   (64 * 1024)
+
+/* Stack size of the threads created once memory is locked */
+#define LATENCY_THREAD_STACK     (256 * 1024)
+
+
+void
+latency_actuator(void);
+
+void
+latency_idle(void);
+
+void
+latency_thread_attr(pthread_attr_t *attr);
+
+int
+latency_init(void);
+
+void
+latency_cleanup(void);
+
+
+#endif /* !__LATENCY_H__ */
@@ -54,6 +54,9 @@ gma950_backlight_toggle(int lvl);
 int
 gma950_backlight_probe(void);
 
+void
+gma950_backlight_fix_config(void);
+
 
 /* nv8600mgt_backlight.c */
 #define NV8600MGT_BACKLIGHT_OFF    0
@@ -82,6 +85,9 @@ sysfs_backlight_step(int dir);
 void
 sysfs_backlight_toggle(int lvl);
 
+void
+sysfs_backlight_fix_config(void);
+
 #ifdef __powerpc__
 void
 sysfs_backlight_step_kernel(int dir);
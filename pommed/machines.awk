@@ -0,0 +1,85 @@
+#
+# pommed - machines.awk
+#
+# Generates the machine table from machines.list, one initializer per
+# line, x86 and ppc entries under the matching preprocessor branch:
+#   { "model", type, lcd backend, caps },
+#
+# The input is sorted with LC_ALL=C, see the Makefile, so the entries
+# come out in strcmp() order for the lookup.
+#
+
+function caps(s,    n, i, c, out)
+{
+  if (s == "-")
+    return "0"
+
+  n = split(s, c, ",")
+  out = ""
+  for (i = 1; i <= n; i++)
+    {
+      if (!(c[i] in known_caps))
+	{
+	  printf("machines.list:%d: unknown capability %s\n", FNR, c[i]) > "/dev/stderr"
+	  err = 1
+	  exit 1
+	}
+
+      out = out ((i > 1) ? " | " : "") "MACHINE_CAP_" toupper(c[i])
+    }
+
+  return out
+}
+
+BEGIN {
+  known_caps["kbd_backlight"] = 1
+  known_caps["kbd_pmu"] = 1
+  known_caps["nv8600_b2"] = 1
+  known_caps["nv8600_52e"] = 1
+
+  known_lcd["x86", "x1600"] = 1
+  known_lcd["x86", "gma950"] = 1
+  known_lcd["x86", "mbp_sysfs"] = 1
+  known_lcd["ppc", "aty128"] = 1
+  known_lcd["ppc", "r9x00"] = 1
+  known_lcd["ppc", "nvidia"] = 1
+}
+
+/^#/ || NF == 0 { next }
+
+{
+  if ((NF != 5) || !(($2, $4) in known_lcd))
+    {
+      printf("machines.list:%d: invalid entry\n", FNR) > "/dev/stderr"
+      err = 1
+      exit 1
+    }
+
+  if ($1 in seen)
+    {
+      printf("machines.list:%d: duplicate model %s\n", FNR, $1) > "/dev/stderr"
+      err = 1
+      exit 1
+    }
+  seen[$1] = 1
+
+  line = sprintf("  { \"%s\", %s, LCD_BACKEND_%s, %s },", $1, $3, toupper($4), caps($5))
+
+  if ($2 == "ppc")
+    ppc[nppc++] = line
+  else
+    x86[nx86++] = line
+}
+
+END {
+  if (err)
+    exit 1
+
+  print "#ifdef __powerpc__"
+  for (i = 0; i < nppc; i++)
+    print ppc[i]
+  print "#else"
+  for (i = 0; i < nx86; i++)
+    print x86[i]
+  print "#endif"
+}
@@ -65,6 +65,8 @@
 #include "../pommed.h"
 #include "../conffile.h"
 #include "../lcd_backlight.h"
+#include "../probecache.h"
+#include "../dynlib_pci.h"
 
 
 static unsigned int GMA950_BACKLIGHT_MAX;
@@ -266,11 +268,14 @@ gma950_backlight_toggle(int lvl)
 
 /*
  * We are hardware-dependent for GMA950_BACKLIGHT_MAX,
- * so here _fix_config() is static and called at probe time.
+ * so here _fix_config() does nothing until called at probe time.
  */
-static void
+void
 gma950_backlight_fix_config(void)
 {
+  if (GMA950_BACKLIGHT_MAX == 0)
+    return;
+
   if (lcd_gma950_cfg.init < 0)
     lcd_gma950_cfg.init = -1;
 
@@ -297,28 +302,47 @@ gma950_backlight_fix_config(void)
 #define PCI_ID_PRODUCT_GMA950    0x27A2
 #define PCI_ID_PRODUCT_GMA965    0x2A02
 
-/* Look for an Intel GMA950 or GMA965 */
-int
-gma950_backlight_probe(void)
+/*
+ * Look for an Intel GMA950 or GMA965; returns the device ID and the PCI
+ * slot, from the probe cache or a bus scan
+ */
+static int
+gma950_backlight_find(char *slot, int size)
 {
   struct pci_access *pacc;
   struct pci_dev *dev;
-  struct stat stbuf;
+  const char *cached;
+  unsigned int vendor;
+  unsigned int device;
+
+  cached = probecache_get("pci.gma950");
+  if ((cached != NULL)
+      && (probecache_pci_id(cached, &vendor, &device) == 0)
+      && (vendor == PCI_ID_VENDOR_INTEL)
+      && ((device == PCI_ID_PRODUCT_GMA950)
+	  || (device == PCI_ID_PRODUCT_GMA965)))
+    {
+      snprintf(slot, size, "%s", cached);
 
-  int card;
-  int ret;
+      return device;
+    }
+
+  /* libpci is only needed for the bus scan */
+  if (dynlib_load(&dynlib_pci) < 0)
+    return -1;
 
   pacc = pci_alloc();
   if (pacc == NULL)
     {
       logmsg(LOG_ERR, "Could not allocate PCI structs");
+      dynlib_unload(&dynlib_pci);
       return -1;
     }
 
   pci_init(pacc);
   pci_scan_bus(pacc);
 
-  card = 0;
+  device = 0;
   /* Iterate over all devices */
   for(dev = pacc->devices; dev; dev = dev->next)
     {
@@ -328,24 +352,45 @@ gma950_backlight_probe(void)
 	  && ((dev->device_id == PCI_ID_PRODUCT_GMA950)
 	      || (dev->device_id == PCI_ID_PRODUCT_GMA965)))
 	{
-	  card = dev->device_id;
+	  device = dev->device_id;
 
-	  ret = snprintf(sysfs_resource, sizeof(sysfs_resource),
-			 "/sys/bus/pci/devices/%04x:%02x:%02x.%1x/resource0",
-			 dev->domain, dev->bus, dev->dev, dev->func);
+	  snprintf(slot, size, "%04x:%02x:%02x.%1x",
+		   dev->domain, dev->bus, dev->dev, dev->func);
 
 	  break;
 	}
     }
 
   pci_cleanup(pacc);
+  dynlib_unload(&dynlib_pci);
 
   if (!dev)
+    return -1;
+
+  probecache_set("pci.gma950", slot);
+
+  return device;
+}
+
+int
+gma950_backlight_probe(void)
+{
+  struct stat stbuf;
+  char slot[16];
+
+  int card;
+  int ret;
+
+  card = gma950_backlight_find(slot, sizeof(slot));
+  if (card < 0)
     {
       logdebug("Failed to detect Intel GMA950 or GMA965, aborting...\n");
       return -1;
     }
 
+  ret = snprintf(sysfs_resource, sizeof(sysfs_resource),
+		 "/sys/bus/pci/devices/%s/resource0", slot);
+
   /* Check snprintf() return value */
   if (ret >= sizeof(sysfs_resource))
     {
@@ -35,6 +35,7 @@
 #include "../evloop.h"
 #include "../conffile.h"
 #include "../kbd_backlight.h"
+#include "../actuator.h"
 
 struct _kbd_bck_info kbd_bck_info;
 
@@ -70,7 +71,7 @@ kbd_backlight_open(int flags)
 
 
 static int
-kbd_backlight_get(void)
+kbd_backlight_read(void)
 {
   int fd;
   int ret;
@@ -99,32 +100,58 @@ kbd_backlight_get(void)
   return ret;
 }
 
-static void
-kbd_backlight_set(int val, int who)
+/* While a write is queued, the hardware lags behind our own state */
+static int
+kbd_backlight_get(void)
 {
-  int curval;
+  if (actuator_busy(ACT_KBD))
+    return kbd_bck_info.level;
 
-  int i;
-  float fadeval;
-  float step;
-  struct timespec fade_step;
+  return kbd_backlight_read();
+}
 
+static int
+kbd_backlight_write_value(int val)
+{
   int fd;
   FILE *fp;
 
-  if (kbd_bck_info.inhibit & ~KBD_INHIBIT_CFG)
-    return;
+  fd = kbd_backlight_open(O_WRONLY);
+  if (fd < 0)
+    return -1;
 
-  curval = kbd_backlight_get();
+  fp = fdopen(fd, "a");
+  if (fp == NULL)
+    {
+      logmsg(LOG_WARNING, "Could not fdopen backlight fd %d: %s", fd, strerror(errno));
+      close(fd);
+      return -1;
+    }
 
-  if (val == curval)
-    return;
+  fprintf(fp, "%d", val);
 
-  if ((val < KBD_BACKLIGHT_OFF) || (val > KBD_BACKLIGHT_MAX))
-    return;
+  fclose(fp);
+
+  return 0;
+}
+
+/* Runs on the actuator thread; the fade is abandoned if a newer value comes in */
+static void
+kbd_backlight_write(int val, int who)
+{
+  int curval;
+
+  int i;
+  float fadeval;
+  float step;
+  struct timespec fade_step;
 
   if (who == KBD_AUTO)
     {
+      curval = kbd_backlight_read();
+      if (curval < 0)
+	curval = val;
+
       fade_step.tv_sec = 0;
       fade_step.tv_nsec = (KBD_BACKLIGHT_FADE_LENGTH / KBD_BACKLIGHT_FADE_STEPS) * 1000000;
 
@@ -133,47 +160,43 @@ kbd_backlight_set(int val, int who)
 
       for (i = 0; i < KBD_BACKLIGHT_FADE_STEPS; i++)
 	{
+	  if (actuator_superseded(ACT_KBD))
+	    return;
+
 	  fadeval += step;
 
-	  fd = kbd_backlight_open(O_WRONLY);
-	  if (fd < 0)
+	  if (kbd_backlight_write_value((int)fadeval) < 0)
 	    continue;
 
-	  fp = fdopen(fd, "a");
-	  if (fp == NULL)
-	    {
-	      logmsg(LOG_WARNING, "Could not fdopen backlight fd: %s", strerror(errno));
-	      close(fd);
-	      continue;
-	    }
-
-	  fprintf(fp, "%d", (int)fadeval);
-
-	  fclose(fp);
-
 	  logdebug("KBD backlight value faded to %d\n", (int)fadeval);
 
 	  nanosleep(&fade_step, NULL);
 	}
     }
 
-  fd = kbd_backlight_open(O_WRONLY);
-  if (fd < 0)
+  if (kbd_backlight_write_value(val) < 0)
     return;
 
-  fp = fdopen(fd, "a");
-  if (fp == NULL)
-    {
-      logmsg(LOG_WARNING, "Could not fdopen backlight fd %d: %s", fd, strerror(errno));
-      close(fd);
-      return;
-    }
+  logdebug("KBD backlight value set to %d\n", val);
+}
 
-  fprintf(fp, "%d", val);
+void
+kbd_backlight_set(int val, int who)
+{
+  int curval;
 
-  fclose(fp);
+  if (kbd_bck_info.inhibit & ~KBD_INHIBIT_CFG)
+    return;
 
-  logdebug("KBD backlight value set to %d\n", val);
+  curval = kbd_backlight_get();
+
+  if (val == curval)
+    return;
+
+  if ((val < KBD_BACKLIGHT_OFF) || (val > KBD_BACKLIGHT_MAX))
+    return;
+
+  actuator_submit(ACT_KBD, val, who);
 
   kbd_bck_info.level = val;
 }
@@ -245,12 +268,14 @@ kbd_backlight_init(void)
       return;
     }
 
-  kbd_bck_info.level = kbd_backlight_get();
+  kbd_bck_info.level = kbd_backlight_read();
   if (kbd_bck_info.level < 0)
     kbd_bck_info.level = 0;
 
   kbd_bck_info.max = KBD_BACKLIGHT_MAX;
 
+  actuator_register(ACT_KBD, kbd_backlight_write);
+
   kbd_auto_init();
 }
 
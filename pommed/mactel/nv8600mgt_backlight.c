@@ -45,6 +45,7 @@
 #include "../pommed.h"
 #include "../conffile.h"
 #include "../lcd_backlight.h"
+#include "../actuator.h"
 
 
 static int nv8600mgt_inited = 0;
@@ -77,6 +78,23 @@ nv8600mgt_backlight_set(unsigned char value)
   outb(0xbf, bl_port);
 }
 
+/* Runs on the actuator thread */
+static void
+nv8600mgt_backlight_write(int value, int arg)
+{
+  nv8600mgt_backlight_set((unsigned char)value);
+}
+
+/* Don't touch the ports while the actuator thread may be using them */
+static int
+nv8600mgt_backlight_current(void)
+{
+  if (actuator_busy(ACT_LCD))
+    return lcd_bck_info.level;
+
+  return nv8600mgt_backlight_get();
+}
+
 
 void
 nv8600mgt_backlight_step(int dir)
@@ -87,7 +105,7 @@ nv8600mgt_backlight_step(int dir)
   if (nv8600mgt_inited == 0)
     return;
 
-  val = nv8600mgt_backlight_get();
+  val = nv8600mgt_backlight_current();
 
   if (dir == STEP_UP)
     {
@@ -110,7 +128,7 @@ nv8600mgt_backlight_step(int dir)
   else
     return;
 
-  nv8600mgt_backlight_set((unsigned char)newval);
+  actuator_submit(ACT_LCD, newval, 0);
 
   lcd_bck_info.level = newval;
 }
@@ -126,7 +144,7 @@ nv8600mgt_backlight_toggle(int lvl)
   if (nv8600mgt_inited == 0)
     return;
 
-  val = nv8600mgt_backlight_get();
+  val = nv8600mgt_backlight_current();
   if (val != lcd_bck_info.level)
     {
       lcd_bck_info.level = val;
@@ -143,7 +161,7 @@ nv8600mgt_backlight_toggle(int lvl)
 
 	logdebug("LCD switching to AC level\n");
 
-	nv8600mgt_backlight_set(lcd_bck_info.ac_lvl);
+	actuator_submit(ACT_LCD, lcd_bck_info.ac_lvl, 0);
 
 	lcd_bck_info.level = lcd_bck_info.ac_lvl;
 	break;
@@ -156,7 +174,7 @@ nv8600mgt_backlight_toggle(int lvl)
 
 	lcd_bck_info.ac_lvl = lcd_bck_info.level;
 
-	nv8600mgt_backlight_set(lcd_nv8600mgt_cfg.on_batt);
+	actuator_submit(ACT_LCD, lcd_nv8600mgt_cfg.on_batt, 0);
 
 	lcd_bck_info.level = lcd_nv8600mgt_cfg.on_batt;
 	break;
@@ -170,25 +188,14 @@ nv8600mgt_backlight_probe(void)
   int ret;
 
   /* Determine backlight I/O port */
-  switch (mops->type)
+  if (mops->caps & MACHINE_CAP_NV8600_B2)
+    bl_port = 0xb2; /* 0xb2 - 0xb3 */
+  else if (mops->caps & MACHINE_CAP_NV8600_52E)
+    bl_port = 0x52e; /* 0x52e - 0x52f */
+  else
     {
-      case MACHINE_MACBOOKPRO_3:
-      case MACHINE_MACBOOKPRO_4:
-	bl_port = 0xb2; /* 0xb2 - 0xb3 */
-	break;
-
-      case MACHINE_MACBOOKPRO_5:
-      case MACHINE_MACBOOKPRO_6:
-      case MACHINE_MACBOOK_5:
-      case MACHINE_MACBOOK_6:
-      case MACHINE_MACBOOKAIR_2:
-      case MACHINE_MACBOOKAIR_3:
-	bl_port = 0x52e; /* 0x52e - 0x52f */
-	break;
-
-      default:
-	logmsg(LOG_ERR, "nv8600mgt LCD backlight support not supported on this hardware");
-	return -1;
+      logmsg(LOG_ERR, "nv8600mgt LCD backlight support not supported on this hardware");
+      return -1;
     }
 
   lcd_bck_info.max = NV8600MGT_BACKLIGHT_MAX;
@@ -205,6 +212,8 @@ nv8600mgt_backlight_probe(void)
 
   nv8600mgt_inited = 1;
 
+  actuator_register(ACT_LCD, nv8600mgt_backlight_write);
+
   /*
    * Set the initial backlight level
    * The value has been sanity checked already
@@ -42,6 +42,8 @@
 #include "../pommed.h"
 #include "../conffile.h"
 #include "../lcd_backlight.h"
+#include "../probecache.h"
+#include "../dynlib_pci.h"
 
 
 static int fd = -1;
@@ -229,20 +231,39 @@ x1600_backlight_toggle(int lvl)
 #define PCI_ID_VENDOR_ATI        0x1002
 #define PCI_ID_PRODUCT_X1600     0x71c5
 
-/* Look for an ATI Radeon Mobility X1600 */
-int
-x1600_backlight_probe(void)
+/*
+ * Look for an ATI Radeon Mobility X1600; returns its PCI slot, from the
+ * probe cache or a bus scan
+ */
+static int
+x1600_backlight_find(char *slot, int size)
 {
   struct pci_access *pacc;
   struct pci_dev *dev;
-  struct stat stbuf;
+  const char *cached;
+  unsigned int vendor;
+  unsigned int device;
+
+  cached = probecache_get("pci.x1600");
+  if ((cached != NULL)
+      && (probecache_pci_id(cached, &vendor, &device) == 0)
+      && (vendor == PCI_ID_VENDOR_ATI)
+      && (device == PCI_ID_PRODUCT_X1600))
+    {
+      snprintf(slot, size, "%s", cached);
 
-  int ret;
+      return 0;
+    }
+
+  /* libpci is only needed for the bus scan */
+  if (dynlib_load(&dynlib_pci) < 0)
+    return -1;
 
   pacc = pci_alloc();
   if (pacc == NULL)
     {
       logmsg(LOG_ERR, "Could not allocate PCI structs");
+      dynlib_unload(&dynlib_pci);
       return -1;
     }
 
@@ -257,22 +278,42 @@ x1600_backlight_probe(void)
       if ((dev->vendor_id == PCI_ID_VENDOR_ATI)
 	  && (dev->device_id == PCI_ID_PRODUCT_X1600))
 	{
-	  ret = snprintf(sysfs_resource, sizeof(sysfs_resource),
-			 "/sys/bus/pci/devices/%04x:%02x:%02x.%1x/resource2",
-			 dev->domain, dev->bus, dev->dev, dev->func);
+	  snprintf(slot, size, "%04x:%02x:%02x.%1x",
+		   dev->domain, dev->bus, dev->dev, dev->func);
 
 	  break;
 	}
     }
 
   pci_cleanup(pacc);
+  dynlib_unload(&dynlib_pci);
 
   if (!dev)
+    return -1;
+
+  probecache_set("pci.x1600", slot);
+
+  return 0;
+}
+
+int
+x1600_backlight_probe(void)
+{
+  struct stat stbuf;
+  char slot[16];
+
+  int ret;
+
+  ret = x1600_backlight_find(slot, sizeof(slot));
+  if (ret < 0)
     {
       logdebug("Failed to detect ATI X1600, aborting...\n");
       return -1;
     }
 
+  ret = snprintf(sysfs_resource, sizeof(sysfs_resource),
+		 "/sys/bus/pci/devices/%s/resource2", slot);
+
   /* Check snprintf() return value */
   if (ret >= sizeof(sysfs_resource))
     {
@@ -0,0 +1,126 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Test build only (make MALLOC_CHECK=1): once armed, any heap allocation
+ * made by the event loop thread aborts the daemon, so a regression in the
+ * fixed pools shows up right away instead of as a slow growth over months.
+ *
+ * Other threads (the beep thread, the eject worker, ALSA internals) are
+ * allowed to allocate. Run in the foreground: syslog() allocates.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include "memcheck.h"
+
+
+/* glibc's own entry points, what ours forward to */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static volatile int armed;
+static pthread_t armed_thread;
+
+
+static void
+memcheck_trip(const char *fn)
+{
+  static const char msg[] = "pommed: heap allocation in the event loop: ";
+
+  if (!armed || !pthread_equal(pthread_self(), armed_thread))
+    return;
+
+  /* No stdio, it may allocate */
+  write(STDERR_FILENO, msg, sizeof(msg) - 1);
+  write(STDERR_FILENO, fn, strlen(fn));
+  write(STDERR_FILENO, "()\n", 3);
+
+  abort();
+}
+
+void *
+malloc(size_t size)
+{
+  memcheck_trip("malloc");
+
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+  memcheck_trip("calloc");
+
+  return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  memcheck_trip("realloc");
+
+  return __libc_realloc(ptr, size);
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+  memcheck_trip("memalign");
+
+  return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  void *ptr;
+
+  memcheck_trip("posix_memalign");
+
+  ptr = __libc_memalign(alignment, size);
+  if (ptr == NULL)
+    return ENOMEM;
+
+  *memptr = ptr;
+
+  return 0;
+}
+
+
+void
+memcheck_arm(void)
+{
+  armed_thread = pthread_self();
+  armed = 1;
+}
+
+void
+memcheck_disarm(void)
+{
+  armed = 0;
+}
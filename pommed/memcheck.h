@@ -0,0 +1,21 @@
+/*
+ * pommed - memcheck.h
+ */
+
+#ifndef __MEMCHECK_H__
+#define __MEMCHECK_H__
+
+
+#ifdef MALLOC_CHECK
+void
+memcheck_arm(void);
+
+void
+memcheck_disarm(void);
+#else
+# define memcheck_arm()
+# define memcheck_disarm()
+#endif /* MALLOC_CHECK */
+
+
+#endif /* !__MEMCHECK_H__ */
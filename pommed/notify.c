@@ -0,0 +1,252 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Service manager notifications (the sd_notify protocol): datagrams of
+ * VAR=value lines sent to the socket named in NOTIFY_SOCKET.
+ *
+ * If a watchdog is requested, the pings are sent from an event loop
+ * timer at half the watchdog period, so a wedged loop stops them and
+ * gets the daemon restarted. A ping that comes in late tells how long
+ * the loop was stuck; that's logged and shown in the service status.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pommed.h"
+#include "evloop.h"
+#include "notify.h"
+
+
+static int notify_fd = -1;
+static struct sockaddr_un notify_addr;
+static socklen_t notify_addrlen;
+
+/* Last status, stall reports are appended to it */
+static char notify_status_msg[256];
+
+static int wd_timer = -1;
+static int wd_interval;  /* ms */
+static struct timespec wd_last;
+
+
+static int
+notify_send(const char *msg)
+{
+  int ret;
+
+  if (notify_fd < 0)
+    return 0;
+
+  ret = sendto(notify_fd, msg, strlen(msg), MSG_NOSIGNAL | MSG_DONTWAIT,
+	       (struct sockaddr *)&notify_addr, notify_addrlen);
+  if (ret < 0)
+    {
+      logdebug("Could not notify the service manager: %s\n", strerror(errno));
+
+      return -1;
+    }
+
+  return 0;
+}
+
+int
+notify_status(const char *fmt, ...)
+{
+  char msg[sizeof(notify_status_msg) + 8];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(notify_status_msg, sizeof(notify_status_msg), fmt, ap);
+  va_end(ap);
+
+  snprintf(msg, sizeof(msg), "STATUS=%s", notify_status_msg);
+
+  return notify_send(msg);
+}
+
+/* NULL keeps the current status, after a reload */
+int
+notify_ready(const char *status)
+{
+  char msg[sizeof(notify_status_msg) + 16];
+
+  if (status != NULL)
+    snprintf(notify_status_msg, sizeof(notify_status_msg), "%s", status);
+
+  snprintf(msg, sizeof(msg), "READY=1\nSTATUS=%s", notify_status_msg);
+
+  return notify_send(msg);
+}
+
+int
+notify_reloading(void)
+{
+  return notify_send("RELOADING=1");
+}
+
+int
+notify_stopping(void)
+{
+  return notify_send("STOPPING=1");
+}
+
+
+static void
+notify_watchdog(int id, uint64_t ticks)
+{
+  struct timespec now;
+  char msg[sizeof(notify_status_msg) + 80];
+  long late;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  late = (now.tv_sec - wd_last.tv_sec) * 1000 + (now.tv_nsec - wd_last.tv_nsec) / 1000000;
+  late -= wd_interval;
+
+  wd_last = now;
+
+  if (late <= (wd_interval * NOTIFY_STALL_PERCENT) / 100)
+    {
+      notify_send("WATCHDOG=1");
+
+      return;
+    }
+
+  logmsg(LOG_WARNING, "Event loop stalled, watchdog ping %ld ms late", late);
+
+  snprintf(msg, sizeof(msg), "WATCHDOG=1\nSTATUS=%s (event loop stalled for %ld ms)",
+	   notify_status_msg, late);
+
+  notify_send(msg);
+}
+
+static void
+notify_watchdog_init(void)
+{
+  char *usec;
+  char *pid;
+  long long val;
+
+  usec = getenv("WATCHDOG_USEC");
+  pid = getenv("WATCHDOG_PID");
+
+  /* Not meant for us */
+  if ((pid != NULL) && (strtol(pid, NULL, 10) != getpid()))
+    return;
+
+  if (usec == NULL)
+    return;
+
+  val = strtoll(usec, NULL, 10);
+  if (val <= 0)
+    return;
+
+  wd_interval = val / 2000;
+  if (wd_interval < 1)
+    wd_interval = 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &wd_last);
+
+  wd_timer = evloop_add_timer(wd_interval, notify_watchdog);
+  if (wd_timer < 0)
+    {
+      logmsg(LOG_WARNING, "Could not set up the watchdog timer");
+
+      wd_timer = -1;
+
+      return;
+    }
+
+  logdebug("Watchdog ping every %d ms\n", wd_interval);
+}
+
+int
+notify_init(void)
+{
+  char *path;
+  size_t len;
+
+  path = getenv("NOTIFY_SOCKET");
+  if (path == NULL)
+    return 0;
+
+  len = strlen(path);
+  if (((path[0] != '/') && (path[0] != '@')) || (len < 2) || (len >= sizeof(notify_addr.sun_path)))
+    {
+      logmsg(LOG_WARNING, "Invalid NOTIFY_SOCKET %s", path);
+
+      return -1;
+    }
+
+  memset(&notify_addr, 0, sizeof(notify_addr));
+  notify_addr.sun_family = AF_UNIX;
+  memcpy(notify_addr.sun_path, path, len);
+
+  /* Abstract namespace */
+  if (path[0] == '@')
+    notify_addr.sun_path[0] = '\0';
+
+  notify_addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+
+  notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (notify_fd < 0)
+    {
+      logmsg(LOG_WARNING, "Could not create notification socket: %s", strerror(errno));
+
+      return -1;
+    }
+
+  notify_watchdog_init();
+
+  /* Keep the hooks from talking to the service manager on our behalf */
+  unsetenv("NOTIFY_SOCKET");
+  unsetenv("WATCHDOG_USEC");
+  unsetenv("WATCHDOG_PID");
+
+  return 0;
+}
+
+void
+notify_cleanup(void)
+{
+  if (wd_timer > 0)
+    evloop_remove_timer(wd_timer);
+
+  wd_timer = -1;
+
+  if (notify_fd >= 0)
+    close(notify_fd);
+
+  notify_fd = -1;
+}
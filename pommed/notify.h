@@ -0,0 +1,32 @@
+/*
+ * pommed - notify.h
+ */
+
+#ifndef __NOTIFY_H__
+#define __NOTIFY_H__
+
+
+/* Loop stalls longer than this fraction of the ping interval are reported */
+#define NOTIFY_STALL_PERCENT   50
+
+
+int
+notify_status(const char *fmt, ...);
+
+int
+notify_ready(const char *status);
+
+int
+notify_reloading(void);
+
+int
+notify_stopping(void);
+
+int
+notify_init(void);
+
+void
+notify_cleanup(void);
+
+
+#endif /* !__NOTIFY_H__ */
@@ -43,6 +43,8 @@
 #include "../evloop.h"
 #include "../conffile.h"
 #include "../kbd_backlight.h"
+#include "../actuator.h"
+#include "../probecache.h"
 
 
 #define SYSFS_I2C_BASE      "/sys/class/i2c-dev"
@@ -52,6 +54,9 @@
 struct _lmu_info lmu_info;
 struct _kbd_bck_info kbd_bck_info;
 
+/* Last value written to the hardware, only touched by the writers */
+static int kbd_hw_level;
+
 
 static int
 kbd_backlight_get(void)
@@ -83,8 +88,9 @@ lmu_write_kbd_value(int fd, unsigned char val)
     logmsg(LOG_ERR, "Could not set LMU kbd brightness: %s", strerror(errno));
 }
 
+/* Runs on the actuator thread */
 static void
-kbd_lmu_backlight_set(int val, int who)
+kbd_lmu_backlight_write(int val, int who)
 {
   int curval;
 
@@ -96,19 +102,10 @@ kbd_lmu_backlight_set(int val, int who)
   int fd;
   int ret;
 
-  if (kbd_bck_info.inhibit & ~KBD_INHIBIT_CFG)
-    return;
-
   if (lmu_info.lmuaddr == 0)
     return;
 
-  curval = kbd_backlight_get();
-
-  if (val == curval)
-    return;
-
-  if ((val < KBD_BACKLIGHT_OFF) || (val > KBD_BACKLIGHT_MAX))
-    return;
+  curval = kbd_hw_level;
 
   fd = open(lmu_info.i2cdev, O_RDWR);
   if (fd < 0)
@@ -137,9 +134,16 @@ kbd_lmu_backlight_set(int val, int who)
 
       for (i = 0; i < KBD_BACKLIGHT_FADE_STEPS; i++)
 	{
+	  if (actuator_superseded(ACT_KBD))
+	    {
+	      close(fd);
+	      return;
+	    }
+
 	  fadeval += step;
 
 	  lmu_write_kbd_value(fd, (unsigned char)fadeval);
+	  kbd_hw_level = (int)fadeval;
 
 	  logdebug("KBD backlight value faded to %d\n", (int)fadeval);
 
@@ -151,7 +155,7 @@ kbd_lmu_backlight_set(int val, int who)
 
   close(fd);
 
-  kbd_bck_info.level = val;
+  kbd_hw_level = val;
 }
 
 
@@ -181,8 +185,9 @@ adb_write_kbd_value(int fd, unsigned char val)
     }
 }
 
+/* Runs on the actuator thread */
 static void
-kbd_pmu_backlight_set(int val, int who)
+kbd_pmu_backlight_write(int val, int who)
 {
   int curval;
 
@@ -193,16 +198,7 @@ kbd_pmu_backlight_set(int val, int who)
 
   int fd;
 
-  if (kbd_bck_info.inhibit & ~KBD_INHIBIT_CFG)
-    return;
-
-  curval = kbd_backlight_get();
-
-  if (val == curval)
-    return;
-
-  if ((val < KBD_BACKLIGHT_OFF) || (val > KBD_BACKLIGHT_MAX))
-    return;
+  curval = kbd_hw_level;
 
   fd = open(ADB_DEVICE, O_RDWR);
   if (fd < 0)
@@ -222,9 +218,16 @@ kbd_pmu_backlight_set(int val, int who)
 
       for (i = 0; i < KBD_BACKLIGHT_FADE_STEPS; i++)
 	{
+	  if (actuator_superseded(ACT_KBD))
+	    {
+	      close(fd);
+	      return;
+	    }
+
 	  fadeval += step;
 
 	  adb_write_kbd_value(fd, (unsigned char)fadeval);
+	  kbd_hw_level = (int)fadeval;
 
 	  logdebug("KBD backlight value faded to %d\n", (int)fadeval);
 
@@ -236,21 +239,28 @@ kbd_pmu_backlight_set(int val, int who)
 
   close(fd);
 
-  kbd_bck_info.level = val;
+  kbd_hw_level = val;
 }
 
-static void
+void
 kbd_backlight_set(int val, int who)
 {
-  if ((mops->type == MACHINE_POWERBOOK_58)
-      || (mops->type == MACHINE_POWERBOOK_59))
-    {
-      kbd_pmu_backlight_set(val, who);
-    }
-  else
-    {
-      kbd_lmu_backlight_set(val, who);
-    }
+  int curval;
+
+  if (kbd_bck_info.inhibit & ~KBD_INHIBIT_CFG)
+    return;
+
+  curval = kbd_backlight_get();
+
+  if (val == curval)
+    return;
+
+  if ((val < KBD_BACKLIGHT_OFF) || (val > KBD_BACKLIGHT_MAX))
+    return;
+
+  actuator_submit(ACT_KBD, val, who);
+
+  kbd_bck_info.level = val;
 }
 
 
@@ -317,8 +327,7 @@ kbd_backlight_init(void)
   kbd_bck_info.auto_on = 0;
 
   if (!has_kbd_backlight()
-      || (mops->type == MACHINE_POWERBOOK_58)
-      || (mops->type == MACHINE_POWERBOOK_59))
+      || (mops->caps & MACHINE_CAP_KBD_PMU))
     {
       /* Nothing to probe for the PMU05 machines */
       ret = 0;
@@ -343,8 +352,15 @@ kbd_backlight_init(void)
   if (kbd_bck_info.level < 0)
     kbd_bck_info.level = 0;
 
+  kbd_hw_level = kbd_bck_info.level;
+
   kbd_bck_info.max = KBD_BACKLIGHT_MAX;
 
+  if (mops->caps & MACHINE_CAP_KBD_PMU)
+    actuator_register(ACT_KBD, kbd_pmu_backlight_write);
+  else
+    actuator_register(ACT_KBD, kbd_lmu_backlight_write);
+
   kbd_auto_init();
 }
 
@@ -474,21 +490,14 @@ kbd_get_lmuaddr(void)
   return 0;
 }
 
+/* Check the LMU answers at the address and on the adapter we found */
 static int
-kbd_probe_lmu(void)
+kbd_check_lmu(void)
 {
   int fd;
   int ret;
   char buffer[4];
 
-  ret = kbd_get_lmuaddr();
-  if (ret < 0)
-    return -1;
-
-  ret = kbd_get_i2cdev();
-  if (ret < 0)
-    return -1;
-
   fd = open(lmu_info.i2cdev, O_RDWR);
   if (fd < 0)
     {
@@ -520,3 +529,56 @@ kbd_probe_lmu(void)
 
   return 0;
 }
+
+/* Address and adapter from the probe cache, "<address> <device>" */
+static int
+kbd_cached_lmu(void)
+{
+  const char *cached;
+  const char *dev;
+  char *end;
+
+  cached = probecache_get("lmu");
+  if (cached == NULL)
+    return -1;
+
+  lmu_info.lmuaddr = strtoul(cached, &end, 16);
+
+  dev = end;
+  if ((*dev != ' ') || (strncmp(dev + 1, "/dev/i2c-", 9) != 0))
+    return -1;
+
+  snprintf(lmu_info.i2cdev, sizeof(lmu_info.i2cdev), "%s", dev + 1);
+
+  logdebug("Cached LMU controller at address 0x%x on %s\n", lmu_info.lmuaddr, lmu_info.i2cdev);
+
+  return 0;
+}
+
+static int
+kbd_probe_lmu(void)
+{
+  char buf[PROBECACHE_VALUE_LEN];
+  int ret;
+
+  /* Skips the device-tree walk and the i2c adapters scan */
+  if ((kbd_cached_lmu() == 0) && (kbd_check_lmu() == 0))
+    return 0;
+
+  ret = kbd_get_lmuaddr();
+  if (ret < 0)
+    return -1;
+
+  ret = kbd_get_i2cdev();
+  if (ret < 0)
+    return -1;
+
+  ret = kbd_check_lmu();
+  if (ret < 0)
+    return -1;
+
+  snprintf(buf, sizeof(buf), "%x %s", lmu_info.lmuaddr, lmu_info.i2cdev);
+  probecache_set("lmu", buf);
+
+  return 0;
+}
@@ -18,7 +18,9 @@
  */
 
 #include <stdio.h>
+#include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #include "../pommed.h"
@@ -35,30 +37,25 @@
 int
 procfs_check_ac_state(void)
 {
-  FILE *fp;
+  int fd;
   char buf[128];
   char *ac_state;
   int ret;
 
-  fp = fopen(PROC_PMU_AC_STATE_FILE, "r");
-  if (fp == NULL)
+  fd = open(PROC_PMU_AC_STATE_FILE, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
     return AC_STATE_ERROR;
 
-  ret = fread(buf, 1, 127, fp);
-
-  if (ferror(fp) != 0)
+  ret = read(fd, buf, sizeof(buf) - 1);
+  if (ret < 0)
     {
       logdebug("pmu: Error reading AC state: %s\n", strerror(errno));
-      return AC_STATE_ERROR;
-    }
 
-  if (feof(fp) == 0)
-    {
-      logdebug("pmu: Error reading AC state: buffer too small\n");
+      close(fd);
       return AC_STATE_ERROR;
     }
 
-  fclose(fp);
+  close(fd);
 
   buf[ret] = '\0';
 
@@ -29,6 +29,8 @@
 #include <signal.h>
 
 #include <sys/utsname.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
 
 #include <syslog.h>
 #include <stdarg.h>
@@ -53,420 +55,106 @@
 #include "audio.h"
 #include "power.h"
 #include "beep.h"
+#include "actuator.h"
+#include "hooks.h"
+#include "control.h"
+#include "statefile.h"
+#include "probecache.h"
+#include "startup.h"
+#include "notify.h"
+#include "latency.h"
+#include "memcheck.h"
 
 
 /* Machine-specific operations */
 struct machine_ops *mops;
 
+static struct machine_ops machine_ops;
 
-/* --- WARNING ---
- *
- * Be extra-careful here, the list below must come in the same
- * order as the machine_type enum in pommed.h !
- */
-#ifdef __powerpc__
-/* PowerBook machines */
-
-struct machine_ops pb_mops[] = {
-  /* PowerBook3,1 is a G3-based PowerBook */
-
-  {  /* PowerBook3,2 */
-    .type = MACHINE_POWERBOOK_32,
-    .lcd_backlight_probe = aty128_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step_kernel,
-    .lcd_backlight_toggle = sysfs_backlight_toggle_kernel,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook3,3 */
-    .type = MACHINE_POWERBOOK_33,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook3,4 */
-    .type = MACHINE_POWERBOOK_34,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook3,5 */
-    .type = MACHINE_POWERBOOK_35,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  /* PowerBook4,* -> G3 iBooks */
-
-  {  /* PowerBook5,1 */
-    .type = MACHINE_POWERBOOK_51,
-    .lcd_backlight_probe = nvidia_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook5,2 */
-    .type = MACHINE_POWERBOOK_52,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook5,3 */
-    .type = MACHINE_POWERBOOK_53,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook5,4 */
-    .type = MACHINE_POWERBOOK_54,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook5,5 */
-    .type = MACHINE_POWERBOOK_55,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook5,6 */
-    .type = MACHINE_POWERBOOK_56,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_fountain, */
-  },
-
-  {  /* PowerBook5,7 */
-    .type = MACHINE_POWERBOOK_57,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_fountain, */
-  },
-
-  {  /* PowerBook5,8 */
-    .type = MACHINE_POWERBOOK_58,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser, */
-  },
-
-  {  /* PowerBook5,9 */
-    .type = MACHINE_POWERBOOK_59,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser, */
-  },
-
-  /* G4 iBooks & 12" PowerBooks */
-
-  {  /* PowerBook6,1 */
-    .type = MACHINE_POWERBOOK_61,
-    .lcd_backlight_probe = nvidia_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook6,2 */
-    .type = MACHINE_POWERBOOK_62,
-    .lcd_backlight_probe = nvidia_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook6,3 */
-    .type = MACHINE_POWERBOOK_63,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook6,4 */
-    .type = MACHINE_POWERBOOK_64,
-    .lcd_backlight_probe = nvidia_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook6,5 */
-    .type = MACHINE_POWERBOOK_65,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  /* Looks like PowerBook6,6 never made it to the market ? */
-
-  {  /* PowerBook6,7 */
-    .type = MACHINE_POWERBOOK_67,
-    .lcd_backlight_probe = r9x00_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  },
-
-  {  /* PowerBook6,8 */
-    .type = MACHINE_POWERBOOK_68,
-    .lcd_backlight_probe = nvidia_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_adb, */
-  }
+
+struct lcd_backend
+{
+  int (*probe) (void);
+  void (*step) (int dir);
+  void (*toggle) (int lvl);
 };
 
+#ifdef __powerpc__
+enum
+  {
+    LCD_BACKEND_ATY128,
+    LCD_BACKEND_R9X00,
+    LCD_BACKEND_NVIDIA,
+  };
+
+static const struct lcd_backend lcd_backends[] =
+  {
+    [LCD_BACKEND_ATY128] = { aty128_sysfs_backlight_probe, sysfs_backlight_step_kernel, sysfs_backlight_toggle_kernel },
+    [LCD_BACKEND_R9X00] = { r9x00_sysfs_backlight_probe, sysfs_backlight_step, sysfs_backlight_toggle },
+    [LCD_BACKEND_NVIDIA] = { nvidia_sysfs_backlight_probe, sysfs_backlight_step, sysfs_backlight_toggle },
+  };
 #else
+enum
+  {
+    LCD_BACKEND_X1600,
+    LCD_BACKEND_GMA950,
+    LCD_BACKEND_MBP_SYSFS,
+  };
+
+static const struct lcd_backend lcd_backends[] =
+  {
+    [LCD_BACKEND_X1600] = { x1600_backlight_probe, x1600_backlight_step, x1600_backlight_toggle },
+    [LCD_BACKEND_GMA950] = { gma950_backlight_probe, gma950_backlight_step, gma950_backlight_toggle },
+    [LCD_BACKEND_MBP_SYSFS] = { mbp_sysfs_backlight_probe, sysfs_backlight_step, sysfs_backlight_toggle },
+  };
+#endif /* __powerpc__ */
 
-struct machine_ops mb_mops[] = {
-  /* MacBook Pro machines */
-
-  {  /* MacBookPro1,1 / MacBookPro1,2 (Core Duo) */
-    .type = MACHINE_MACBOOKPRO_1,
-    .lcd_backlight_probe = x1600_backlight_probe,
-    .lcd_backlight_step = x1600_backlight_step,
-    .lcd_backlight_toggle = x1600_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser3, */
-  },
-
-  {  /* MacBookPro2,1 / MacBookPro2,2 (Core2 Duo) */
-    .type = MACHINE_MACBOOKPRO_2,
-    .lcd_backlight_probe = x1600_backlight_probe,
-    .lcd_backlight_step = x1600_backlight_step,
-    .lcd_backlight_toggle = x1600_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser4, */
-  },
-
-  {  /* MacBookPro3,1 (15" & 17", Core2 Duo, June 2007) */
-    .type = MACHINE_MACBOOKPRO_3,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser4, */
-  },
-
-  {  /* MacBookPro4,1 (15" & 17", Core2 Duo, February 2008) */
-    .type = MACHINE_MACBOOKPRO_4,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring2, */
-  },
-
-  {  /* MacBookPro5,1 (15" & 17", Core2 Duo, October 2008)
-      * MacBookPro5,2 (17" June 2009)
-      * MacBookPro5,3 (15" June 2009)
-      * MacBookPro5,4 (15" June 2009)
-      * MacBookPro5,5 (13" June 2009) */
-    .type = MACHINE_MACBOOKPRO_5,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring3, */
-  },
-
-  {  /* MacBookPro6,1 (17", Core i5/i7, April 2010)
-      * MacBookPro6,2 (15", Core i5/i7, April 2010) */
-    .type = MACHINE_MACBOOKPRO_6,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring3, */
-  },
-
-  {  /* MacBookPro7,1 (13", Core2 Duo, April 2010) */
-    .type = MACHINE_MACBOOKPRO_7,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring3, */
-  },
-
-  {  /* MacBookPro8,1 (13", Early 2011)
-      * MacBookPro8,2 (15", Early 2011)
-      * MacBookPro8,3 (17", Early 2011)
-      */
-    .type = MACHINE_MACBOOKPRO_8,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring5, */
-  },
-
-  { /* MacBookPro9,1 (15", Mid 2012)
-     * MacBookPro9,2 (13", Mid 2012)
-     */
-    .type = MACHINE_MACBOOKPRO_9,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-  },
-
-  {  /* MacBookPro10,2 (13", Late 2012)
-      */
-    .type = MACHINE_MACBOOKPRO_10,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring5, */
-  },
-
-  {  /* MacBookPro11,1 (13", Late 2013)
-      * MacBookPro11,2 (13", Late 2013)
-      * MacBookPro11,3 (15", Late 2013)
-      */
-    .type = MACHINE_MACBOOKPRO_11,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring6, */
-  },
-
-  {  /* MacBookPro12,1 (13", Early 2015)
-      */
-    .type = MACHINE_MACBOOKPRO_12,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring9, */
-  },
-
-  /* MacBook machines */
-
-  {  /* MacBook1,1 (Core Duo) */
-    .type = MACHINE_MACBOOK_1,
-    .lcd_backlight_probe = gma950_backlight_probe,
-    .lcd_backlight_step = gma950_backlight_step,
-    .lcd_backlight_toggle = gma950_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser3, */
-  },
-
-  {  /* MacBook2,1 (Core2 Duo) */
-    .type = MACHINE_MACBOOK_2,
-    .lcd_backlight_probe = gma950_backlight_probe,
-    .lcd_backlight_step = gma950_backlight_step,
-    .lcd_backlight_toggle = gma950_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser4, */
-  },
-
-  {  /* MacBook3,1 (Core2 Duo Santa Rosa, November 2007) */
-    .type = MACHINE_MACBOOK_3,
-    .lcd_backlight_probe = gma950_backlight_probe, /* gma950 supports the gma965 */
-    .lcd_backlight_step = gma950_backlight_step,
-    .lcd_backlight_toggle = gma950_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser4hf, */
-  },
-
-  {  /* MacBook4,1 (Core2 Duo, February 2008) */
-    .type = MACHINE_MACBOOK_4,
-    .lcd_backlight_probe = gma950_backlight_probe, /* gma950 supports the gma965 */
-    .lcd_backlight_step = gma950_backlight_step,
-    .lcd_backlight_toggle = gma950_backlight_toggle,
-    /* .evdev_identify = evdev_is_geyser4hf, */
-  },
-
-  {  /* MacBook5,1 (Core2 Duo, October 2008) */
-    .type = MACHINE_MACBOOK_5,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring3, */
-  },
-
-  {  /* MacBook6,1 (Core2 Duo, October 2009) */
-    .type = MACHINE_MACBOOK_6,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring3, */
-  },
-
-  {  /* MacBook7,1 (Core2 Duo, April 2010) */
-    .type = MACHINE_MACBOOK_7,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring3, */
-  },
-
-  /* MacBook Air machines */
-
-  {  /* MacBookAir1,1 (January 2008) */
-    .type = MACHINE_MACBOOKAIR_1,
-    .lcd_backlight_probe = gma950_backlight_probe, /* gma950 supports the gma965 */
-    .lcd_backlight_step = gma950_backlight_step,
-    .lcd_backlight_toggle = gma950_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring, */
-  },
-
-  {  /* MacBookAir2,1 (October 2008) */
-    .type = MACHINE_MACBOOKAIR_2,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring3, */
-  },
-
-  {  /* MacBookAir3,1 & 3,2 (October 2010) */
-    .type = MACHINE_MACBOOKAIR_3,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_wellspring4a / evdev_is_wellspring4, */
-  },
-
-  {  /* MacBookAir4,1 & 4,2 (July 2011) */
-    .type = MACHINE_MACBOOKAIR_4,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_2011mba, */
-  },
-
-  {  /* MacBookAir5,1 & 5,2 (June 2012) */
-    .type = MACHINE_MACBOOKAIR_5,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_2012mba, */
-  },
-  {  /* MacBookAir6,1 & 6,2 (Mid 2014) */
-    .type = MACHINE_MACBOOKAIR_6,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_2014mba, */
-  },
-  {  /* MacBookAir7,1 & 7,2 (Early 2015) */
-    .type = MACHINE_MACBOOKAIR_7,
-    .lcd_backlight_probe = mbp_sysfs_backlight_probe,
-    .lcd_backlight_step = sysfs_backlight_step,
-    .lcd_backlight_toggle = sysfs_backlight_toggle,
-    /* .evdev_identify = evdev_is_2015mba, */
-  },
+struct machine_entry
+{
+  const char *model;
+  machine_type type;
+  int lcd;
+  unsigned int caps;
 };
-#endif /* __powerpc__ */
+
+/* Generated from machines.list, sorted by model, see the Makefile */
+static const struct machine_entry machines[] =
+  {
+#include "machines.h"
+  };
+
+
+static int
+machine_compare(const void *key, const void *entry)
+{
+  return strcmp(key, ((const struct machine_entry *)entry)->model);
+}
+
+static machine_type
+machine_lookup(const char *model)
+{
+  const struct machine_entry *m;
+  const struct lcd_backend *lcd;
+
+  m = bsearch(model, machines, sizeof(machines) / sizeof(*machines),
+	      sizeof(*machines), machine_compare);
+  if (m == NULL)
+    return MACHINE_MAC_UNKNOWN;
+
+  lcd = &lcd_backends[m->lcd];
+
+  /* Writable copy, backends may wire up a fallback */
+  machine_ops.type = m->type;
+  machine_ops.caps = m->caps;
+  machine_ops.model = m->model;
+  machine_ops.lcd_backlight_probe = lcd->probe;
+  machine_ops.lcd_backlight_step = lcd->step;
+  machine_ops.lcd_backlight_toggle = lcd->toggle;
+
+  mops = &machine_ops;
+
+  return m->type;
+}
 
 
 /* debug mode */
@@ -536,18 +224,21 @@ kbd_set_fnmode(void)
       "/sys/module/hid/parameters/pb_fnmode",    /* 2.6.20 & up */
       "/sys/module/usbhid/parameters/pb_fnmode"
     };
-  FILE *fp;
+  char buf[4];
+  int fd;
   int i;
 
   if ((general_cfg.fnmode < 1) || (general_cfg.fnmode > 2))
     general_cfg.fnmode = 1;
 
+  /* Also called on hotplug, no stdio here: fopen() allocates */
+  fd = -1;
   for (i = 0; i < sizeof(fnmode_node) / sizeof(*fnmode_node); i++)
     {
       logdebug("Trying %s\n", fnmode_node[i]);
 
-      fp = fopen(fnmode_node[i], "a");
-      if (fp != NULL)
+      fd = open(fnmode_node[i], O_WRONLY | O_APPEND | O_CLOEXEC);
+      if (fd >= 0)
 	break;
 
       if (errno == ENOENT)
@@ -557,15 +248,18 @@ kbd_set_fnmode(void)
       return;
     }
 
-  if (!fp)
+  if (fd < 0)
     {
       logmsg(LOG_INFO, "Could not set fnmode: no sysfs node found!");
       return;
     }
 
-  fprintf(fp, "%d", general_cfg.fnmode);
+  snprintf(buf, sizeof(buf), "%d", general_cfg.fnmode);
 
-  fclose(fp);
+  if (write(fd, buf, strlen(buf)) < 0)
+    logmsg(LOG_INFO, "Could not set fnmode: %s", strerror(errno));
+
+  close(fd);
 }
 
 #ifdef __powerpc__
@@ -628,73 +322,10 @@ check_machine_pmu(void)
 
   logdebug("device-tree model node: [%s]\n", buffer);
 
-  /* PowerBook G4 Titanium 15" (December 2000) */
-  if (strncmp(buffer, "PowerBook3,2", 12) == 0)
-    ret = MACHINE_POWERBOOK_32;
-  /* PowerBook G4 Titanium 15" (October 2001) */
-  else if (strncmp(buffer, "PowerBook3,3", 12) == 0)
-    ret = MACHINE_POWERBOOK_33;
-  /* PowerBook G4 Titanium 15" (April 2002) */
-  else if (strncmp(buffer, "PowerBook3,4", 12) == 0)
-    ret = MACHINE_POWERBOOK_34;
-  /* PowerBook G4 Titanium 15" */
-  else if (strncmp(buffer, "PowerBook3,5", 12) == 0)
-    ret = MACHINE_POWERBOOK_35;
-
-  /* PowerBook G4 Aluminium 17" */
-  else if (strncmp(buffer, "PowerBook5,1", 12) == 0)
-    ret = MACHINE_POWERBOOK_51;
-  /* PowerBook G4 Aluminium 15" (September 2003) */
-  else if (strncmp(buffer, "PowerBook5,2", 12) == 0)
-    ret = MACHINE_POWERBOOK_52;
-  /* PowerBook G4 Aluminium 17" (September 2003) */
-  else if (strncmp(buffer, "PowerBook5,3", 12) == 0)
-    ret = MACHINE_POWERBOOK_53;
-  /* PowerBook G4 Aluminium 15" (April 2004) */
-  else if (strncmp(buffer, "PowerBook5,4", 12) == 0)
-    ret = MACHINE_POWERBOOK_54;
-  /* PowerBook G4 Aluminium 17" (April 2004) */
-  else if (strncmp(buffer, "PowerBook5,5", 12) == 0)
-    ret = MACHINE_POWERBOOK_55;
-  /* PowerBook G4 Aluminium 15" (February 2005) */
-  else if (strncmp(buffer, "PowerBook5,6", 12) == 0)
-    ret = MACHINE_POWERBOOK_56;
-  /* PowerBook G4 Aluminium 17" (February 2005) */
-  else if (strncmp(buffer, "PowerBook5,7", 12) == 0)
-    ret = MACHINE_POWERBOOK_57;
-  /* PowerBook G4 Aluminium 15" */
-  else if (strncmp(buffer, "PowerBook5,8", 12) == 0)
-    ret = MACHINE_POWERBOOK_58;
-  /* PowerBook G4 Aluminium 17" */
-  else if (strncmp(buffer, "PowerBook5,9", 12) == 0)
-    ret = MACHINE_POWERBOOK_59;
-
-  /* PowerBook G4 12" (January 2003) */
-  else if (strncmp(buffer, "PowerBook6,1", 12) == 0)
-    ret = MACHINE_POWERBOOK_61;
-  /* PowerBook G4 12" (September 2003) */
-  else if (strncmp(buffer, "PowerBook6,2", 12) == 0)
-    ret = MACHINE_POWERBOOK_61;
-  /* iBook G4 (October 2003) */
-  else if (strncmp(buffer, "PowerBook6,3", 12) == 0)
-    ret = MACHINE_POWERBOOK_63;
-  /* PowerBook G4 12" (April 2004) */
-  else if (strncmp(buffer, "PowerBook6,4", 12) == 0)
-    ret = MACHINE_POWERBOOK_64;
-  /* iBook G4 (October 2004) */
-  else if (strncmp(buffer, "PowerBook6,5", 12) == 0)
-    ret = MACHINE_POWERBOOK_65;
-  /* iBook G4 */
-  else if (strncmp(buffer, "PowerBook6,7", 12) == 0)
-    ret = MACHINE_POWERBOOK_67;
-  /* PowerBook G4 12" */
-  else if (strncmp(buffer, "PowerBook6,8", 12) == 0)
-    ret = MACHINE_POWERBOOK_68;
-
-  else
+  ret = machine_lookup(buffer);
+  if (ret == MACHINE_MAC_UNKNOWN)
     logmsg(LOG_ERR, "Unknown Apple machine: %s", buffer);
-
-  if (ret != MACHINE_MAC_UNKNOWN)
+  else
     logmsg(LOG_INFO, "PMU machine check: running on a %s", buffer);
 
   return ret;
@@ -785,116 +416,10 @@ check_machine_dmi(void)
 
   logdebug("DMI product name: [%s]\n", buf);
 
-  ret = MACHINE_MAC_UNKNOWN;
-
-  /* Core Duo MacBook Pro 15" (January 2006) & 17" (April 2006) */
-  if ((strcmp(buf, "MacBookPro1,1") == 0) || (strcmp(buf, "MacBookPro1,2") == 0))
-    ret = MACHINE_MACBOOKPRO_1;
-  /* Core2 Duo MacBook Pro 17" & 15" (October 2006) */
-  else if ((strcmp(buf, "MacBookPro2,1") == 0) || (strcmp(buf, "MacBookPro2,2") == 0))
-    ret = MACHINE_MACBOOKPRO_2;
-  /* Core2 Duo MacBook Pro 15" & 17" (June 2007) */
-  else if (strcmp(buf, "MacBookPro3,1") == 0)
-    ret = MACHINE_MACBOOKPRO_3;
-  /* Core2 Duo MacBook Pro 15" & 17" (February 2008) */
-  else if (strcmp(buf, "MacBookPro4,1") == 0)
-    ret = MACHINE_MACBOOKPRO_4;
-  /* Core2 Duo MacBook Pro 15" & 17" (October 2008)
-   * MacBook Pro 17" (June 2009)
-   * MacBook Pro 13" (June 2009) */
-  else if ((strcmp(buf, "MacBookPro5,1") == 0)
-	   || (strcmp(buf, "MacBookPro5,2") == 0)
-	   || (strcmp(buf, "MacBookPro5,3") == 0)
-	   || (strcmp(buf, "MacBookPro5,4") == 0)
-	   || (strcmp(buf, "MacBookPro5,5") == 0))
-    ret = MACHINE_MACBOOKPRO_5;
-  /* Core i5/i7 MacBook Pro 15" & 17" (April 2010) */
-  else if ((strcmp(buf, "MacBookPro6,1") == 0)
-	   || (strcmp(buf, "MacBookPro6,2") == 0))
-    ret = MACHINE_MACBOOKPRO_6;
-  /* Core2 Duo MacBook Pro 13" (April 2010) */
-  else if (strcmp(buf, "MacBookPro7,1") == 0)
-    ret = MACHINE_MACBOOKPRO_7;
-  /* MacBook Pro 13" (Early 2011)
-   * MacBook Pro 15" (Early 2011)
-   * MacBook Pro 17" (Early 2011)
-   */
-  else if ((strcmp(buf, "MacBookPro8,1") == 0)
-	   || (strcmp(buf, "MacBookPro8,2") == 0)
-	   || (strcmp(buf, "MacBookPro8,3") == 0))
-    ret = MACHINE_MACBOOKPRO_8;
-  /* MacBook Pro 13" (Mid 2012)
-   * MacBook Pro 15" (Mid 2012)
-   */
-  else if ((strcmp(buf, "MacBookPro9,1") == 0)
-	   || (strcmp(buf, "MacBookPro9,2") == 0))
-    ret = MACHINE_MACBOOKPRO_9;
-  /* MacBook Pro (Retina, 13-inch, Late 2012)
-   * MacBook Pro (Retina, 13-inch, Early 2013)
-   * MacBook Pro (Retina, Mid 2012)
-   * MacBook Pro (Retina, 15-inch, Early 2013)
-   */
-  else if ((strcmp(buf, "MacBookPro10,1") == 0)
-           || (strcmp(buf, "MacBookPro10,2") == 0))
-    ret = MACHINE_MACBOOKPRO_10;
-  /* MacBook Pro 13" (Late 2013)
-   * MacBook Pro 15" (Late 2013)
-   */
-  else if ((strcmp(buf, "MacBookPro11,1") == 0)
-            || (strcmp(buf, "MacBookPro11,2") == 0)
-            || (strcmp(buf, "MacBookPro11,3") == 0)
-            || (strcmp(buf, "MacBookPro11,4") == 0)
-            || (strcmp(buf, "MacBookPro11,5") == 0))
-    ret = MACHINE_MACBOOKPRO_11;
-   /* MacBook Pro 13" (Early 2015) */
-  else if (strcmp(buf, "MacBookPro12,1") == 0)
-    ret = MACHINE_MACBOOKPRO_12;
-  /* Core Duo MacBook (May 2006) */
-  else if (strcmp(buf, "MacBook1,1") == 0)
-    ret = MACHINE_MACBOOK_1;
-  /* Core2 Duo MacBook (November 2006) */
-  else if (strcmp(buf, "MacBook2,1") == 0)
-    ret = MACHINE_MACBOOK_2;
-  /* Core2 Duo Santa Rosa MacBook (November 2007) */
-  else if (strcmp(buf, "MacBook3,1") == 0)
-    ret = MACHINE_MACBOOK_3;
-  /* Core2 Duo MacBook (February 2008) */
-  else if (strcmp(buf, "MacBook4,1") == 0)
-    ret = MACHINE_MACBOOK_4;
-  /* Core2 Duo MacBook (October 2008) (5,2 white MacBook) */
-  else if ((strcmp(buf, "MacBook5,1") == 0) || (strcmp(buf, "MacBook5,2") == 0))
-    ret = MACHINE_MACBOOK_5;
-  /* Core2 Duo MacBook (October 2009) */
-  else if (strcmp(buf, "MacBook6,1") == 0)
-    ret = MACHINE_MACBOOK_6;
-  /* Core2 Duo MacBook (April 2010) */
-  else if (strcmp(buf, "MacBook7,1") == 0)
-    ret = MACHINE_MACBOOK_7;
-  /* MacBook Air (January 2008) */
-  else if (strcmp(buf, "MacBookAir1,1") == 0)
-    ret = MACHINE_MACBOOKAIR_1;
-  /* MacBook Air (October 2008) */
-  else if (strcmp(buf, "MacBookAir2,1") == 0)
-    ret = MACHINE_MACBOOKAIR_2;
-  /* MacBook Air 11" & 13" (October 2010) */
-  else if ((strcmp(buf, "MacBookAir3,1") == 0) || (strcmp(buf, "MacBookAir3,2") == 0))
-    ret = MACHINE_MACBOOKAIR_3;
-  /* MacBook Air 11" & 13" (July 2011) */
-  else if ((strcmp(buf, "MacBookAir4,1") == 0) || (strcmp(buf, "MacBookAir4,2") == 0))
-    ret = MACHINE_MACBOOKAIR_4;
-  /* MacBook Air 11" & 13" (June 2012) */
-  else if ((strcmp(buf, "MacBookAir5,1") == 0) || (strcmp(buf, "MacBookAir5,2") == 0))
-    ret = MACHINE_MACBOOKAIR_5;
-  /* MacBook Air 11" & 13" (Mid 2014) */
-  else if ((strcmp(buf, "MacBookAir6,1") == 0) || (strcmp(buf, "MacBookAir6,2") == 0))
-    ret = MACHINE_MACBOOKAIR_6;
-  /* MacBook Air 11" & 13" (Early 2015) */
-  else if ((strcmp(buf, "MacBookAir7,1") == 0) || (strcmp(buf, "MacBookAir7,2") == 0))
-    ret = MACHINE_MACBOOKAIR_7;
-  else
+  ret = machine_lookup(buf);
+  if (ret == MACHINE_MAC_UNKNOWN)
     logmsg(LOG_ERR, "Unknown Apple machine: %s", buf);
-
-  if (ret != MACHINE_MAC_UNKNOWN)
+  else
     logmsg(LOG_INFO, "DMI machine check: running on a %s", buf);
 
   return ret;
@@ -922,17 +447,176 @@ sig_int_term_handler(int signal)
   evloop_stop();
 }
 
+
+/* SIGHUP: configuration reload, handled from the event loop */
+static int sighup_fd = -1;
+static int reload_queued;
+
+static void
+pommed_reconfigure(int changed)
+{
+  int ret;
+
+  if (changed & CONFIG_RELOAD_FNMODE)
+    kbd_set_fnmode();
+
+  if ((changed & CONFIG_RELOAD_KBD_AUTO) && has_kbd_backlight())
+    {
+      if (kbd_cfg.auto_on)
+	kbd_backlight_inhibit_clear(KBD_INHIBIT_CFG);
+      else
+	kbd_backlight_inhibit_set(KBD_INHIBIT_CFG);
+    }
+
+  if (changed & CONFIG_RELOAD_AUDIO)
+    {
+      audio_cleanup();
+
+      ret = audio_init();
+      if ((ret < 0) && !audio_cfg.disabled)
+	logmsg(LOG_WARNING, "Audio mixer not available with the new configuration");
+    }
+
+  /* Recreates the uinput beeper */
+  if (changed & CONFIG_RELOAD_BEEP)
+    {
+      beep_cleanup();
+
+      beep_init();
+    }
+
+  if (changed & CONFIG_RELOAD_EVDEV)
+    evdev_reconfigure();
+
+  if (changed & CONFIG_RELOAD_CONTROL)
+    control_reconfigure();
+}
+
+/* Deferred work, runs once the events of the iteration are dispatched */
+static void
+pommed_reload(void *data)
+{
+  int changed;
+
+  reload_queued = 0;
+
+  logmsg(LOG_INFO, "Reloading configuration");
+
+  notify_reloading();
+
+  /* libconfuse allocates, a reload is not the steady state */
+  memcheck_disarm();
+
+  changed = config_reload();
+  if (changed >= 0)
+    {
+      pommed_reconfigure(changed);
+
+      logmsg(LOG_INFO, "Configuration reloaded");
+    }
+
+  memcheck_arm();
+
+  notify_ready(NULL);
+}
+
+/*
+ * The reload tears down and recreates event sources; it is deferred so
+ * it doesn't happen under the sources that are still to be dispatched,
+ * and back-to-back SIGHUPs collapse into one reload
+ */
+static void
+sighup_process(int fd, uint32_t events)
+{
+  struct signalfd_siginfo si;
+  int ret;
+
+  ret = read(fd, &si, sizeof(si));
+  if (ret != sizeof(si))
+    return;
+
+  if (reload_queued)
+    return;
+
+  ret = evloop_defer(pommed_reload, NULL);
+  if (ret < 0)
+    return;
+
+  reload_queued = 1;
+}
+
+static int
+sighup_init(void)
+{
+  sigset_t sigs;
+  int ret;
+
+  /* Blocked at startup, see main() */
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGHUP);
+
+  sighup_fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sighup_fd < 0)
+    {
+      logmsg(LOG_ERR, "Could not create signalfd: %s", strerror(errno));
+
+      return -1;
+    }
+
+  ret = evloop_add(sighup_fd, EPOLLIN, EVLOOP_PRIO_HOUSEKEEPING, sighup_process);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not add signalfd to event loop");
+
+      close(sighup_fd);
+      sighup_fd = -1;
+
+      return -1;
+    }
+
+  return 0;
+}
+
+static void
+sighup_cleanup(void)
+{
+  if (sighup_fd < 0)
+    return;
+
+  evloop_remove(sighup_fd);
+
+  close(sighup_fd);
+  sighup_fd = -1;
+}
+
 int
 main (int argc, char **argv)
 {
   int ret;
   int c;
+  int phase;
+  int audio_phase;
+  int evdev_phase;
+  int ndevs;
+  int audio_ok;
+  char status[128];
+  sigset_t sigs;
 
   FILE *pidfile;
   struct utsname sysinfo;
 
   machine_type machine;
 
+  startup_init();
+
+  /*
+   * SIGHUP goes to the signalfd; block it before any thread is created,
+   * they'd get it otherwise. The hooks are spawned with it unblocked.
+   */
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGHUP);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+
   while ((c = getopt(argc, argv, "fdv")) != -1)
     {
       switch (c)
@@ -977,13 +661,19 @@ main (int argc, char **argv)
   logmsg(LOG_INFO, "Copyright (C) 2006-2011 Julien BLACHE <jb@jblache.org>");
 
   /* Load our configuration */
+  phase = startup_begin("config");
   ret = config_load();
   if (ret < 0)
     {
       exit(1);
     }
+  startup_end(phase);
+
+  /* The mixer only needs the configuration, probe it in the background */
+  audio_phase = startup_spawn("audio", audio_probe);
 
   /* Identify the machine we're running on */
+  phase = startup_begin("machine");
   machine = check_machine();
   switch (machine)
     {
@@ -1004,25 +694,9 @@ main (int argc, char **argv)
 	break;
 
       default:
-	if (machine < MACHINE_LAST)
-	  {
-#ifdef __powerpc__
-	    mops = &pb_mops[machine];
-#else
-	    mops = &mb_mops[machine];
-#endif /* __powerpc__ */
-	  }
 	break;
     }
 
-  /* Runtime sanity check: catch errors in the mb_mops and pb_mops arrays */
-  if (mops->type != machine)
-    {
-      logmsg(LOG_ERR, "machine_ops mismatch: expected %d, found %d", machine, mops->type);
-
-      exit(1);
-    }
-
   if (debug)
     {
       ret = uname(&sysinfo);
@@ -1033,13 +707,28 @@ main (int argc, char **argv)
 	logdebug("System: %s %s %s\n", sysinfo.sysname, sysinfo.release, sysinfo.machine);
     }
 
-  ret = evloop_init();
+  /* Outcomes of the previous probes, if still valid */
+  probecache_load(mops->model);
+  startup_end(phase);
+
+  phase = startup_begin("evloop");
+  ret = evloop_init(general_cfg.io_uring);
   if (ret < 0)
     {
       logmsg(LOG_ERR, "Event loop initialization failed");
       exit (1);
     }
+  startup_end(phase);
 
+  /* Classify the input devices on the scan threads ... */
+  evdev_phase = startup_begin("evdev");
+  evdev_scan_start();
+
+  /*
+   * ... while we probe the LCD backlight; this one stays on the main
+   * thread, iopl() is per-thread and the actuator inherits it from us
+   */
+  phase = startup_begin("lcd");
   ret = mops->lcd_backlight_probe();
   if (ret < 0)
     {
@@ -1047,24 +736,33 @@ main (int argc, char **argv)
 
       exit(1);
     }
+  startup_end(phase);
 
-  ret = evdev_init();
-  if (ret < 1)
+  ndevs = evdev_init();
+  if (ndevs < 1)
     {
       logmsg(LOG_ERR, "No suitable event devices found");
 
       exit(1);
     }
+  startup_end(evdev_phase);
 
+  phase = startup_begin("kbd");
   kbd_backlight_init();
+  startup_end(phase);
 
-  ret = audio_init();
+  ret = startup_join(audio_phase);
+  if (ret == 0)
+    ret = audio_start();
   if (ret < 0)
     {
       logmsg(LOG_WARNING, "Audio initialization failed, audio support disabled");
     }
+  audio_ok = (ret == 0) && !audio_cfg.disabled;
 
+  phase = startup_begin("power");
   power_init();
+  startup_end(phase);
 
   if (!console)
     {
@@ -1093,27 +791,114 @@ main (int argc, char **argv)
   fprintf(pidfile, "%d\n", getpid());
   fclose(pidfile);
 
+  /* Before the hook helper forks, it must not inherit NOTIFY_SOCKET */
+  ret = notify_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Service manager notifications disabled");
+    }
+
+  /* Fork the hook helper while we're still single-threaded */
+  ret = hooks_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Hook helper creation failed, hooks disabled");
+    }
+
   /* Spawn the beep thread */
   beep_init();
 
+  ret = cd_eject_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Eject worker creation failed, CD eject disabled");
+    }
+
+  /*
+   * Spawn the actuator thread; this must happen after daemon(),
+   * and after the probes so it inherits the I/O privileges
+   */
+  ret = actuator_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Actuator thread creation failed, hardware writes will block");
+    }
+
+  ret = control_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Control socket creation failed, clients disabled");
+    }
+
+  ret = statefile_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "State file creation failed");
+    }
+
+  ret = sighup_init();
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Configuration reload on SIGHUP disabled");
+    }
+
+  /* All the probes are done, keep their outcomes for the next start */
+  probecache_save();
+
+  startup_report();
+
+  snprintf(status, sizeof(status), "%s: %d input devices, LCD backlight %d/%d, keyboard backlight %s, audio %s",
+	   mops->model, ndevs, lcd_bck_info.level, lcd_bck_info.max,
+	   (has_kbd_backlight()) ? "yes" : "no", (audio_ok) ? "on" : "off");
+
+  notify_ready(status);
+
   signal(SIGINT, sig_int_term_handler);
   signal(SIGTERM, sig_int_term_handler);
 
+  latency_init();
+
+  /* Steady state from here on, nothing may allocate */
+  memcheck_arm();
 
   do
     {
       ret = evloop_iteration();
+
+      control_update();
     }
   while (ret >= 0);
 
+  memcheck_disarm();
+
+  latency_cleanup();
+
+  notify_stopping();
+
+  sighup_cleanup();
+
+  control_cleanup();
+
+  statefile_cleanup();
+
   evdev_cleanup();
 
   beep_cleanup();
 
+  cd_eject_cleanup();
+
+  actuator_cleanup();
+
   kbd_backlight_cleanup();
 
+  audio_cleanup();
+
   power_cleanup();
 
+  hooks_cleanup();
+
+  notify_cleanup();
+
   evloop_cleanup();
 
   config_cleanup();
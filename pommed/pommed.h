@@ -85,9 +85,17 @@ typedef enum
     MACHINE_LAST
   } machine_type;
 
+/* Machine capabilities, from machines.list */
+#define MACHINE_CAP_KBD_BACKLIGHT  (1 << 0)
+#define MACHINE_CAP_KBD_PMU        (1 << 1)  /* keyboard backlight on the PMU */
+#define MACHINE_CAP_NV8600_B2      (1 << 2)  /* nv8600mgt fallback, port 0xb2 */
+#define MACHINE_CAP_NV8600_52E     (1 << 3)  /* nv8600mgt fallback, port 0x52e */
+
 struct machine_ops
 {
   machine_type type;
+  unsigned int caps;
+  const char *model;
   int (*lcd_backlight_probe) (void);
   void (*lcd_backlight_step) (int dir);
   void (*lcd_backlight_toggle) (int lvl);
@@ -0,0 +1,81 @@
+/*
+ * pommed - pommed_state.h
+ *
+ * Public interface to the state file; this header is meant to be
+ * copied into clients and has no dependency on the rest of pommed.
+ *
+ * The file holds a struct pommed_state, updated under a seqlock. Map it
+ * read-only and use pommed_state_read() to get a consistent copy of the
+ * values. The sequence number is bumped twice per update and can be
+ * waited on with FUTEX_WAIT (shared, not private). The magic is cleared
+ * when pommed exits.
+ */
+
+#ifndef __POMMED_STATE_H__
+#define __POMMED_STATE_H__
+
+#include <stdint.h>
+
+
+#define POMMED_STATE_FILE       "/run/pommed.state"
+
+#define POMMED_STATE_MAGIC      0x706f6d64  /* "pomd" */
+#define POMMED_STATE_VERSION    1
+
+
+struct pommed_state_data
+{
+  int32_t lcd_level;
+  int32_t lcd_max;
+  int32_t kbd_level;  /* 0 if no keyboard backlight */
+  int32_t kbd_max;
+  int32_t vol_level;
+  int32_t vol_max;
+  int32_t muted;
+  int32_t ac;         /* 1 online, 0 offline, < 0 unknown */
+};
+
+struct pommed_state
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;       /* odd while an update is in progress */
+  uint32_t pad;
+
+  struct pommed_state_data data;
+};
+
+
+/* Returns the sequence number the copy is consistent with, 0 if pommed is gone */
+static inline uint32_t
+pommed_state_read(const struct pommed_state *state, struct pommed_state_data *data)
+{
+  const int32_t *src;
+  int32_t *dst;
+  uint32_t seq;
+  unsigned int i;
+
+  src = (const int32_t *)&state->data;
+  dst = (int32_t *)data;
+
+  do
+    {
+      if (__atomic_load_n(&state->magic, __ATOMIC_RELAXED) != POMMED_STATE_MAGIC)
+	return 0;
+
+      seq = __atomic_load_n(&state->seq, __ATOMIC_ACQUIRE);
+      if (seq & 1)
+	continue;
+
+      for (i = 0; i < sizeof(*data) / sizeof(int32_t); i++)
+	dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+  while ((seq & 1) || (__atomic_load_n(&state->seq, __ATOMIC_RELAXED) != seq));
+
+  return seq;
+}
+
+
+#endif /* !__POMMED_STATE_H__ */
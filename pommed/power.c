@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #include <syslog.h>
@@ -29,6 +30,7 @@
 #include "evloop.h"
 #include "lcd_backlight.h"
 #include "power.h"
+#include "hooks.h"
 
 
 /* Internal API - legacy procfs interface, ACPI or PMU */
@@ -44,22 +46,25 @@ static int power_timer;
 static int
 sysfs_check_ac_state(void)
 {
-  FILE *fp;
+  int fd;
+  int n;
   char ac_state;
 
-  fp = fopen(SYSFS_POWER_AC_STATE, "r");
-  if (fp == NULL)
+  /* Polled, no stdio here: fopen() allocates */
+  fd = open(SYSFS_POWER_AC_STATE, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
     return AC_STATE_ERROR;
 
-  fread(&ac_state, 1, 1, fp);
-
-  if (ferror(fp) != 0)
+  n = read(fd, &ac_state, 1);
+  if (n < 1)
     {
-      logdebug("power: Error reading sysfs AC state: %s\n", strerror(errno));
+      logdebug("power: Error reading sysfs AC state: %s\n", (n < 0) ? strerror(errno) : "empty");
+
+      close(fd);
       return AC_STATE_ERROR;
     }
 
-  fclose(fp);
+  close(fd);
 
   if (ac_state == '1')
     return AC_STATE_ONLINE;
@@ -100,11 +105,13 @@ power_check_ac_state(int id, uint64_t ticks)
       case AC_STATE_ONLINE:
 	logdebug("power: switched to AC\n");
 	mops->lcd_backlight_toggle(LCD_ON_AC_LEVEL);
+	hooks_event(HOOK_AC_PLUGGED);
 	break;
 
       case AC_STATE_OFFLINE:
 	logdebug("power: switched to battery\n");
 	mops->lcd_backlight_toggle(LCD_ON_BATT_LEVEL);
+	hooks_event(HOOK_AC_UNPLUGGED);
 	break;
 
       case AC_STATE_ERROR:
@@ -118,6 +125,12 @@ power_check_ac_state(int id, uint64_t ticks)
 }
 
 
+int
+power_ac_state(void)
+{
+  return prev_state;
+}
+
 void
 power_init(void)
 {
@@ -21,6 +21,9 @@
 #endif
 
 
+int
+power_ac_state(void);
+
 void
 power_init(void);
 
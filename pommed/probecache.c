@@ -0,0 +1,349 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Probe cache: outcomes of the hardware probes, kept across restarts as
+ * "key value" lines. The cache is only used on the machine model and
+ * kernel release it was written on; entries are hints, every user checks
+ * them against the hardware before trusting them and probes again if the
+ * check fails.
+ *
+ * Main thread only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "pommed.h"
+#include "probecache.h"
+
+
+struct probecache_entry
+{
+  char key[PROBECACHE_KEY_LEN];
+  char value[PROBECACHE_VALUE_LEN];
+};
+
+static struct probecache_entry entries[PROBECACHE_MAX_ENTRIES];
+static int nentries;
+
+static char cache_model[PROBECACHE_VALUE_LEN];
+static char cache_kernel[PROBECACHE_VALUE_LEN];
+
+static int dirty;
+
+
+static struct probecache_entry *
+probecache_find(const char *key)
+{
+  int i;
+
+  for (i = 0; i < nentries; i++)
+    {
+      if (strcmp(entries[i].key, key) == 0)
+	return &entries[i];
+    }
+
+  return NULL;
+}
+
+const char *
+probecache_get(const char *key)
+{
+  struct probecache_entry *e;
+
+  e = probecache_find(key);
+  if (e == NULL)
+    return NULL;
+
+  return e->value;
+}
+
+void
+probecache_set(const char *key, const char *value)
+{
+  struct probecache_entry *e;
+
+  if (strchr(value, '\n') != NULL)
+    return;
+
+  e = probecache_find(key);
+  if (e == NULL)
+    {
+      if (nentries == PROBECACHE_MAX_ENTRIES)
+	{
+	  logdebug("Probe cache full, dropping %s\n", key);
+
+	  return;
+	}
+
+      e = &entries[nentries++];
+
+      strncpy(e->key, key, sizeof(e->key) - 1);
+      e->key[sizeof(e->key) - 1] = '\0';
+      e->value[0] = '\0';
+    }
+  else if (strcmp(e->value, value) == 0)
+    return;
+
+  strncpy(e->value, value, sizeof(e->value) - 1);
+  e->value[sizeof(e->value) - 1] = '\0';
+
+  dirty = 1;
+}
+
+void
+probecache_del(const char *key)
+{
+  struct probecache_entry *e;
+
+  e = probecache_find(key);
+  if (e == NULL)
+    return;
+
+  nentries--;
+  *e = entries[nentries];
+
+  dirty = 1;
+}
+
+
+static int
+probecache_read_hex(const char *slot, const char *attr, unsigned int *val)
+{
+  char path[PATH_MAX];
+  FILE *fp;
+  int ret;
+
+  ret = snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/%s", slot, attr);
+  if (ret >= sizeof(path))
+    return -1;
+
+  fp = fopen(path, "r");
+  if (fp == NULL)
+    return -1;
+
+  ret = fscanf(fp, "%x", val);
+  fclose(fp);
+
+  return (ret == 1) ? 0 : -1;
+}
+
+/* Cheap check of a cached PCI slot, against the IDs sysfs reports */
+int
+probecache_pci_id(const char *slot, unsigned int *vendor, unsigned int *device)
+{
+  if (strchr(slot, '/') != NULL)
+    return -1;
+
+  if (probecache_read_hex(slot, "vendor", vendor) < 0)
+    return -1;
+
+  if (probecache_read_hex(slot, "device", device) < 0)
+    return -1;
+
+  return 0;
+}
+
+
+static int
+probecache_read(FILE *fp)
+{
+  char line[PROBECACHE_KEY_LEN + PROBECACHE_VALUE_LEN + 2];
+  char *value;
+  int len;
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+    {
+      len = strlen(line);
+      if ((len == 0) || (line[len - 1] != '\n'))
+	return -1;
+
+      line[len - 1] = '\0';
+
+      value = strchr(line, ' ');
+      if (value == NULL)
+	return -1;
+
+      *value = '\0';
+      value++;
+
+      if (strlen(line) >= PROBECACHE_KEY_LEN)
+	return -1;
+
+      probecache_set(line, value);
+    }
+
+  return 0;
+}
+
+static int
+probecache_valid(void)
+{
+  const char *val;
+
+  val = probecache_get("version");
+  if ((val == NULL) || (atoi(val) != PROBECACHE_VERSION))
+    return 0;
+
+  val = probecache_get("model");
+  if ((val == NULL) || (strcmp(val, cache_model) != 0))
+    return 0;
+
+  val = probecache_get("kernel");
+  if ((val == NULL) || (strcmp(val, cache_kernel) != 0))
+    return 0;
+
+  return 1;
+}
+
+int
+probecache_load(const char *model)
+{
+  struct utsname un;
+  FILE *fp;
+  int ret;
+
+  nentries = 0;
+  dirty = 1;
+
+  strncpy(cache_model, model, sizeof(cache_model) - 1);
+
+  ret = uname(&un);
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "uname() failed: %s", strerror(errno));
+
+      return -1;
+    }
+
+  strncpy(cache_kernel, un.release, sizeof(cache_kernel) - 1);
+
+  fp = fopen(PROBECACHE_FILE, "r");
+  if (fp == NULL)
+    {
+      logdebug("No probe cache: %s\n", strerror(errno));
+
+      return -1;
+    }
+
+  ret = probecache_read(fp);
+  fclose(fp);
+
+  if ((ret < 0) || !probecache_valid())
+    {
+      logmsg(LOG_INFO, "Probe cache is stale, probing from scratch");
+
+      nentries = 0;
+
+      return -1;
+    }
+
+  /* Identical content, nothing to write back unless something changes */
+  dirty = 0;
+
+  logdebug("Probe cache: %d entries\n", nentries);
+
+  return 0;
+}
+
+void
+probecache_save(void)
+{
+  char tmpfile[] = PROBECACHE_FILE ".XXXXXX";
+  char version[16];
+  FILE *fp;
+  int fd;
+  int ret;
+  int i;
+
+  if (!dirty || (cache_kernel[0] == '\0'))
+    return;
+
+  snprintf(version, sizeof(version), "%d", PROBECACHE_VERSION);
+
+  probecache_set("version", version);
+  probecache_set("model", cache_model);
+  probecache_set("kernel", cache_kernel);
+
+  ret = mkdir(PROBECACHE_DIR, 0755);
+  if ((ret < 0) && (errno != EEXIST))
+    {
+      logmsg(LOG_WARNING, "Could not create %s: %s", PROBECACHE_DIR, strerror(errno));
+
+      return;
+    }
+
+  fd = mkstemp(tmpfile);
+  if (fd < 0)
+    {
+      logmsg(LOG_WARNING, "Could not write probe cache: %s", strerror(errno));
+
+      return;
+    }
+
+  fchmod(fd, 0644);
+
+  fp = fdopen(fd, "w");
+  if (fp == NULL)
+    {
+      close(fd);
+      unlink(tmpfile);
+
+      return;
+    }
+
+  for (i = 0; i < nentries; i++)
+    fprintf(fp, "%s %s\n", entries[i].key, entries[i].value);
+
+  ret = fclose(fp);
+  if (ret != 0)
+    {
+      logmsg(LOG_WARNING, "Could not write probe cache: %s", strerror(errno));
+
+      unlink(tmpfile);
+
+      return;
+    }
+
+  ret = rename(tmpfile, PROBECACHE_FILE);
+  if (ret < 0)
+    {
+      logmsg(LOG_WARNING, "Could not replace probe cache: %s", strerror(errno));
+
+      unlink(tmpfile);
+
+      return;
+    }
+
+  dirty = 0;
+
+  logdebug("Probe cache saved, %d entries\n", nentries);
+}
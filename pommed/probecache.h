@@ -0,0 +1,39 @@
+/*
+ * pommed - probecache.h
+ */
+
+#ifndef __PROBECACHE_H__
+#define __PROBECACHE_H__
+
+
+#define PROBECACHE_DIR          "/var/cache/pommed"
+#define PROBECACHE_FILE         PROBECACHE_DIR "/probe.cache"
+
+/* Bump when the meaning of an entry changes */
+#define PROBECACHE_VERSION      1
+
+#define PROBECACHE_MAX_ENTRIES  48
+#define PROBECACHE_KEY_LEN      32
+#define PROBECACHE_VALUE_LEN    128
+
+
+const char *
+probecache_get(const char *key);
+
+void
+probecache_set(const char *key, const char *value);
+
+void
+probecache_del(const char *key);
+
+int
+probecache_pci_id(const char *slot, unsigned int *vendor, unsigned int *device);
+
+int
+probecache_load(const char *model);
+
+void
+probecache_save(void);
+
+
+#endif /* !__PROBECACHE_H__ */
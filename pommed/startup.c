@@ -0,0 +1,200 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Startup timeline: the initialization phases are timed against the
+ * start of the daemon, and the independent probes can be run on a
+ * thread of their own while the main thread carries on.
+ *
+ * Asynchronous phases must not touch the event loop nor the actuator;
+ * they are joined by the main thread, which then finishes the job.
+ * All of them must be joined before daemon() forks.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <syslog.h>
+
+#include <pthread.h>
+
+#include "pommed.h"
+#include "startup.h"
+
+
+struct startup_phase
+{
+  const char *name;
+
+  struct timespec start;
+  struct timespec end;
+
+  startup_fn fn;
+  int ret;
+
+  int async;
+  int joined;
+  pthread_t thread;
+};
+
+/* One more slot for the phases that don't fit; run, but not reported */
+static struct startup_phase phases[STARTUP_MAX_PHASES + 1];
+static int nphases;
+
+static struct timespec t0;
+
+
+static double
+startup_ms(struct timespec *ts)
+{
+  return (ts->tv_sec - t0.tv_sec) * 1000.0 + (ts->tv_nsec - t0.tv_nsec) / 1000000.0;
+}
+
+static int
+startup_phase_new(const char *name)
+{
+  int phase;
+
+  if (nphases < STARTUP_MAX_PHASES)
+    phase = nphases++;
+  else
+    {
+      logdebug("Startup timeline full, not timing %s\n", name);
+
+      phase = STARTUP_MAX_PHASES;
+    }
+
+  memset(&phases[phase], 0, sizeof(phases[phase]));
+  phases[phase].name = name;
+
+  clock_gettime(CLOCK_MONOTONIC, &phases[phase].start);
+
+  return phase;
+}
+
+
+int
+startup_begin(const char *name)
+{
+  return startup_phase_new(name);
+}
+
+void
+startup_end(int phase)
+{
+  clock_gettime(CLOCK_MONOTONIC, &phases[phase].end);
+}
+
+
+static void *
+startup_thread(void *arg)
+{
+  struct startup_phase *p = arg;
+
+  p->ret = p->fn();
+
+  /* Read by the main thread once joined */
+  clock_gettime(CLOCK_MONOTONIC, &p->end);
+
+  return NULL;
+}
+
+/* Run fn on a thread of its own, or inline if that fails */
+int
+startup_spawn(const char *name, startup_fn fn)
+{
+  int phase;
+  int ret;
+
+  phase = startup_phase_new(name);
+
+  phases[phase].fn = fn;
+
+  ret = pthread_create(&phases[phase].thread, NULL, startup_thread, &phases[phase]);
+  if (ret != 0)
+    {
+      logmsg(LOG_WARNING, "Could not create %s probe thread: %s", name, strerror(ret));
+
+      startup_thread(&phases[phase]);
+
+      return phase;
+    }
+
+  phases[phase].async = 1;
+
+  return phase;
+}
+
+/* Wait for a phase started by startup_spawn(), returns its result */
+int
+startup_join(int phase)
+{
+  if (phases[phase].async && !phases[phase].joined)
+    {
+      pthread_join(phases[phase].thread, NULL);
+
+      phases[phase].joined = 1;
+    }
+
+  return phases[phase].ret;
+}
+
+
+void
+startup_report(void)
+{
+  struct timespec now;
+  char summary[256];
+  size_t len;
+  int ret;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  logdebug("\nStartup timeline:\n");
+
+  len = 0;
+  summary[0] = '\0';
+  for (i = 0; i < nphases; i++)
+    {
+      logdebug("  %-10s %8.2f -> %8.2f ms%s\n", phases[i].name,
+	       startup_ms(&phases[i].start), startup_ms(&phases[i].end),
+	       (phases[i].async) ? " (thread)" : "");
+
+      if (len >= sizeof(summary))
+	continue;
+
+      ret = snprintf(summary + len, sizeof(summary) - len, "%s%s %.1f",
+		     (i > 0) ? ", " : "", phases[i].name,
+		     startup_ms(&phases[i].end) - startup_ms(&phases[i].start));
+      if (ret > 0)
+	len += ret;
+    }
+
+  logmsg(LOG_INFO, "Started in %.1f ms (%s)", startup_ms(&now), summary);
+}
+
+void
+startup_init(void)
+{
+  nphases = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+}
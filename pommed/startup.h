@@ -0,0 +1,33 @@
+/*
+ * pommed - startup.h
+ */
+
+#ifndef __STARTUP_H__
+#define __STARTUP_H__
+
+
+#define STARTUP_MAX_PHASES     16
+
+typedef int(*startup_fn)(void);
+
+
+int
+startup_begin(const char *name);
+
+void
+startup_end(int phase);
+
+int
+startup_spawn(const char *name, startup_fn fn);
+
+int
+startup_join(int phase);
+
+void
+startup_report(void);
+
+void
+startup_init(void);
+
+
+#endif /* !__STARTUP_H__ */
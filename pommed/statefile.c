@@ -0,0 +1,172 @@
+/*
+ * pommed - Apple laptops hotkeys handler daemon
+ *
+ * Copyright (C) 2006-2008 Julien BLACHE <jb@jblache.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * State file: the state reported on the control socket, published in a
+ * file clients can map. Only the main thread writes to it, so a seqlock
+ * is all the readers need; see pommed_state.h for the reader side.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+
+#include <syslog.h>
+
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "pommed.h"
+#include "control.h"
+#include "statefile.h"
+#include "pommed_state.h"
+
+
+static struct pommed_state *state_page;
+
+
+static void
+statefile_wake(void)
+{
+  /* Shared mapping, can't use FUTEX_WAKE_PRIVATE */
+  syscall(__NR_futex, &state_page->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void
+statefile_update(struct control_state *state)
+{
+  struct pommed_state_data data;
+  int32_t *src;
+  int32_t *dst;
+  uint32_t seq;
+  int i;
+
+  if (state_page == NULL)
+    return;
+
+  data.lcd_level = state->lcd_level;
+  data.lcd_max = state->lcd_max;
+  data.kbd_level = state->kbd_level;
+  data.kbd_max = state->kbd_max;
+  data.vol_level = state->vol_level;
+  data.vol_max = state->vol_max;
+  data.muted = state->muted;
+  data.ac = state->ac;
+
+  src = (int32_t *)&data;
+  dst = (int32_t *)&state_page->data;
+
+  seq = state_page->seq;
+
+  __atomic_store_n(&state_page->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  for (i = 0; i < sizeof(data) / sizeof(int32_t); i++)
+    __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+
+  /* 0 tells readers pommed is gone */
+  seq += 2;
+  if (seq == 0)
+    seq = 2;
+
+  __atomic_store_n(&state_page->seq, seq, __ATOMIC_RELEASE);
+
+  statefile_wake();
+}
+
+int
+statefile_init(void)
+{
+  struct control_state state;
+  int fd;
+  int ret;
+
+  /* Left over by a previous instance */
+  unlink(POMMED_STATE_FILE);
+
+  fd = open(POMMED_STATE_FILE, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if (fd < 0)
+    {
+      logmsg(LOG_ERR, "Could not create state file %s: %s", POMMED_STATE_FILE, strerror(errno));
+
+      return -1;
+    }
+
+  ret = ftruncate(fd, sizeof(struct pommed_state));
+  if (ret < 0)
+    {
+      logmsg(LOG_ERR, "Could not size state file: %s", strerror(errno));
+
+      goto out_unlink;
+    }
+
+  state_page = mmap(NULL, sizeof(struct pommed_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (state_page == MAP_FAILED)
+    {
+      logmsg(LOG_ERR, "Could not map state file: %s", strerror(errno));
+
+      state_page = NULL;
+
+      goto out_unlink;
+    }
+
+  close(fd);
+
+  state_page->version = POMMED_STATE_VERSION;
+  state_page->seq = 0;
+
+  control_snapshot(&state);
+  statefile_update(&state);
+
+  __atomic_store_n(&state_page->magic, POMMED_STATE_MAGIC, __ATOMIC_RELEASE);
+
+  return 0;
+
+ out_unlink:
+  unlink(POMMED_STATE_FILE);
+  close(fd);
+
+  return -1;
+}
+
+void
+statefile_cleanup(void)
+{
+  if (state_page == NULL)
+    return;
+
+  /* Also moves readers off the sequence number they may be waiting on */
+  __atomic_store_n(&state_page->magic, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&state_page->seq, 0, __ATOMIC_RELEASE);
+  statefile_wake();
+
+  munmap(state_page, sizeof(struct pommed_state));
+  state_page = NULL;
+
+  unlink(POMMED_STATE_FILE);
+}
@@ -0,0 +1,22 @@
+/*
+ * pommed - statefile.h
+ */
+
+#ifndef __STATEFILE_H__
+#define __STATEFILE_H__
+
+
+struct control_state;
+
+
+void
+statefile_update(struct control_state *state);
+
+int
+statefile_init(void);
+
+void
+statefile_cleanup(void);
+
+
+#endif /* !__STATEFILE_H__ */
@@ -31,6 +31,8 @@
 #include "pommed.h"
 #include "conffile.h"
 #include "lcd_backlight.h"
+#include "actuator.h"
+#include "probecache.h"
 
 
 enum {
@@ -192,22 +194,44 @@ sysfs_backlight_get_max(void)
 static void
 sysfs_backlight_set(int value)
 {
-  FILE *fp;
+  int fd;
+  int n;
+  char buffer[16];
 
   if (bck_driver == SYSFS_DRIVER_NONE)
     return;
 
-  fp = fopen(brightness[bck_driver], "a");
-  if (fp == NULL)
+  fd = open(brightness[bck_driver], O_WRONLY | O_APPEND);
+  if (fd < 0)
     {
       logmsg(LOG_WARNING, "Could not open sysfs brightness node: %s", strerror(errno));
 
       return;
     }
 
-  fprintf(fp, "%d", value);
+  n = snprintf(buffer, sizeof(buffer), "%d", value);
 
-  fclose(fp);
+  if (write(fd, buffer, n) != n)
+    logmsg(LOG_WARNING, "Could not write sysfs brightness node: %s", strerror(errno));
+
+  close(fd);
+}
+
+/* Runs on the actuator thread */
+static void
+sysfs_backlight_write(int value, int arg)
+{
+  sysfs_backlight_set(value);
+}
+
+/* While a write is queued, the hardware lags behind our own state */
+static int
+sysfs_backlight_current(void)
+{
+  if (actuator_busy(ACT_LCD))
+    return lcd_bck_info.level;
+
+  return sysfs_backlight_get();
 }
 
 void
@@ -219,7 +243,7 @@ sysfs_backlight_step(int dir)
   if (bck_driver == SYSFS_DRIVER_NONE)
     return;
 
-  val = sysfs_backlight_get();
+  val = sysfs_backlight_current();
 
   if (dir == STEP_UP)
     {
@@ -242,7 +266,7 @@ sysfs_backlight_step(int dir)
   else
     return;
 
-  sysfs_backlight_set(newval);
+  actuator_submit(ACT_LCD, newval, 0);
 
   lcd_bck_info.level = newval;
 }
@@ -259,7 +283,7 @@ sysfs_backlight_toggle(int lvl)
   if (lcd_sysfs_cfg.on_batt == 0)
     return;
 
-  val = sysfs_backlight_get();
+  val = sysfs_backlight_current();
   if (val != lcd_bck_info.level)
     {
       lcd_bck_info.level = val;
@@ -276,7 +300,7 @@ sysfs_backlight_toggle(int lvl)
 
 	logdebug("LCD switching to AC level\n");
 
-	sysfs_backlight_set(lcd_bck_info.ac_lvl);
+	actuator_submit(ACT_LCD, lcd_bck_info.ac_lvl, 0);
 
 	lcd_bck_info.level = lcd_bck_info.ac_lvl;
 	break;
@@ -289,7 +313,7 @@ sysfs_backlight_toggle(int lvl)
 
 	lcd_bck_info.ac_lvl = lcd_bck_info.level;
 
-	sysfs_backlight_set(lcd_sysfs_cfg.on_batt);
+	actuator_submit(ACT_LCD, lcd_sysfs_cfg.on_batt, 0);
 
 	lcd_bck_info.level = lcd_sysfs_cfg.on_batt;
 	break;
@@ -322,11 +346,14 @@ sysfs_backlight_toggle_kernel(int lvl)
 
 
 /* We can't fix the config until we know the max backlight value,
- * so, here, fix_config() is static and called at probe time
+ * so, here, fix_config() does nothing until called at probe time
  */
-static void
+void
 sysfs_backlight_fix_config(void)
 {
+  if (bck_driver == SYSFS_DRIVER_NONE)
+    return;
+
   if (lcd_sysfs_cfg.init < 0)
     lcd_sysfs_cfg.init = -1;
 
@@ -369,6 +396,8 @@ sysfs_backlight_probe(int driver)
 
   bck_driver = driver;
 
+  actuator_register(ACT_LCD, sysfs_backlight_write);
+
   lcd_bck_info.max = sysfs_backlight_get_max();
 
   /* Now we can fix the config */
@@ -414,44 +443,53 @@ nvidia_sysfs_backlight_probe(void)
 int
 mbp_sysfs_backlight_probe(void)
 {
+  const char *cached;
   int drv;
   int ret;
 
+  /* Driver found last time, if it's still there */
+  cached = probecache_get("sysfs.brightness");
+
+  for (drv = SYSFS_DRIVER_NONE + 1; (cached != NULL) && (drv < SYSFS_DRIVER_MAX); drv++)
+    {
+      if (strcmp(brightness[drv], cached) == 0)
+	{
+	  ret = sysfs_backlight_probe(drv);
+	  if (ret == 0)
+	    return 0;
+
+	  break;
+	}
+    }
+
   for (drv = SYSFS_DRIVER_NONE + 1; drv < SYSFS_DRIVER_MAX; drv++)
     {
       ret = sysfs_backlight_probe(drv);
       if (ret == 0)
-	return 0;
+	{
+	  probecache_set("sysfs.brightness", brightness[drv]);
+
+	  return 0;
+	}
     }
 
   /* Probe failed, wire up native driver instead */
-  switch (mops->type)
+  if (!(mops->caps & (MACHINE_CAP_NV8600_B2 | MACHINE_CAP_NV8600_52E)))
+    {
+      logmsg(LOG_ERR, "sysfs backlight probe failed, no fallback for this machine");
+      return -1;
+    }
+
+  logmsg(LOG_INFO, "sysfs backlight probe failed, falling back to nv8600mgt");
+
+  ret = nv8600mgt_backlight_probe();
+  if (ret == 0)
     {
-      case MACHINE_MACBOOKPRO_3:
-      case MACHINE_MACBOOKPRO_4:
-      case MACHINE_MACBOOKPRO_5:
-      case MACHINE_MACBOOKPRO_6:
-      case MACHINE_MACBOOK_5:
-      case MACHINE_MACBOOK_6:
-      case MACHINE_MACBOOKAIR_2:
-      case MACHINE_MACBOOKAIR_3:
-      case MACHINE_MACBOOKAIR_4:
-	logmsg(LOG_INFO, "sysfs backlight probe failed, falling back to nv8600mgt");
-
-	ret = nv8600mgt_backlight_probe();
-	if (ret == 0)
-	  {
-	    /* Wire up fallback native driver */
-	    mops->lcd_backlight_step = nv8600mgt_backlight_step;
-	    mops->lcd_backlight_toggle = nv8600mgt_backlight_toggle;
-	  }
-	return ret;
-
-      default:
-	logmsg(LOG_ERR, "sysfs backlight probe failed, no fallback for this machine");
-	return -1;
+      /* Wire up fallback native driver */
+      mops->lcd_backlight_step = nv8600mgt_backlight_step;
+      mops->lcd_backlight_toggle = nv8600mgt_backlight_toggle;
     }
 
-  return -1;
+  return ret;
 }
 #endif